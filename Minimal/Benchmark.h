@@ -0,0 +1,47 @@
+#pragma once
+//
+//  Benchmark.h
+//  A tiny timing harness for the --bench command line mode.
+//
+
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+namespace bench {
+
+	// Runs body(i) for every i in [0, count), `rounds` times over, and returns the best
+	// round in nanoseconds per call. The first round also warms the caches.
+	// body should write its result somewhere the caller reads afterwards, or the
+	// optimizer may drop the work.
+	template <typename Body>
+	double nanosecondsPerCall(size_t count, Body body, int rounds = 7) {
+		double best = 1.0e30;
+		for (int round = 0; round < rounds; ++round) {
+			auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < count; ++i) {
+				body(i);
+			}
+			std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+			best = std::min(best, elapsed.count() / count);
+		}
+		return best;
+	}
+
+	// One line of results; with a baseline the speedup over it is printed too
+	inline void report(std::ostream & out, const char * name, double value, double baseline = 0.0, const char * unit = "ns") {
+		out << "  " << std::left << std::setw(32) << name << std::right << std::fixed << std::setprecision(2)
+			<< std::setw(10) << value << " " << unit;
+		if (baseline > 0.0) {
+			out << "  (" << baseline / value << "x)";
+		}
+		out << std::endl;
+		out.unsetf(std::ios::floatfield);
+	}
+}
+
+#endif
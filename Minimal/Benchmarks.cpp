@@ -0,0 +1,707 @@
+//
+//  Benchmarks.cpp
+//  The --bench microbenchmarks: each engine system against the code it replaced
+//  or a plain scan, on synthetic loads, no headset or GL context needed.
+//
+
+#include "Benchmarks.h"
+
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "Benchmark.h"
+#include "RigidMath.h"
+#include "PosePipeline.h"
+#include "SceneGraph.h"
+#include "EntityStore.h"
+#include "SceneFile.h"
+#include "Bvh.h"
+#include "RayPick.h"
+#include "HiZ.h"
+#include "DepthReadback.h"
+#include "JobSystem.h"
+#include "ImageCache.h"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+using glm::quat;
+
+using namespace std;
+
+static float maxAbsDifference(const mat4 & a, const mat4 & b) {
+	float difference = 0.0f;
+	for (int column = 0; column < 4; ++column) {
+		for (int row = 0; row < 4; ++row) {
+			difference = std::max(difference, fabsf(a[column][row] - b[column][row]));
+		}
+	}
+	return difference;
+}
+
+static float maxAbsDifference(const quat & a, const quat & b) {
+	return std::max(std::max(fabsf(a.x - b.x), fabsf(a.y - b.y)), std::max(fabsf(a.z - b.z), fabsf(a.w - b.w)));
+}
+
+// The rigid kernels against glm on random poses within a room scale volume.
+// Returns false if any result is further from glm than float rounding explains:
+// a tenth of a millimetre, where a wrong sign or swapped lane is off by metres.
+static bool rigidMathCheck(std::ostream & out) {
+	const size_t count = 10000;
+	const float tolerance = 1.0e-4f;
+	std::mt19937 random(2017);
+	std::normal_distribution<float> gaussian;
+	std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+	auto randomPose = [&](quat & q, vec3 & t) {
+		q = glm::normalize(quat(gaussian(random), gaussian(random), gaussian(random), gaussian(random)));
+		t = vec3(offset(random), offset(random), offset(random));
+	};
+
+	float poseError = 0.0f, inverseError = 0.0f, viewError = 0.0f, composeError = 0.0f;
+	for (size_t i = 0; i < count; ++i) {
+		quat a, b;
+		vec3 t, unused;
+		randomPose(a, t);
+		randomPose(b, unused);
+		const mat4 pose = glm::translate(mat4(), t) * glm::mat4_cast(a);
+		const mat4 view = glm::inverse(pose);
+		poseError = std::max(poseError, maxAbsDifference(rigid::poseToMatrix(a, t), pose));
+		inverseError = std::max(inverseError, maxAbsDifference(rigid::inverse(pose), view));
+		viewError = std::max(viewError, maxAbsDifference(rigid::viewFromPose(a, t), view));
+		composeError = std::max(composeError, maxAbsDifference(rigid::compose(a, b), a * b));
+	}
+
+	const bool passed = std::max(std::max(poseError, inverseError), std::max(viewError, composeError)) <= tolerance;
+	out << "rigid transforms against glm (max abs error over " << count << " random poses)" << endl;
+	out << "  pose to matrix " << poseError << ", inverse " << inverseError << ", pose to view " << viewError
+		<< ", quaternion compose " << composeError << endl;
+	if (!passed) {
+		out << "  FAILED: above the tolerance of " << tolerance << endl;
+	}
+	return passed;
+}
+
+// Rigid transform kernels against the glm code they replaced
+static void rigidMathBenchmarks(std::ostream & out) {
+	const size_t count = 4096;
+	std::vector<quat> orientations(count);
+	std::vector<vec3> positions(count);
+	for (size_t i = 0; i < count; ++i) {
+		float angle = (float)i * 0.01f;
+		orientations[i] = glm::angleAxis(angle, glm::normalize(vec3(sinf(angle), 1.0f, cosf(angle * 0.7f))));
+		positions[i] = vec3(sinf(angle), 1.6f + 0.1f * cosf(angle), -0.5f * angle);
+	}
+	std::vector<mat4> matrices(count);
+	std::vector<quat> quats(count);
+	float checksum = 0.0f;
+	auto sum = [&]() {
+		for (size_t i = 0; i < count; ++i) {
+			checksum += matrices[i][3].x + quats[i].w;
+		}
+	};
+
+	out << "rigid transforms (per call)" << endl;
+
+	double glmPose = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = glm::translate(mat4(), positions[i]) * glm::mat4_cast(orientations[i]);
+	});
+	bench::report(out, "pose to matrix, glm", glmPose);
+	sum();
+	double rigidPose = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = rigid::poseToMatrix(orientations[i], positions[i]);
+	});
+	bench::report(out, "pose to matrix, rigid", rigidPose, glmPose);
+	sum();
+
+	double glmInverse = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = glm::inverse(matrices[i]);
+	});
+	bench::report(out, "inverse, glm", glmInverse);
+	sum();
+	double rigidInverse = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = rigid::inverse(matrices[i]);
+	});
+	bench::report(out, "inverse, rigid", rigidInverse, glmInverse);
+	sum();
+
+	double glmView = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = glm::inverse(glm::translate(mat4(), positions[i]) * glm::mat4_cast(orientations[i]));
+	});
+	bench::report(out, "pose to view, glm", glmView);
+	sum();
+	double rigidView = bench::nanosecondsPerCall(count, [&](size_t i) {
+		matrices[i] = rigid::viewFromPose(orientations[i], positions[i]);
+	});
+	bench::report(out, "pose to view, rigid", rigidView, glmView);
+	sum();
+
+	double glmCompose = bench::nanosecondsPerCall(count, [&](size_t i) {
+		quats[i] = orientations[i] * orientations[(i + 1) % count];
+	});
+	bench::report(out, "quaternion compose, glm", glmCompose);
+	sum();
+	double rigidCompose = bench::nanosecondsPerCall(count, [&](size_t i) {
+		quats[i] = rigid::compose(orientations[i], orientations[(i + 1) % count]);
+	});
+	bench::report(out, "quaternion compose, rigid", rigidCompose, glmCompose);
+	sum();
+
+	out << "  (checksum " << checksum << ")" << endl;
+}
+
+// The head pose pipeline against the per-eye code it replaced, on a random head
+// trajectory: 30 frames of tracking, then 90 in each freeze mode. The old code
+// copied matrix columns of each eye from the previous frame; the new one freezes
+// the head and places the eyes around it. With both held, or none, the eyes must
+// match. Holding only one of the two, the eyes now stay either side of the head,
+// so they are compared at the centre of the head, and the eye difference printed.
+// Super-rotation replaced an Euler angle decomposition that flipped near the
+// poles, so it is checked against its definition instead: yaw doubled, the tilt
+// left alone. Returns false if anything is off by more than float rounding.
+static bool posePipelineCheck(std::ostream & out) {
+	const float tolerance = 1.0e-4f;
+	const float halfIod = 0.032f;
+	std::mt19937 random(2017);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	PosePipeline pipeline;
+	FreezePositionStage freezePosition;
+	FreezeOrientationStage freezeOrientation;
+	SuperRotationStage superRotation;
+	SmoothingStage smoothing;
+	pipeline.add(freezePosition);
+	pipeline.add(freezeOrientation);
+	pipeline.add(superRotation);
+	pipeline.add(smoothing);
+
+	// The old eye matrices: translate(head) * rotation * translate(eye offset)
+	auto trackedEye = [](const RigidPose & head, float offset) {
+		return glm::translate(mat4(), head.position) * glm::mat4_cast(head.orientation) * glm::translate(mat4(), vec3(offset, 0.0f, 0.0f));
+	};
+	auto pipelineEye = [](const RigidPose & head, float offset) {
+		return rigid::poseToMatrix(head.orientation, head.position + head.orientation * vec3(offset, 0.0f, 0.0f));
+	};
+
+	out << "head pose pipeline against the per-eye code it replaced (max abs error)" << endl;
+	bool passed = true;
+	double time = 1.0;
+	const char * modeNames[4] = { "tracking", "position frozen", "orientation frozen", "both frozen" };
+	for (int mode = 0; mode < 4; ++mode) {
+		RigidPose head;
+		head.position = vec3(0.0f, 1.6f, 0.0f);
+		vec3 spin(unit(random), unit(random), unit(random));
+		vec3 velocity(unit(random), unit(random), unit(random));
+		mat4 previousEyes[2] = { trackedEye(head, -halfIod), trackedEye(head, halfIod) };
+		mat4 previousCentre = trackedEye(head, 0.0f);
+		float eyeError = 0.0f, centreError = 0.0f;
+		for (int frame = 0; frame < 120; ++frame) {
+			const bool frozen = frame >= 30;
+			const bool positionFrozen = frozen && (mode == 1 || mode == 3);
+			const bool orientationFrozen = frozen && (mode == 2 || mode == 3);
+			head.orientation = glm::normalize(glm::angleAxis(0.05f, glm::normalize(spin)) * head.orientation);
+			head.position += velocity * 0.01f;
+			spin += vec3(unit(random), unit(random), unit(random)) * 0.2f;
+			time += 1.0 / 90.0;
+
+			freezePosition.enabled = positionFrozen;
+			freezeOrientation.enabled = orientationFrozen;
+			const RigidPose processed = pipeline.process(head, time);
+
+			// the old per-eye column copies, the centre of the head treated as a third eye
+			mat4 * previous[3] = { &previousEyes[0], &previousEyes[1], &previousCentre };
+			const float offsets[3] = { -halfIod, halfIod, 0.0f };
+			for (int eye = 0; eye < 3; ++eye) {
+				mat4 old = trackedEye(head, offsets[eye]);
+				if (positionFrozen) {
+					old[3] = (*previous[eye])[3];
+				}
+				if (orientationFrozen) {
+					old[0] = (*previous[eye])[0];
+					old[1] = (*previous[eye])[1];
+					old[2] = (*previous[eye])[2];
+				}
+				*previous[eye] = old;
+				const float error = maxAbsDifference(pipelineEye(processed, offsets[eye]), old);
+				if (eye < 2) {
+					eyeError = std::max(eyeError, error);
+				}
+				else {
+					centreError = std::max(centreError, error);
+				}
+			}
+		}
+		const bool eyesMustMatch = mode == 0 || mode == 3;
+		const bool modePassed = centreError <= tolerance && (!eyesMustMatch || eyeError <= tolerance);
+		out << "  " << modeNames[mode] << ": head " << centreError << ", eyes " << eyeError
+			<< (eyesMustMatch ? "" : " (placed around the held head now)") << (modePassed ? "" : "  FAILED") << endl;
+		passed = passed && modePassed;
+	}
+
+	// Super-rotation: a yaw about up after a tilt about a level axis comes out with
+	// the yaw doubled and the same tilt
+	freezePosition.enabled = false;
+	freezeOrientation.enabled = false;
+	superRotation.enabled = true;
+	float superError = 0.0f;
+	const vec3 up(0.0f, 1.0f, 0.0f);
+	for (int i = 0; i < 10000; ++i) {
+		const float yaw = unit(random) * 3.14159265f;
+		const float tilt = unit(random) * 1.4f;
+		const quat tiltRotation = glm::angleAxis(tilt, glm::normalize(vec3(unit(random), 0.0f, unit(random))));
+		RigidPose head;
+		head.orientation = glm::angleAxis(yaw, up) * tiltRotation;
+		time += 1.0 / 90.0;
+		const quat result = pipeline.process(head, time).orientation;
+		const quat expected = glm::angleAxis(2.0f * yaw, up) * tiltRotation;
+		const quat negated(-expected.w, -expected.x, -expected.y, -expected.z); // the same rotation
+		superError = std::max(superError, std::min(maxAbsDifference(result, expected), maxAbsDifference(result, negated)));
+	}
+	out << "  super-rotation against doubled yaw: " << superError << (superError <= tolerance ? "" : "  FAILED") << endl;
+	return passed && superError <= tolerance;
+}
+
+// One frame of the entity systems over a large synthetic scene: a tenth of the
+// objects move, then transforms, culling and draw packets run over all of them
+static void entityBenchmarks(std::ostream & out) {
+	const unsigned int groups = 1000;
+	const unsigned int perGroup = 100;
+	const unsigned int count = groups * perGroup;
+
+	SceneGraph graph;
+	EntityStore store;
+	store.reserve(count);
+	std::vector<SceneGraph::Node> groupNodes;
+	for (unsigned int g = 0; g < groups; ++g) {
+		float angle = (float)g * 0.37f;
+		groupNodes.push_back(graph.create(SceneGraph::None,
+			glm::translate(mat4(1.0f), vec3(40.0f * sinf(angle), 0.0f, 40.0f * cosf(angle)))));
+		for (unsigned int i = 0; i < perGroup; ++i) {
+			mat4 local = glm::translate(mat4(1.0f), vec3((float)(i % 10) - 4.5f, (float)(i / 10) - 4.5f, 0.0f));
+			SceneGraph::Node node = graph.create(groupNodes.back(), glm::scale(local, vec3(0.3f)));
+			store.create(node, (uint16_t)(i % 4), (uint16_t)(g % 8), sqrtf(3.0f), LAYER_CUBES);
+		}
+	}
+	graph.update();
+	store.updateTransforms(graph);
+
+	glm::vec4 planes[6];
+	mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.01f, 1000.0f);
+	frustumPlanes(projection * glm::lookAt(vec3(0.0f, 1.6f, 0.0f), vec3(0.0f, 1.6f, -1.0f), vec3(0.0f, 1.0f, 0.0f)), planes);
+	std::vector<uint8_t> visible;
+	std::vector<DrawPacket> packets;
+	packets.reserve(count);
+
+	const size_t frames = 20;
+	unsigned int frame = 0;
+	double transformTotal = 0.0, cullTotal = 0.0, packetTotal = 0.0;
+	unsigned int moved = 0, visibleCount = 0;
+	auto timed = [](double & total, std::function<void()> work) {
+		auto start = std::chrono::steady_clock::now();
+		work();
+		total += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+	double frameNs = bench::nanosecondsPerCall(frames, [&](size_t) {
+		++frame;
+		// every tenth group moves this frame, and with it 100 entities
+		for (unsigned int g = frame % 10; g < groups; g += 10) {
+			mat4 local = graph.local(groupNodes[g]);
+			local[3].y = 0.1f * sinf((float)frame * 0.1f + (float)g);
+			graph.setLocal(groupNodes[g], local);
+		}
+		timed(transformTotal, [&] {
+			graph.update();
+			moved = store.updateTransforms(graph);
+		});
+		timed(cullTotal, [&] { visibleCount = store.cull(planes, LAYER_CUBES, visible); });
+		timed(packetTotal, [&] { store.buildDrawPackets(visible, packets); });
+	}, 5);
+
+	const double runs = frames * 5.0;
+	out << "entity systems, " << count << " entities (" << moved << " moved, " << visibleCount << " visible per frame)" << endl;
+	bench::report(out, "transform update", transformTotal / runs, 0.0, "ms");
+	bench::report(out, "frustum cull", cullTotal / runs, 0.0, "ms");
+	bench::report(out, "draw packets", packetTotal / runs, 0.0, "ms");
+	bench::report(out, "whole frame, best round", frameNs / 1.0e6, 0.0, "ms");
+
+	// Both eyes of a 64 mm IPD headset: separately, then combined frustum first
+	mat4 eyeViewProjections[2];
+	glm::vec4 eyePlanes[2][6], combined[6];
+	for (int eye = 0; eye < 2; ++eye) {
+		vec3 eyePosition(eye ? 0.032f : -0.032f, 1.6f, 0.0f);
+		eyeViewProjections[eye] = projection * glm::lookAt(eyePosition, eyePosition + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+		frustumPlanes(eyeViewProjections[eye], eyePlanes[eye]);
+	}
+	culling::combinedFrustumPlanes(eyeViewProjections, combined);
+	std::vector<uint8_t> visibleRight;
+	double separateMs = bench::nanosecondsPerCall(frames, [&](size_t) {
+		store.cull(eyePlanes[0], LAYER_CUBES, visible);
+		store.cull(eyePlanes[1], LAYER_CUBES, visibleRight);
+	}) / 1.0e6;
+	culling::StereoStats stats;
+	double stereoMs = bench::nanosecondsPerCall(frames, [&](size_t) {
+		stats = store.cullStereo(combined, eyePlanes[0], eyePlanes[1], LAYER_CUBES, visible);
+	}) / 1.0e6;
+	out << "stereo cull, " << stats.rejected << " of " << stats.tested << " rejected by the combined frustum" << endl;
+	bench::report(out, "each eye separately", separateMs, 0.0, "ms");
+	bench::report(out, "combined, then per eye", stereoMs, separateMs, "ms");
+}
+
+// BVH build, refit and queries against linear scans of the same bounds
+static void bvhBenchmarks(std::ostream & out) {
+	const unsigned int count = 100000;
+	std::vector<float> x(count), y(count), z(count), radius(count);
+	std::vector<uint32_t> layers(count);
+	unsigned int seed = 1;
+	auto random = [&seed](float low, float high) {
+		seed = seed * 1664525u + 1013904223u;
+		return low + (high - low) * (float)(seed >> 8) / 16777216.0f;
+	};
+	for (unsigned int i = 0; i < count; ++i) {
+		x[i] = random(-100.0f, 100.0f);
+		y[i] = random(-10.0f, 10.0f);
+		z[i] = random(-100.0f, 100.0f);
+		radius[i] = random(0.1f, 0.6f);
+		layers[i] = LAYER_CUBES;
+	}
+	culling::Spheres spheres = { x.data(), y.data(), z.data(), radius.data(), layers.data(), count };
+
+	Bvh bvh;
+	double buildMs = bench::nanosecondsPerCall(1, [&](size_t) { bvh.build(spheres); }, 3) / 1.0e6;
+	double refitMs = bench::nanosecondsPerCall(1, [&](size_t) {
+		for (unsigned int i = 0; i < count; i += 10) y[i] += 0.01f; // a tenth of the objects move
+		bvh.refit(spheres);
+	}, 7) / 1.0e6;
+	out << "bvh, " << count << " objects, " << bvh.nodeCount() << " nodes, depth " << bvh.depth() << endl;
+	bench::report(out, "SAH build", buildMs, 0.0, "ms");
+	bench::report(out, "refit", refitMs, 0.0, "ms");
+
+	// a narrow view sees a small part of the scene, where the tree pays off
+	glm::vec4 planes[6];
+	mat4 projection = glm::perspective(glm::radians(30.0f), 1.0f, 0.01f, 1000.0f);
+	frustumPlanes(projection * glm::lookAt(vec3(0.0f, 1.6f, 0.0f), vec3(0.0f, 1.6f, -1.0f), vec3(0.0f, 1.0f, 0.0f)), planes);
+	std::vector<uint8_t> visible(count);
+	std::vector<uint32_t> found;
+	found.reserve(count);
+	unsigned int linearVisible = 0, bvhVisible = 0;
+	double linearCull = bench::nanosecondsPerCall(20, [&](size_t) {
+		linearVisible = culling::cull(spheres, LAYER_CUBES, planes, visible.data());
+	}) / 1.0e6;
+	double bvhCull = bench::nanosecondsPerCall(20, [&](size_t) {
+		found.clear();
+		bvhVisible = bvh.queryFrustum(spheres, planes, LAYER_CUBES, found);
+	}) / 1.0e6;
+	out << "frustum query, 30 degree view, " << bvhVisible << " visible (linear " << linearVisible << ")" << endl;
+	bench::report(out, "linear SSE cull", linearCull, 0.0, "ms");
+	bench::report(out, "bvh query", bvhCull, linearCull, "ms");
+
+	const size_t rays = 256;
+	std::vector<vec3> origins(rays), directions(rays);
+	for (size_t r = 0; r < rays; ++r) {
+		origins[r] = vec3(random(-10.0f, 10.0f), 1.2f, random(-10.0f, 10.0f));
+		directions[r] = glm::normalize(vec3(random(-1.0f, 1.0f), random(-0.1f, 0.1f), random(-1.0f, 1.0f)));
+	}
+	uint32_t hits = 0;
+	double linearRay = bench::nanosecondsPerCall(rays, [&](size_t r) {
+		uint32_t nearest = Bvh::NoHit;
+		float nearestDistance = 100.0f;
+		for (unsigned int i = 0; i < count; ++i) {
+			vec3 toCenter = vec3(x[i], y[i], z[i]) - origins[r];
+			float along = glm::dot(toCenter, directions[r]);
+			float miss2 = glm::dot(toCenter, toCenter) - along * along;
+			if (along > 0.0f && miss2 <= radius[i] * radius[i] && along < nearestDistance) {
+				nearestDistance = along;
+				nearest = i;
+			}
+		}
+		hits += nearest != Bvh::NoHit;
+	}, 3);
+	double bvhRay = bench::nanosecondsPerCall(rays, [&](size_t r) {
+		hits += bvh.raycast(spheres, origins[r], directions[r], 100.0f, LAYER_CUBES).item != Bvh::NoHit;
+	});
+	out << "ray casts (" << hits << " hits)" << endl;
+	bench::report(out, "linear scan", linearRay / 1000.0, 0.0, "us");
+	bench::report(out, "bvh", bvhRay / 1000.0, linearRay / 1000.0, "us");
+}
+
+// Both controllers' rays against 100k cube instances, as handPosesUpdated picks them
+static void rayPickBenchmarks(std::ostream & out, const BenchmarkSettings & settings) {
+	const unsigned int count = 100000;
+	unsigned int seed = 7;
+	auto random = [&seed](float low, float high) {
+		seed = seed * 1664525u + 1013904223u;
+		return low + (high - low) * (float)(seed >> 8) / 16777216.0f;
+	};
+	RayPicker picker;
+	picker.reserve(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		mat4 world = glm::translate(mat4(1.0f), vec3(random(-100.0f, 100.0f), random(-10.0f, 10.0f), random(-100.0f, 100.0f)));
+		picker.addCube(i, glm::scale(world, vec3(0.3f)));
+	}
+	picker.finish();
+	const size_t frames = 256;
+	std::vector<RayPicker::Ray> rays(2 * frames);
+	for (RayPicker::Ray & ray : rays) {
+		ray.origin = vec3(random(-0.5f, 0.5f), random(1.0f, 1.5f), random(-0.5f, 0.5f));
+		ray.direction = glm::normalize(vec3(random(-1.0f, 1.0f), random(-0.2f, 0.2f), random(-1.0f, 1.0f)));
+	}
+	unsigned int hits = 0;
+	auto frame = [&](size_t f) {
+		RayPicker::Hit found[2];
+		picker.pick(&rays[2 * f], 2, found, settings.pickDistance);
+		hits += (found[0].id != RayPicker::NoHit) + (found[1].id != RayPicker::NoHit);
+	};
+	picker.setAvx(false);
+	double sse = bench::nanosecondsPerCall(frames, frame, 3) / 1000.0;
+	picker.setAvx(true);
+	double avx = bench::nanosecondsPerCall(frames, frame, 3) / 1000.0;
+	// the way the app calls it, stopping early at the budget
+	unsigned int complete = 0;
+	for (size_t f = 0; f < frames; ++f) {
+		RayPicker::Hit found[2];
+		complete += picker.pick(&rays[2 * f], 2, found, settings.pickDistance, settings.pickBudgetMicroseconds).complete;
+	}
+	out << "ray picking, 2 rays x " << count << " cubes per frame (" << hits << " hits)" << endl;
+	bench::report(out, "SSE, 4 boxes per test", sse, 0.0, "us");
+	if (picker.avx()) {
+		bench::report(out, "AVX, 8 boxes per test", avx, sse, "us");
+	}
+	else {
+		out << "  AVX not available on this CPU" << endl;
+	}
+	out << "  " << complete << " of " << frames << " frames finished within the " << (int)settings.pickBudgetMicroseconds << " us budget" << endl;
+}
+
+// Opening a large compiled scene against compiling it from text every time
+static void sceneFileBenchmarks(std::ostream & out) {
+	const unsigned int count = 100000;
+	const char * textPath = "bench_scene.txt";
+	const char * binaryPath = "bench_scene.bin";
+	{
+		std::ofstream text(textPath);
+		text << "texture t a b c d e f\nmesh m t cube\nnode root -\n";
+		for (unsigned int i = 0; i < count; ++i) {
+			text << "node n" << i << " root translate " << (i % 100) << " " << (i / 100 % 100) << " " << (i / 10000)
+				<< " scale 0.3\nobject n" << i << " m cubes 1.7320508\n";
+		}
+	}
+	scene::compile(textPath, binaryPath);
+
+	double parseMs = bench::nanosecondsPerCall(1, [&](size_t) {
+		scene::Compiler compiler;
+		compiler.parse(textPath);
+	}, 3) / 1.0e6;
+	uint32_t objects = 0;
+	double openMs = bench::nanosecondsPerCall(1, [&](size_t) {
+		scene::SceneFile file;
+		file.open(binaryPath);
+		objects = file.objectCount();
+	}, 7) / 1.0e6;
+
+	out << "scene file, " << objects << " objects" << endl;
+	bench::report(out, "parse text", parseMs, 0.0, "ms");
+	bench::report(out, "map and fix up binary", openMs, parseMs, "ms");
+	remove(textPath);
+	remove(binaryPath);
+}
+
+// A dense cube field behind a wall: last frame's depth is reprojected after a small
+// head turn and the frustum-culled cubes are tested against the pyramids
+static void occlusionBenchmarks(std::ostream & out) {
+	const int side = 40;
+	const unsigned int count = side * side * side;
+	std::vector<float> x(count), y(count), z(count), radius(count), extent(count, 0.3f);
+	std::vector<uint32_t> layers(count, LAYER_CUBES);
+	for (unsigned int i = 0; i < count; ++i) {
+		x[i] = (float)(i % side) * 1.5f - 30.0f;
+		y[i] = (float)(i / side % side) * 1.5f - 30.0f;
+		z[i] = -3.0f - (float)(i / (side * side)) * 1.5f;
+		radius[i] = 0.3f * 1.7320508f;
+	}
+	culling::Spheres spheres = { x.data(), y.data(), z.data(), radius.data(), layers.data(), count };
+	culling::Boxes boxes = { x.data(), y.data(), z.data(), extent.data(), extent.data(), extent.data(), layers.data(), count };
+
+	const mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.01f, 1000.0f);
+	const float iod = 0.064f;
+	mat4 previous[2], current[2];
+	DepthGrid grids[2];
+	for (int eye = 0; eye < 2; ++eye) {
+		vec3 offset((eye ? 0.5f : -0.5f) * iod, 0.0f, 0.0f);
+		previous[eye] = projection * glm::lookAt(offset, offset + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+		current[eye] = previous[eye] * glm::rotate(mat4(), glm::radians(2.0f), vec3(0.0f, 1.0f, 0.0f));
+		// a wall 2.5 m ahead over the middle of the view, nothing drawn around it
+		glm::vec4 wall = projection * glm::vec4(0.0f, 0.0f, -2.5f, 1.0f);
+		float wallDepth = wall.z / wall.w * 0.5f + 0.5f;
+		grids[eye].width = DepthReadback::GRID_WIDTH;
+		grids[eye].height = DepthReadback::GRID_HEIGHT;
+		grids[eye].viewProjection = previous[eye];
+		grids[eye].depth.resize(grids[eye].width * grids[eye].height);
+		for (int cy = 0; cy < grids[eye].height; ++cy) {
+			for (int cx = 0; cx < grids[eye].width; ++cx) {
+				bool onWall = std::abs(cx - grids[eye].width / 2) < grids[eye].width * 3 / 8 && std::abs(cy - grids[eye].height / 2) < grids[eye].height * 3 / 8;
+				grids[eye].depth[cy * grids[eye].width + cx] = onWall ? wallDepth : 1.0f;
+			}
+		}
+	}
+
+	HiZBuffer pyramids[2];
+	double buildMs = bench::nanosecondsPerCall(1, [&](size_t) {
+		for (int eye = 0; eye < 2; ++eye) pyramids[eye].build(grids[eye], current[eye]);
+	}, 20) / 1.0e6;
+
+	glm::vec4 eyePlanes[2][6], combined[6];
+	frustumPlanes(current[0], eyePlanes[0]);
+	frustumPlanes(current[1], eyePlanes[1]);
+	culling::combinedFrustumPlanes(current, combined);
+	std::vector<uint8_t> frustumVisible(count), visible(count);
+	culling::StereoStats frustumStats = culling::cullStereo(spheres, LAYER_CUBES, combined, eyePlanes[0], eyePlanes[1], frustumVisible.data());
+	culling::StereoStats stats;
+	double testMs = bench::nanosecondsPerCall(1, [&](size_t) {
+		visible = frustumVisible;
+		stats = frustumStats;
+		culling::occlusionCull(boxes, LAYER_CUBES, pyramids, visible.data(), stats);
+	}, 20) / 1.0e6;
+
+	out << "occlusion, " << count << " cubes, " << frustumStats.visible[0] << " in the left eye's frustum, "
+		<< stats.occluded[0] << " of them occluded (right " << frustumStats.visible[1] << ", " << stats.occluded[1] << ")" << endl;
+	bench::report(out, "reproject + pyramids, 2 eyes", buildMs, 0.0, "ms");
+	bench::report(out, "occlusion test", testMs, 0.0, "ms");
+}
+
+// The same loads on 1, 2, 4... threads up to one per core: a synthetic parallelFor,
+// the entity transform and stereo cull systems over every entity, and decoding every
+// cube map face the scene names. Speedups are against one thread (no workers, the
+// caller runs every job).
+static void jobBenchmarks(std::ostream & out, const BenchmarkSettings & settings) {
+	const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned int> threadCounts;
+	for (unsigned int threads = 1; threads < cores; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(cores);
+
+	// synthetic: a fixed amount of arithmetic per element, no memory traffic to speak of
+	const size_t elements = 1 << 20;
+	std::vector<float> results(elements);
+	auto synthetic = [&results](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			float x = (float)i;
+			for (int k = 0; k < 16; ++k) {
+				x = sqrtf(x * 1.0001f + 1.0f);
+			}
+			results[i] = x;
+		}
+	};
+
+	// entities: every group moved, so each pass rewrites every entity's bounds
+	const unsigned int groups = 1000, perGroup = 100;
+	SceneGraph graph;
+	EntityStore store;
+	store.reserve(groups * perGroup);
+	for (unsigned int g = 0; g < groups; ++g) {
+		float angle = (float)g * 0.37f;
+		SceneGraph::Node group = graph.create(SceneGraph::None,
+			glm::translate(mat4(1.0f), vec3(40.0f * sinf(angle), 0.0f, 40.0f * cosf(angle))));
+		for (unsigned int i = 0; i < perGroup; ++i) {
+			mat4 local = glm::translate(mat4(1.0f), vec3((float)(i % 10) - 4.5f, (float)(i / 10) - 4.5f, 0.0f));
+			store.create(graph.create(group, glm::scale(local, vec3(0.3f))), (uint16_t)(i % 4), (uint16_t)(g % 8), sqrtf(3.0f), LAYER_CUBES);
+		}
+	}
+	graph.update();
+	mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.01f, 1000.0f);
+	mat4 eyeViewProjections[2];
+	glm::vec4 eyePlanes[2][6], combined[6];
+	for (int eye = 0; eye < 2; ++eye) {
+		vec3 eyePosition(eye ? 0.032f : -0.032f, 1.6f, 0.0f);
+		eyeViewProjections[eye] = projection * glm::lookAt(eyePosition, eyePosition + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+		frustumPlanes(eyeViewProjections[eye], eyePlanes[eye]);
+	}
+	culling::combinedFrustumPlanes(eyeViewProjections, combined);
+	std::vector<uint8_t> visible;
+
+	// real files: every face of every cube map in the scene
+	std::vector<std::string> faces;
+	const char * facesPath = "bench_faces.bin";
+	try {
+		scene::compile(settings.sceneSourcePath, facesPath);
+		scene::SceneFile file;
+		if (file.open(facesPath)) {
+			for (uint32_t t = 0; t < file.textureCount(); ++t) {
+				for (const std::string & face : file.faces(t)) {
+					faces.push_back(face);
+				}
+			}
+		}
+	}
+	catch (std::exception & error) {
+		out << "  (no scene faces: " << error.what() << ")" << endl;
+	}
+	remove(facesPath);
+	std::sort(faces.begin(), faces.end());
+	faces.erase(std::unique(faces.begin(), faces.end()), faces.end());
+	const bool facesFound = !faces.empty() && (bool)decodeImage(faces[0], PrefetchedImages::CHANNELS);
+
+	double baseline[4] = { 0.0, 0.0, 0.0, 0.0 };
+	out << "job system, " << cores << " cores; synthetic " << elements << " elements, " << store.size()
+		<< " entities, " << faces.size() << " cube map faces" << endl;
+	for (unsigned int threads : threadCounts) {
+		JobSystem jobs(threads - 1);
+		double syntheticMs = bench::nanosecondsPerCall(1, [&](size_t) {
+			jobs.parallelFor(elements, 16384, synthetic);
+		}, 5) / 1.0e6;
+		unsigned int moved = 0;
+		double transformMs = bench::nanosecondsPerCall(1, [&](size_t) {
+			moved = store.updateTransforms(graph, &jobs);
+		}, 5) / 1.0e6;
+		culling::StereoStats stats;
+		double cullMs = bench::nanosecondsPerCall(1, [&](size_t) {
+			stats = store.cullStereo(combined, eyePlanes[0], eyePlanes[1], LAYER_CUBES, visible, &jobs);
+		}, 5) / 1.0e6;
+		double decodeMs = 0.0;
+		if (facesFound) {
+			std::vector<std::shared_ptr<DecodedImage>> decoded(faces.size());
+			decodeMs = bench::nanosecondsPerCall(1, [&](size_t) {
+				JobSystem::Counter counter;
+				for (size_t i = 0; i < faces.size(); ++i) {
+					jobs.run([&, i] { decoded[i] = decodeImage(faces[i], PrefetchedImages::CHANNELS); }, &counter);
+				}
+				jobs.wait(counter);
+			}, 3) / 1.0e6;
+		}
+
+		out << "  " << threads << (threads == 1 ? " thread" : " threads") << " (" << moved << " moved, "
+			<< stats.visible[0] << " + " << stats.visible[1] << " visible)" << endl;
+		bench::report(out, "synthetic parallelFor", syntheticMs, baseline[0], "ms");
+		bench::report(out, "entity transforms", transformMs, baseline[1], "ms");
+		bench::report(out, "stereo cull", cullMs, baseline[2], "ms");
+		if (facesFound) {
+			bench::report(out, "decode every face", decodeMs, baseline[3], "ms");
+		}
+		else {
+			out << "  decode every face: skipped, the face images are not here" << endl;
+		}
+		if (threads == 1) {
+			const double measured[4] = { syntheticMs, transformMs, cullMs, decodeMs };
+			std::copy(measured, measured + 4, baseline);
+		}
+	}
+}
+
+bool runBenchmarks(const BenchmarkSettings & settings) {
+	const bool rigidMathCorrect = rigidMathCheck(cout);
+	rigidMathBenchmarks(cout);
+	const bool posePipelineCorrect = posePipelineCheck(cout);
+	entityBenchmarks(cout);
+	bvhBenchmarks(cout);
+	occlusionBenchmarks(cout);
+	rayPickBenchmarks(cout, settings);
+	sceneFileBenchmarks(cout);
+	jobBenchmarks(cout, settings);
+	return rigidMathCorrect && posePipelineCorrect;
+}
@@ -0,0 +1,21 @@
+#pragma once
+//
+//  Benchmarks.h
+//  The --bench command line mode: CPU microbenchmarks of the engine systems,
+//  printed to stdout, after which the app exits without opening the headset.
+//
+
+#ifndef Benchmarks_h
+#define Benchmarks_h
+
+// The app's own settings the benchmarks measure against
+struct BenchmarkSettings {
+	float pickDistance;            // how far the controllers pick
+	double pickBudgetMicroseconds; // picking time allowed a frame
+	const char * sceneSourcePath;  // text scene whose cube map faces are decoded
+};
+
+// Returns false if a correctness check that runs alongside the timings failed
+bool runBenchmarks(const BenchmarkSettings & settings);
+
+#endif
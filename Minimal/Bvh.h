@@ -0,0 +1,345 @@
+#pragma once
+//
+//  Bvh.h
+//  Bounding volume hierarchy over the entities' bounding spheres: binned
+//  SAH builds, linear-time refits, frustum queries and ray casts.
+//
+
+#ifndef Bvh_h
+#define Bvh_h
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+
+// Nodes sit in one array, children always after their parent and next to each other,
+// so a refit is one backward pass and traversal never follows more than an index.
+// Items are indices into the arrays the tree was built over (culling::Spheres).
+class Bvh {
+public:
+	struct Node {
+		glm::vec3 min;
+		uint32_t leftOrFirst; // first child if count == 0, else first entry in the index list
+		glm::vec3 max;
+		uint32_t count;       // items in a leaf, 0 for an inner node
+	};
+
+	struct Hit {
+		uint32_t item{ NoHit };
+		float distance{ FLT_MAX };
+	};
+
+	static const uint32_t NoHit = ~0u;
+	static const uint32_t MaxLeafSize = 4;
+	static const unsigned int MaxDepth = 48; // deeper nodes stay leaves, so traversal stacks fit in 64
+	static const int Bins = 16;
+
+	// Binned surface area heuristic: every node is split where the expected cost of
+	// testing both children, weighted by their surface area, is lowest
+	void build(const culling::Spheres & items) {
+		nodes.clear();
+		treeDepth = 0;
+		indices.resize(items.count);
+		std::iota(indices.begin(), indices.end(), 0u);
+		if (items.count == 0) {
+			return;
+		}
+		nodes.reserve(2 * items.count);
+		Node root = {};
+		root.count = (uint32_t)items.count;
+		nodes.push_back(root);
+		setBounds(items, 0);
+		// explicit stack of (node, depth), a badly clustered scene can't overflow the call stack
+		std::vector<std::pair<uint32_t, unsigned int>> pending(1, std::make_pair(0u, 1u));
+		while (!pending.empty()) {
+			std::pair<uint32_t, unsigned int> entry = pending.back();
+			pending.pop_back();
+			treeDepth = std::max(treeDepth, entry.second);
+			if (entry.second < MaxDepth && split(items, entry.first)) {
+				pending.push_back(std::make_pair(nodes[entry.first].leftOrFirst, entry.second + 1));
+				pending.push_back(std::make_pair(nodes[entry.first].leftOrFirst + 1, entry.second + 1));
+			}
+		}
+	}
+
+	// Recomputes every node's box from the items' current bounds, keeping the topology.
+	// Cheap enough every frame; the tree gets looser as things move far from where the
+	// last build put them, so rebuild once the structure no longer matches the scene.
+	void refit(const culling::Spheres & items) {
+		for (size_t i = nodes.size(); i-- > 0;) {
+			Node & node = nodes[i];
+			if (node.count) {
+				setBounds(items, (uint32_t)i);
+			}
+			else {
+				const Node & left = nodes[node.leftOrFirst];
+				const Node & right = nodes[node.leftOrFirst + 1];
+				node.min = glm::min(left.min, right.min);
+				node.max = glm::max(left.max, right.max);
+			}
+		}
+	}
+
+	// Appends every item on a layer in layerMask whose sphere reaches inside all six
+	// planes, the same test as culling::cull. Subtrees entirely inside a plane stop
+	// testing it. Returns how many were appended.
+	template <typename Allocator>
+	unsigned int queryFrustum(const culling::Spheres & items, const glm::vec4 planes[6], uint32_t layerMask, std::vector<uint32_t, Allocator> & found) const {
+		if (nodes.empty()) return 0;
+		const size_t before = found.size();
+		struct Entry { uint32_t node; uint32_t planeMask; };
+		Entry stack[64];
+		int top = 0;
+		stack[top++] = { 0u, 0x3fu };
+		while (top > 0) {
+			Entry entry = stack[--top];
+			const Node & node = nodes[entry.node];
+			uint32_t planeMask = entry.planeMask;
+			bool outside = false;
+			for (int p = 0; p < 6 && !outside; ++p) {
+				if (!(planeMask & 1u << p)) continue;
+				const glm::vec4 & plane = planes[p];
+				// the box corner furthest along the plane normal, and the one nearest
+				glm::vec3 outer(plane.x >= 0.0f ? node.max.x : node.min.x, plane.y >= 0.0f ? node.max.y : node.min.y, plane.z >= 0.0f ? node.max.z : node.min.z);
+				glm::vec3 inner(plane.x >= 0.0f ? node.min.x : node.max.x, plane.y >= 0.0f ? node.min.y : node.max.y, plane.z >= 0.0f ? node.min.z : node.max.z);
+				if (glm::dot(glm::vec3(plane), outer) + plane.w < 0.0f) {
+					outside = true;
+				}
+				else if (glm::dot(glm::vec3(plane), inner) + plane.w >= 0.0f) {
+					planeMask &= ~(1u << p);
+				}
+			}
+			if (outside) continue;
+			if (node.count) {
+				for (uint32_t k = 0; k < node.count; ++k) {
+					uint32_t item = indices[node.leftOrFirst + k];
+					if (!(items.layers[item] & layerMask)) continue;
+					bool inside = true;
+					for (int p = 0; p < 6 && inside; ++p) {
+						if (planeMask & 1u << p) {
+							const glm::vec4 & plane = planes[p];
+							inside = plane.x * items.x[item] + plane.y * items.y[item] + plane.z * items.z[item] + plane.w >= -items.radius[item];
+						}
+					}
+					if (inside) found.push_back(item);
+				}
+			}
+			else {
+				stack[top++] = { node.leftOrFirst, planeMask };
+				stack[top++] = { node.leftOrFirst + 1, planeMask };
+			}
+		}
+		return (unsigned int)(found.size() - before);
+	}
+
+	// Nearest item on a layer in layerMask whose sphere the ray enters within maxDistance.
+	// direction must be normalised. A ray starting inside a sphere hits where it leaves.
+	Hit raycast(const culling::Spheres & items, const glm::vec3 & origin, const glm::vec3 & direction, float maxDistance, uint32_t layerMask) const {
+		Hit hit;
+		hit.distance = maxDistance;
+		if (nodes.empty()) {
+			hit.distance = FLT_MAX;
+			return hit;
+		}
+		const glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node & node = nodes[stack[--top]];
+			if (node.count) {
+				for (uint32_t k = 0; k < node.count; ++k) {
+					uint32_t item = indices[node.leftOrFirst + k];
+					if (!(items.layers[item] & layerMask)) continue;
+					float distance = sphereDistance(items, item, origin, direction);
+					if (distance < hit.distance) {
+						hit.distance = distance;
+						hit.item = item;
+					}
+				}
+				continue;
+			}
+			// nearer child last so it is popped first and shrinks hit.distance for the other
+			uint32_t left = node.leftOrFirst, right = node.leftOrFirst + 1;
+			float leftEntry = boxEntry(nodes[left], origin, inverse, hit.distance);
+			float rightEntry = boxEntry(nodes[right], origin, inverse, hit.distance);
+			if (leftEntry > rightEntry) {
+				std::swap(left, right);
+				std::swap(leftEntry, rightEntry);
+			}
+			if (rightEntry < FLT_MAX) stack[top++] = right;
+			if (leftEntry < FLT_MAX) stack[top++] = left;
+		}
+		if (hit.item == NoHit) {
+			hit.distance = FLT_MAX;
+		}
+		return hit;
+	}
+
+	size_t nodeCount() const {
+		return nodes.size();
+	}
+
+	// Longest root-to-leaf path of the last build
+	unsigned int depth() const {
+		return treeDepth;
+	}
+
+private:
+	std::vector<Node> nodes;
+	std::vector<uint32_t> indices;
+	unsigned int treeDepth{ 0 };
+
+	struct Bin {
+		glm::vec3 min{ FLT_MAX };
+		glm::vec3 max{ -FLT_MAX };
+		uint32_t count{ 0 };
+	};
+
+	static float area(const glm::vec3 & min, const glm::vec3 & max) {
+		glm::vec3 extent = max - min;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	void setBounds(const culling::Spheres & items, uint32_t n) {
+		Node & node = nodes[n];
+		node.min = glm::vec3(FLT_MAX);
+		node.max = glm::vec3(-FLT_MAX);
+		for (uint32_t k = 0; k < node.count; ++k) {
+			uint32_t item = indices[node.leftOrFirst + k];
+			glm::vec3 center(items.x[item], items.y[item], items.z[item]);
+			glm::vec3 radius(items.radius[item]);
+			node.min = glm::min(node.min, center - radius);
+			node.max = glm::max(node.max, center + radius);
+		}
+	}
+
+	// Splits a leaf in two if that is cheaper than keeping it; true if it did
+	bool split(const culling::Spheres & items, uint32_t n) {
+		const uint32_t first = nodes[n].leftOrFirst;
+		const uint32_t count = nodes[n].count;
+		if (count <= MaxLeafSize) {
+			return false;
+		}
+		glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+		for (uint32_t k = 0; k < count; ++k) {
+			uint32_t item = indices[first + k];
+			glm::vec3 center(items.x[item], items.y[item], items.z[item]);
+			centerMin = glm::min(centerMin, center);
+			centerMax = glm::max(centerMax, center);
+		}
+
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float extent = centerMax[axis] - centerMin[axis];
+			if (extent <= 0.0f) continue;
+			const float scale = Bins / extent;
+			const float * centers = axis == 0 ? items.x : axis == 1 ? items.y : items.z;
+			Bin bins[Bins];
+			for (uint32_t k = 0; k < count; ++k) {
+				uint32_t item = indices[first + k];
+				int b = std::min(Bins - 1, (int)((centers[item] - centerMin[axis]) * scale));
+				glm::vec3 center(items.x[item], items.y[item], items.z[item]);
+				glm::vec3 radius(items.radius[item]);
+				bins[b].min = glm::min(bins[b].min, center - radius);
+				bins[b].max = glm::max(bins[b].max, center + radius);
+				++bins[b].count;
+			}
+			// sweep from the right, then from the left, costing every split plane
+			float rightArea[Bins - 1];
+			uint32_t rightCount[Bins - 1];
+			Bin right;
+			for (int b = Bins - 1; b > 0; --b) {
+				right.min = glm::min(right.min, bins[b].min);
+				right.max = glm::max(right.max, bins[b].max);
+				right.count += bins[b].count;
+				rightArea[b - 1] = right.count ? area(right.min, right.max) : 0.0f;
+				rightCount[b - 1] = right.count;
+			}
+			Bin left;
+			for (int b = 0; b < Bins - 1; ++b) {
+				left.min = glm::min(left.min, bins[b].min);
+				left.max = glm::max(left.max, bins[b].max);
+				left.count += bins[b].count;
+				if (!left.count || !rightCount[b]) continue;
+				float cost = left.count * area(left.min, left.max) + rightCount[b] * rightArea[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+		if (bestAxis < 0 || bestCost >= count * area(nodes[n].min, nodes[n].max)) {
+			return false;
+		}
+
+		const float * centers = bestAxis == 0 ? items.x : bestAxis == 1 ? items.y : items.z;
+		const float scale = Bins / (centerMax[bestAxis] - centerMin[bestAxis]);
+		uint32_t * begin = indices.data() + first;
+		uint32_t * middle = std::partition(begin, begin + count, [&](uint32_t item) {
+			return std::min(Bins - 1, (int)((centers[item] - centerMin[bestAxis]) * scale)) < bestSplit;
+		});
+		const uint32_t leftCount = (uint32_t)(middle - begin);
+		if (leftCount == 0 || leftCount == count) {
+			return false;
+		}
+
+		const uint32_t leftChild = (uint32_t)nodes.size();
+		Node child = {};
+		child.leftOrFirst = first;
+		child.count = leftCount;
+		nodes.push_back(child);
+		child.leftOrFirst = first + leftCount;
+		child.count = count - leftCount;
+		nodes.push_back(child);
+		nodes[n].leftOrFirst = leftChild;
+		nodes[n].count = 0;
+		setBounds(items, leftChild);
+		setBounds(items, leftChild + 1);
+		return true;
+	}
+
+	// Distance along the ray to where it enters the box, FLT_MAX if it misses or the
+	// entry is beyond maxDistance (slab test)
+	static float boxEntry(const Node & node, const glm::vec3 & origin, const glm::vec3 & inverse, float maxDistance) {
+		float t1 = (node.min.x - origin.x) * inverse.x, t2 = (node.max.x - origin.x) * inverse.x;
+		float tmin = std::min(t1, t2), tmax = std::max(t1, t2);
+		t1 = (node.min.y - origin.y) * inverse.y;
+		t2 = (node.max.y - origin.y) * inverse.y;
+		tmin = std::max(tmin, std::min(t1, t2));
+		tmax = std::min(tmax, std::max(t1, t2));
+		t1 = (node.min.z - origin.z) * inverse.z;
+		t2 = (node.max.z - origin.z) * inverse.z;
+		tmin = std::max(tmin, std::min(t1, t2));
+		tmax = std::min(tmax, std::max(t1, t2));
+		if (tmax < std::max(tmin, 0.0f) || tmin > maxDistance) {
+			return FLT_MAX;
+		}
+		return std::max(tmin, 0.0f);
+	}
+
+	static float sphereDistance(const culling::Spheres & items, uint32_t item, const glm::vec3 & origin, const glm::vec3 & direction) {
+		glm::vec3 toCenter = glm::vec3(items.x[item], items.y[item], items.z[item]) - origin;
+		float along = glm::dot(toCenter, direction);
+		float radius2 = items.radius[item] * items.radius[item];
+		float miss2 = glm::dot(toCenter, toCenter) - along * along;
+		if (miss2 > radius2) {
+			return FLT_MAX;
+		}
+		float half = std::sqrt(radius2 - miss2);
+		if (along - half >= 0.0f) return along - half;
+		if (along + half >= 0.0f) return along + half;
+		return FLT_MAX;
+	}
+};
+
+#endif
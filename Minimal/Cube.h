@@ -37,8 +37,11 @@
 #include <GL/glew.h>
 
 #define STB_IMAGE_IMPLEMENTATION
+// images are decoded on the startup task threads, each keeping its own failure reason
+#define STBI_THREAD_LOCAL thread_local
 
 #include "stb_image.h"
+#include "ImageCache.h"
 
 using namespace std;
 
@@ -62,7 +65,11 @@ public:
 	GLuint VBO, VAO, EBO;
 	GLuint uProjection, uModelview;
 
-	Cube(int mySize, vector<string> faces, bool check, bool isLeft, bool room)
+	// the model matrix's first column in shader_cube.vert; the other three follow
+	static const GLuint MODEL_ATTRIBUTE = 2;
+
+	// images, if given, has the faces decoded already (or on their way)
+	Cube(int mySize, vector<string> faces, bool check, bool isLeft, bool room, PrefetchedImages * images = nullptr)
 	{
 		size = mySize;
 		isSkybox = check;
@@ -76,17 +83,17 @@ public:
 
 		if (check) {
 			if (room) {
-				skyboxTexture_room = loadCubemap(faces);
+				skyboxTexture_room = loadCubemap(faces, images);
 			}
 			else if (isLeftEye) {
-				skyboxTexture_left = loadCubemap(faces);
+				skyboxTexture_left = loadCubemap(faces, images);
 			}
 			else {
-				skyboxTexture_right = loadCubemap(faces);
+				skyboxTexture_right = loadCubemap(faces, images);
 			}
 		}
 		else {
-			cubemapTexture = loadCubemap(faces);
+			cubemapTexture = loadCubemap(faces, images);
 		}
 
 		// Create array object and buffers. Remember to delete your buffers when the object is destroyed!
@@ -134,27 +141,29 @@ public:
 	};
 
 
-	unsigned int loadCubemap(vector<string> faces)
+	unsigned int loadCubemap(vector<string> faces, PrefetchedImages * images = nullptr)
 	{
 		unsigned int textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-		int width, height, nrChannels;
 		for (unsigned int i = 0; i < faces.size(); i++)
 		{
-			unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-			if (data)
+			// always 3 channels, what GL_RGB below reads
+			std::shared_ptr<const DecodedImage> image = images ? images->get(faces[i]) : nullptr;
+			if (!image)
+			{
+				image = decodeImage(faces[i], PrefetchedImages::CHANNELS);
+			}
+			if (image)
 			{
 				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-					0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+					0, GL_RGB, image->width, image->height, 0, GL_RGB, GL_UNSIGNED_BYTE, image->pixels.get()
 				);
-				stbi_image_free(data);
 			}
 			else
 			{
 				cout << "Cubemap texture failed to load at path: " << faces[i] << endl;
-				stbi_image_free(data);
 			}
 		}
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -167,6 +176,55 @@ public:
 	};
 
 	void draw(GLuint shaderProgram, const glm::mat4 & projection, const glm::mat4 & modelview)
+	{
+		bindState(shaderProgram, projection, modelview);
+
+		// Draw triangles
+		glBindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+
+		/*glDepthMask(GL_TRUE);*/
+
+		glDepthFunc(GL_LESS); // set depth function back to default
+	};
+
+	// The model matrix draw() uses, as the attribute's constant value
+	static void setModel(const glm::mat4 & model)
+	{
+		for (GLuint column = 0; column < 4; ++column) {
+			glVertexAttrib4fv(MODEL_ATTRIBUTE + column, &model[column][0]);
+		}
+	};
+
+	// count instances in one call, their model matrices read one per instance from
+	// instanceBuffer at offset
+	void drawInstanced(GLuint shaderProgram, const glm::mat4 & projection, const glm::mat4 & modelview,
+		GLuint instanceBuffer, GLintptr offset, GLsizei count)
+	{
+		bindState(shaderProgram, projection, modelview);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (GLuint column = 0; column < 4; ++column) {
+			glEnableVertexAttribArray(MODEL_ATTRIBUTE + column);
+			glVertexAttribPointer(MODEL_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(offset + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(MODEL_ATTRIBUTE + column, 1);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, count);
+		// draw() takes the constant value again
+		for (GLuint column = 0; column < 4; ++column) {
+			glDisableVertexAttribArray(MODEL_ATTRIBUTE + column);
+		}
+		glBindVertexArray(0);
+
+		glDepthFunc(GL_LESS);
+	};
+
+	// Uniforms, texture and fixed-function state for drawing this mesh with shaderProgram.
+	// draw() uses it; instanced draws that bring their own VAO call it directly.
+	void bindState(GLuint shaderProgram, const glm::mat4 & projection, const glm::mat4 & modelview)
 	{
 		// If drawing skybox cull front face
 		// otherwise cull back face
@@ -186,8 +244,6 @@ public:
 		glUniformMatrix4fv(uModelview, 1, GL_FALSE, &modelview[0][0]);
 
 		// skybox cube
-		glBindVertexArray(VAO);
-
 		if (isSkybox) {
 			glCullFace(GL_FRONT);
 
@@ -227,14 +283,6 @@ public:
 		glEnable(GL_DEPTH_TEST);
 		// Accept fragment if it closer to the camera than the former one
 		glDepthFunc(GL_LESS);
-
-		// Draw triangles
-		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		/*glDepthMask(GL_TRUE);*/
-
-		glDepthFunc(GL_LESS); // set depth function back to default
 	};
 
 
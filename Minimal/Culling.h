@@ -0,0 +1,237 @@
+#pragma once
+//
+//  Culling.h
+//  Bounding-sphere frustum tests over structure-of-arrays bounds, four
+//  spheres per SSE instruction, and a stereo pass that rejects against one
+//  frustum enclosing both eyes before testing each eye.
+//
+
+#ifndef Culling_h
+#define Culling_h
+
+#include <algorithm>
+#include <cstdint>
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include <glm/glm.hpp>
+
+// Frustum planes of a projection * view matrix (Gribb/Hartmann), normals pointing
+// inwards and normalised so plane distances are in world units
+inline void frustumPlanes(const glm::mat4 & viewProjection, glm::vec4 planes[6]) {
+	const glm::mat4 & m = viewProjection;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+	planes[0] = row3 + row0; // left
+	planes[1] = row3 - row0; // right
+	planes[2] = row3 + row1; // bottom
+	planes[3] = row3 - row1; // top
+	planes[4] = row3 + row2; // near
+	planes[5] = row3 - row2; // far
+	for (int p = 0; p < 6; ++p) {
+		planes[p] /= glm::length(glm::vec3(planes[p]));
+	}
+}
+
+namespace culling {
+
+	// Bounds as parallel arrays, one entry per object
+	struct Spheres {
+		const float * x;
+		const float * y;
+		const float * z;
+		const float * radius;
+		const uint32_t * layers;
+		size_t count;
+	};
+
+	// Axis-aligned world boxes around the same centers, as parallel arrays
+	struct Boxes {
+		const float * x;
+		const float * y;
+		const float * z;
+		const float * extentX; // half sizes
+		const float * extentY;
+		const float * extentZ;
+		const uint32_t * layers;
+		size_t count;
+	};
+
+	// Per-frame counts from cullStereo()
+	struct StereoStats {
+		unsigned int tested{ 0 };   // on a requested layer
+		unsigned int rejected{ 0 }; // outside the combined frustum, never tested per eye
+		unsigned int visible[2]{ 0, 0 };
+		unsigned int occluded[2]{ 0, 0 }; // inside an eye's frustum but hidden, see occlusionCull()
+	};
+
+	// The same projection with its x and y extents widened by `margin` (0.05 = 5%), for
+	// views that may still turn a little after culling
+	inline glm::mat4 widenedProjection(const glm::mat4 & projection, float margin) {
+		glm::mat4 wide = projection;
+		wide[0][0] /= 1.0f + margin;
+		wide[1][1] /= 1.0f + margin;
+		return wide;
+	}
+
+	// A frustum that contains both eyes' frusta. Each plane keeps the direction of the
+	// matching eye plane (the outer eye for left and right, both eyes averaged for the
+	// rest) and is pushed out until all sixteen frustum corners are inside it. A frustum
+	// is the convex hull of its corners, so the result is conservative for any eye
+	// separation, canting or asymmetric FOV.
+	inline void combinedFrustumPlanes(const glm::mat4 viewProjections[2], glm::vec4 planes[6]) {
+		glm::vec4 eyePlanes[2][6];
+		glm::vec3 corners[16];
+		for (int eye = 0; eye < 2; ++eye) {
+			frustumPlanes(viewProjections[eye], eyePlanes[eye]);
+			glm::mat4 inverse = glm::inverse(viewProjections[eye]);
+			for (int c = 0; c < 8; ++c) {
+				glm::vec4 corner = inverse * glm::vec4(c & 1 ? 1.0f : -1.0f, c & 2 ? 1.0f : -1.0f, c & 4 ? 1.0f : -1.0f, 1.0f);
+				corners[eye * 8 + c] = glm::vec3(corner) / corner.w;
+			}
+		}
+		for (int p = 0; p < 6; ++p) {
+			glm::vec3 normal;
+			if (p == 0) normal = glm::vec3(eyePlanes[0][0]);
+			else if (p == 1) normal = glm::vec3(eyePlanes[1][1]);
+			else normal = glm::normalize(glm::vec3(eyePlanes[0][p]) + glm::vec3(eyePlanes[1][p]));
+			float nearest = glm::dot(normal, corners[0]);
+			for (int c = 1; c < 16; ++c) {
+				nearest = std::min(nearest, glm::dot(normal, corners[c]));
+			}
+			planes[p] = glm::vec4(normal, -nearest);
+		}
+	}
+
+	// Six planes broadcast across the four lanes
+	struct SimdFrustum {
+		__m128 x[6], y[6], z[6], w[6];
+
+		explicit SimdFrustum(const glm::vec4 planes[6]) {
+			for (int p = 0; p < 6; ++p) {
+				x[p] = _mm_set1_ps(planes[p].x);
+				y[p] = _mm_set1_ps(planes[p].y);
+				z[p] = _mm_set1_ps(planes[p].z);
+				w[p] = _mm_set1_ps(planes[p].w);
+			}
+		}
+
+		// All-ones in the lanes whose sphere reaches inside every plane
+		__m128 inside(__m128 cx, __m128 cy, __m128 cz, __m128 negRadius) const {
+			__m128 result = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p) {
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[p], cx), _mm_mul_ps(y[p], cy)),
+					_mm_add_ps(_mm_mul_ps(z[p], cz), w[p]));
+				result = _mm_and_ps(result, _mm_cmpge_ps(distance, negRadius));
+			}
+			return result;
+		}
+	};
+
+	inline bool sphereInside(const glm::vec4 planes[6], float x, float y, float z, float radius) {
+		for (int p = 0; p < 6; ++p) {
+			if (planes[p].x * x + planes[p].y * y + planes[p].z * z + planes[p].w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// All-ones in the lanes whose layers share a bit with layerMask
+	inline __m128 onLayer(const uint32_t * layers, __m128i layerMask) {
+		__m128i hit = _mm_and_si128(_mm_loadu_si128((const __m128i *)layers), layerMask);
+		return _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hit, _mm_setzero_si128())), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+	}
+
+	inline unsigned int bitCount(int bits) {
+		return (bits & 1) + (bits >> 1 & 1) + (bits >> 2 & 1) + (bits >> 3 & 1);
+	}
+
+	// visible[i] = 1 if sphere i is on a layer in layerMask and inside the frustum.
+	// Returns how many are.
+	inline unsigned int cull(const Spheres & spheres, uint32_t layerMask, const glm::vec4 planes[6], uint8_t * visible) {
+		const SimdFrustum frustum(planes);
+		const __m128i mask = _mm_set1_epi32((int)layerMask);
+		const __m128 zero = _mm_setzero_ps();
+		unsigned int visibleCount = 0;
+		size_t i = 0;
+		for (; i + 4 <= spheres.count; i += 4) {
+			__m128 lanes = _mm_and_ps(onLayer(spheres.layers + i, mask),
+				frustum.inside(_mm_loadu_ps(spheres.x + i), _mm_loadu_ps(spheres.y + i), _mm_loadu_ps(spheres.z + i),
+					_mm_sub_ps(zero, _mm_loadu_ps(spheres.radius + i))));
+			int bits = _mm_movemask_ps(lanes);
+			for (int k = 0; k < 4; ++k) {
+				visible[i + k] = bits >> k & 1;
+			}
+			visibleCount += bitCount(bits);
+		}
+		for (; i < spheres.count; ++i) {
+			bool inside = (spheres.layers[i] & layerMask) && sphereInside(planes, spheres.x[i], spheres.y[i], spheres.z[i], spheres.radius[i]);
+			visible[i] = inside;
+			visibleCount += inside;
+		}
+		return visibleCount;
+	}
+
+	// Both eyes in one pass: visible[i] gets bit 0 for the left eye and bit 1 for the
+	// right. Spheres outside `combined` skip the per-eye tests; a block of four that is
+	// entirely outside costs one frustum test instead of two.
+	inline StereoStats cullStereo(const Spheres & spheres, uint32_t layerMask, const glm::vec4 combined[6],
+		const glm::vec4 left[6], const glm::vec4 right[6], uint8_t * visible) {
+		const SimdFrustum both(combined), leftEye(left), rightEye(right);
+		const __m128i mask = _mm_set1_epi32((int)layerMask);
+		const __m128 zero = _mm_setzero_ps();
+		StereoStats stats;
+		size_t i = 0;
+		for (; i + 4 <= spheres.count; i += 4) {
+			__m128 layered = onLayer(spheres.layers + i, mask);
+			int layerBits = _mm_movemask_ps(layered);
+			if (!layerBits) {
+				for (int k = 0; k < 4; ++k) visible[i + k] = 0;
+				continue;
+			}
+			__m128 cx = _mm_loadu_ps(spheres.x + i);
+			__m128 cy = _mm_loadu_ps(spheres.y + i);
+			__m128 cz = _mm_loadu_ps(spheres.z + i);
+			__m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(spheres.radius + i));
+			__m128 candidates = _mm_and_ps(layered, both.inside(cx, cy, cz, negRadius));
+			int candidateBits = _mm_movemask_ps(candidates);
+			stats.tested += bitCount(layerBits);
+			stats.rejected += bitCount(layerBits & ~candidateBits);
+			if (!candidateBits) {
+				for (int k = 0; k < 4; ++k) visible[i + k] = 0;
+				continue;
+			}
+			int leftBits = _mm_movemask_ps(_mm_and_ps(candidates, leftEye.inside(cx, cy, cz, negRadius)));
+			int rightBits = _mm_movemask_ps(_mm_and_ps(candidates, rightEye.inside(cx, cy, cz, negRadius)));
+			for (int k = 0; k < 4; ++k) {
+				visible[i + k] = (uint8_t)((leftBits >> k & 1) | (rightBits >> k & 1) << 1);
+			}
+			stats.visible[0] += bitCount(leftBits);
+			stats.visible[1] += bitCount(rightBits);
+		}
+		for (; i < spheres.count; ++i) {
+			visible[i] = 0;
+			if (!(spheres.layers[i] & layerMask)) {
+				continue;
+			}
+			++stats.tested;
+			const float x = spheres.x[i], y = spheres.y[i], z = spheres.z[i], r = spheres.radius[i];
+			if (!sphereInside(combined, x, y, z, r)) {
+				++stats.rejected;
+				continue;
+			}
+			bool inLeft = sphereInside(left, x, y, z, r);
+			bool inRight = sphereInside(right, x, y, z, r);
+			visible[i] = (uint8_t)(inLeft | inRight << 1);
+			stats.visible[0] += inLeft;
+			stats.visible[1] += inRight;
+		}
+		return stats;
+	}
+}
+
+#endif
@@ -0,0 +1,184 @@
+#pragma once
+//
+//  DepthReadback.h
+//  Reduces both eyes' depth to coarse max-depth grids on the GPU and reads them
+//  back through pixel buffers without stalling, for HiZBuffer.
+//
+
+#ifndef DepthReadback_h
+#define DepthReadback_h
+
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "HiZ.h"
+#include "shader.h"
+
+// capture() renders both grids side by side into a small float target and starts a
+// glReadPixels into the next of SLOTS pixel buffers, fenced. collect() takes the newest
+// capture whose fence has passed, so the CPU sees depth one or two frames old and never
+// waits on the GPU. Captures still in flight when their slot comes round are dropped.
+class DepthReadback {
+public:
+	static const int GRID_WIDTH = 128;  // cells per eye; each covers about 10x12 texels of a CV1
+	static const int GRID_HEIGHT = 128; // eye buffer. Coarser grids lose a cube-sized occluder to
+	                                    // the cells on its edges and the reprojection's dilation
+	static const unsigned int SLOTS = 3;
+
+	~DepthReadback() {
+		release();
+	}
+
+	void init(const char * vertPath, const char * fragPath) {
+		program = LoadShaders(vertPath, fragPath);
+		uDepthTex = glGetUniformLocation(program, "depthTex");
+		uSourceViewport = glGetUniformLocation(program, "sourceViewport");
+		uGridOrigin = glGetUniformLocation(program, "gridOrigin");
+		uGridSize = glGetUniformLocation(program, "gridSize");
+		glGenVertexArrays(1, &vao);
+
+		glGenTextures(1, &gridTexture);
+		glBindTexture(GL_TEXTURE_2D, gridTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 2 * GRID_WIDTH, GRID_HEIGHT, 0, GL_RED, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glGenFramebuffers(1, &gridFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, gridFbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gridTexture, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(SLOTS, pixelBuffers);
+		for (unsigned int i = 0; i < SLOTS; ++i) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 2 * GRID_WIDTH * GRID_HEIGHT * sizeof(float), nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	void release() {
+		for (unsigned int i = 0; i < SLOTS; ++i) {
+			if (slots[i].fence) glDeleteSync(slots[i].fence);
+			slots[i].fence = nullptr;
+		}
+		if (pixelBuffers[0]) glDeleteBuffers(SLOTS, pixelBuffers);
+		if (gridFbo) glDeleteFramebuffers(1, &gridFbo);
+		if (gridTexture) glDeleteTextures(1, &gridTexture);
+		if (vao) glDeleteVertexArrays(1, &vao);
+		if (program) glDeleteProgram(program);
+		for (unsigned int i = 0; i < SLOTS; ++i) pixelBuffers[i] = 0;
+		gridFbo = gridTexture = vao = program = 0;
+	}
+
+	// Reduces the two eye viewports of depthTexture, drawn with viewProjections, and starts
+	// reading the grids back. Leaves the framebuffer and program unbound and the viewport
+	// on the grid, so the caller sets its own; the depth test and face culling are as they were.
+	void capture(GLuint depthTexture, const glm::ivec4 viewports[2], const glm::mat4 viewProjections[2], unsigned int frame) {
+		Slot & slot = slots[next];
+		next = (next + 1) % SLOTS;
+		if (slot.fence) {
+			glDeleteSync(slot.fence); // never collected, a newer capture will be
+			slot.fence = nullptr;
+		}
+
+		GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+		GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glBindFramebuffer(GL_FRAMEBUFFER, gridFbo);
+		glUseProgram(program);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glUniform1i(uDepthTex, 0);
+		glUniform2i(uGridSize, GRID_WIDTH, GRID_HEIGHT);
+		glBindVertexArray(vao);
+		for (int eye = 0; eye < 2; ++eye) {
+			glViewport(eye * GRID_WIDTH, 0, GRID_WIDTH, GRID_HEIGHT);
+			glUniform4i(uSourceViewport, viewports[eye].x, viewports[eye].y, viewports[eye].z, viewports[eye].w);
+			glUniform2i(uGridOrigin, eye * GRID_WIDTH, 0);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			slot.viewProjections[eye] = viewProjections[eye];
+		}
+		glBindVertexArray(0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[&slot - slots]);
+		glReadPixels(0, 0, 2 * GRID_WIDTH, GRID_HEIGHT, GL_RED, GL_FLOAT, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.frame = frame;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glUseProgram(0);
+		if (depthTest) glEnable(GL_DEPTH_TEST);
+		if (cullFace) glEnable(GL_CULL_FACE);
+	}
+
+	// Copies out the newest finished capture; false if none has finished since the last
+	// call. frame is what was passed to capture().
+	bool collect(DepthGrid grids[2], unsigned int & frame) {
+		int newest = -1;
+		for (unsigned int i = 0; i < SLOTS; ++i) {
+			if (!slots[i].fence || (newest >= 0 && (int)(slots[i].frame - slots[newest].frame) < 0)) {
+				continue;
+			}
+			GLenum status = glClientWaitSync(slots[i].fence, 0, 0);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+				newest = (int)i;
+			}
+		}
+		if (newest < 0) {
+			return false;
+		}
+		// anything older than the newest finished capture is stale already
+		for (unsigned int i = 0; i < SLOTS; ++i) {
+			if (slots[i].fence && (int)(slots[i].frame - slots[newest].frame) < 0) {
+				glDeleteSync(slots[i].fence);
+				slots[i].fence = nullptr;
+			}
+		}
+
+		Slot & slot = slots[newest];
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffers[newest]);
+		const float * pixels = (const float *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 2 * GRID_WIDTH * GRID_HEIGHT * sizeof(float), GL_MAP_READ_BIT);
+		if (pixels) {
+			for (int eye = 0; eye < 2; ++eye) {
+				DepthGrid & grid = grids[eye];
+				grid.width = GRID_WIDTH;
+				grid.height = GRID_HEIGHT;
+				grid.viewProjection = slot.viewProjections[eye];
+				grid.depth.resize(GRID_WIDTH * GRID_HEIGHT);
+				for (int y = 0; y < GRID_HEIGHT; ++y) {
+					memcpy(&grid.depth[y * GRID_WIDTH], pixels + y * 2 * GRID_WIDTH + eye * GRID_WIDTH, GRID_WIDTH * sizeof(float));
+				}
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		frame = slot.frame;
+		return pixels != nullptr;
+	}
+
+private:
+	struct Slot {
+		GLsync fence{ nullptr };
+		unsigned int frame{ 0 };
+		glm::mat4 viewProjections[2];
+	};
+
+	GLuint program{ 0 };
+	GLint uDepthTex{ -1 }, uSourceViewport{ -1 }, uGridOrigin{ -1 }, uGridSize{ -1 };
+	GLuint vao{ 0 };
+	GLuint gridTexture{ 0 };
+	GLuint gridFbo{ 0 };
+	GLuint pixelBuffers[SLOTS]{};
+	Slot slots[SLOTS];
+	unsigned int next{ 0 };
+};
+
+#endif
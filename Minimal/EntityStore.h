@@ -0,0 +1,260 @@
+#pragma once
+//
+//  EntityStore.h
+//  Scene objects as structure-of-arrays components, and the systems that
+//  walk them linearly each frame: transforms, culling, occlusion and draw packets.
+//
+
+#ifndef EntityStore_h
+#define EntityStore_h
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+#include "HiZ.h"
+#include "JobSystem.h"
+#include "SceneGraph.h"
+
+// Which passes draw an entity, tested against a per-pass mask
+enum EntityLayer : uint32_t {
+	LAYER_CUBES = 1 << 0,
+	LAYER_SKYBOX_LEFT = 1 << 1,
+	LAYER_SKYBOX_RIGHT = 1 << 2,
+	LAYER_SKYBOX_ROOM = 1 << 3,
+};
+
+// Sorting packets by key groups draws by material, then mesh
+struct DrawPacket {
+	uint32_t key;
+	uint32_t entity;
+
+	bool operator<(const DrawPacket & other) const {
+		return key < other.key;
+	}
+};
+
+// One entry per entity in every array; an entity is just its index. Entities are
+// never removed, so the arrays stay dense and every system is a straight loop.
+// Given a job system, the per-entity systems split that loop into slices of
+// PARALLEL_GRAIN entities across its workers; each slice writes only its own entries.
+class EntityStore {
+public:
+	typedef unsigned int Entity;
+
+	static const size_t PARALLEL_GRAIN = 8192;
+
+	// transform
+	std::vector<SceneGraph::Node> nodes;
+	std::vector<glm::mat4> worlds;
+	// bounds: a model-space sphere and box around the origin, and their world-space copies
+	// (the box axis-aligned in world space)
+	std::vector<float> localRadius;
+	std::vector<glm::vec3> localExtent;
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<float> extentX, extentY, extentZ;
+	// rendering
+	std::vector<uint16_t> meshes;
+	std::vector<uint16_t> materials;
+	std::vector<uint32_t> layers;
+
+	// halfExtent is the model-space box; by default the one around the sphere
+	Entity create(SceneGraph::Node node, uint16_t mesh, uint16_t material, float boundingRadius, uint32_t layer,
+		const glm::vec3 & halfExtent = glm::vec3(-1.0f)) {
+		Entity entity = (Entity)nodes.size();
+		nodes.push_back(node);
+		worlds.push_back(glm::mat4(1.0f));
+		localRadius.push_back(boundingRadius);
+		localExtent.push_back(halfExtent.x < 0.0f ? glm::vec3(boundingRadius) : halfExtent);
+		centerX.push_back(0.0f);
+		centerY.push_back(0.0f);
+		centerZ.push_back(0.0f);
+		radius.push_back(boundingRadius);
+		extentX.push_back(localExtent.back().x);
+		extentY.push_back(localExtent.back().y);
+		extentZ.push_back(localExtent.back().z);
+		meshes.push_back(mesh);
+		materials.push_back(material);
+		layers.push_back(layer);
+		pending.push_back(1);
+		return entity;
+	}
+
+	size_t size() const {
+		return nodes.size();
+	}
+
+	void reserve(size_t count) {
+		nodes.reserve(count);
+		worlds.reserve(count);
+		localRadius.reserve(count);
+		localExtent.reserve(count);
+		centerX.reserve(count);
+		centerY.reserve(count);
+		centerZ.reserve(count);
+		radius.reserve(count);
+		extentX.reserve(count);
+		extentY.reserve(count);
+		extentZ.reserve(count);
+		meshes.reserve(count);
+		materials.reserve(count);
+		layers.reserve(count);
+		pending.reserve(count);
+	}
+
+	// Transform system: picks up the world matrices the scene graph recomputed and
+	// refreshes the world bounds. Returns how many entities moved.
+	unsigned int updateTransforms(const SceneGraph & graph, JobSystem * jobs = nullptr) {
+		if (!jobs) {
+			return updateTransforms(graph, 0, nodes.size());
+		}
+		std::atomic<unsigned int> moved{ 0 };
+		jobs->parallelFor(nodes.size(), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			moved += updateTransforms(graph, begin, end);
+		});
+		return moved.load();
+	}
+
+	// The world bounds and layers, as the culling kernels take them
+	culling::Spheres spheres() const {
+		culling::Spheres spheres = { centerX.data(), centerY.data(), centerZ.data(), radius.data(), layers.data(), nodes.size() };
+		return spheres;
+	}
+
+	culling::Boxes boxes() const {
+		culling::Boxes boxes = { centerX.data(), centerY.data(), centerZ.data(), extentX.data(), extentY.data(), extentZ.data(), layers.data(), nodes.size() };
+		return boxes;
+	}
+
+	// The same for entities [begin, end), indexed from begin
+	culling::Spheres slicedSpheres(size_t begin, size_t end) const {
+		culling::Spheres spheres = { centerX.data() + begin, centerY.data() + begin, centerZ.data() + begin, radius.data() + begin,
+			layers.data() + begin, end - begin };
+		return spheres;
+	}
+
+	culling::Boxes slicedBoxes(size_t begin, size_t end) const {
+		culling::Boxes boxes = { centerX.data() + begin, centerY.data() + begin, centerZ.data() + begin,
+			extentX.data() + begin, extentY.data() + begin, extentZ.data() + begin, layers.data() + begin, end - begin };
+		return boxes;
+	}
+
+	// Culling system: visible[i] = entity i is on a layer in layerMask and its sphere
+	// touches the inside of all six planes (xyz normal pointing in, w distance).
+	unsigned int cull(const glm::vec4 planes[6], uint32_t layerMask, std::vector<uint8_t> & visible) const {
+		visible.resize(nodes.size());
+		return culling::cull(spheres(), layerMask, planes, visible.data());
+	}
+
+	// Both eyes at once, see culling::cullStereo; visible[i] has a bit per eye
+	culling::StereoStats cullStereo(const glm::vec4 combined[6], const glm::vec4 left[6], const glm::vec4 right[6],
+		uint32_t layerMask, std::vector<uint8_t> & visible, JobSystem * jobs = nullptr) const {
+		visible.resize(nodes.size());
+		if (!jobs) {
+			return culling::cullStereo(spheres(), layerMask, combined, left, right, visible.data());
+		}
+		culling::StereoStats stats;
+		std::mutex statsMutex;
+		jobs->parallelFor(nodes.size(), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			culling::StereoStats slice = culling::cullStereo(slicedSpheres(begin, end), layerMask, combined, left, right, visible.data() + begin);
+			std::lock_guard<std::mutex> lock(statsMutex);
+			stats.tested += slice.tested;
+			stats.rejected += slice.rejected;
+			for (int eye = 0; eye < 2; ++eye) {
+				stats.visible[eye] += slice.visible[eye];
+			}
+		});
+		return stats;
+	}
+
+	// Occlusion system: after cullStereo(), clears the eye bits of entities on layerMask
+	// hidden in that eye's depth pyramid, and counts them in stats
+	void occlusionCull(const HiZBuffer eyes[2], uint32_t layerMask, std::vector<uint8_t> & visible, culling::StereoStats & stats,
+		JobSystem * jobs = nullptr) const {
+		if (!jobs) {
+			culling::occlusionCull(boxes(), layerMask, eyes, visible.data(), stats);
+			return;
+		}
+		std::mutex statsMutex;
+		jobs->parallelFor(nodes.size(), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+			// a slice starts from no visible entities, so only its occluded counts mean anything
+			culling::StereoStats slice;
+			culling::occlusionCull(slicedBoxes(begin, end), layerMask, eyes, visible.data() + begin, slice);
+			std::lock_guard<std::mutex> lock(statsMutex);
+			for (int eye = 0; eye < 2; ++eye) {
+				stats.visible[eye] -= slice.occluded[eye];
+				stats.occluded[eye] += slice.occluded[eye];
+			}
+		});
+	}
+
+	// Draw-packet system: one packet per visible entity, sorted to minimise state changes.
+	// Visible means one of visibleBits is set in visible[i] and the entity is on a layer in
+	// layerMask, so a stereo cull result can be drawn one eye and one layer at a time.
+	// Either vector may use any allocator, such as a FrameAllocator for one frame's list.
+	template <typename VisibleAllocator, typename PacketAllocator>
+	void buildDrawPackets(const std::vector<uint8_t, VisibleAllocator> & visible, std::vector<DrawPacket, PacketAllocator> & packets,
+		uint8_t visibleBits = 1, uint32_t layerMask = ~0u) const {
+		packets.clear();
+		const size_t count = nodes.size();
+		for (size_t i = 0; i < count; ++i) {
+			if ((visible[i] & visibleBits) && (layers[i] & layerMask)) {
+				DrawPacket packet;
+				packet.key = (uint32_t)materials[i] << 16 | meshes[i];
+				packet.entity = (uint32_t)i;
+				packets.push_back(packet);
+			}
+		}
+		std::sort(packets.begin(), packets.end());
+	}
+
+	// The same from a list of visible entities, such as a Bvh query's, so the work
+	// follows what was found rather than the size of the store
+	template <typename FoundAllocator, typename PacketAllocator>
+	void buildDrawPackets(const std::vector<uint32_t, FoundAllocator> & found, std::vector<DrawPacket, PacketAllocator> & packets) const {
+		packets.clear();
+		for (uint32_t entity : found) {
+			DrawPacket packet;
+			packet.key = (uint32_t)materials[entity] << 16 | meshes[entity];
+			packet.entity = entity;
+			packets.push_back(packet);
+		}
+		std::sort(packets.begin(), packets.end());
+	}
+
+private:
+	std::vector<uint8_t> pending; // created since the last transform update
+
+	// updateTransforms() over entities [begin, end)
+	unsigned int updateTransforms(const SceneGraph & graph, size_t begin, size_t end) {
+		unsigned int moved = 0;
+		for (size_t i = begin; i < end; ++i) {
+			if (!pending[i] && !graph.worldChanged(nodes[i])) {
+				continue;
+			}
+			pending[i] = 0;
+			const glm::mat4 & world = graph.world(nodes[i]);
+			worlds[i] = world;
+			centerX[i] = world[3].x;
+			centerY[i] = world[3].y;
+			centerZ[i] = world[3].z;
+			float scale2 = std::max(glm::dot(glm::vec3(world[0]), glm::vec3(world[0])),
+				std::max(glm::dot(glm::vec3(world[1]), glm::vec3(world[1])), glm::dot(glm::vec3(world[2]), glm::vec3(world[2]))));
+			radius[i] = localRadius[i] * std::sqrt(scale2);
+			const glm::vec3 & local = localExtent[i];
+			extentX[i] = std::abs(world[0].x) * local.x + std::abs(world[1].x) * local.y + std::abs(world[2].x) * local.z;
+			extentY[i] = std::abs(world[0].y) * local.x + std::abs(world[1].y) * local.y + std::abs(world[2].y) * local.z;
+			extentZ[i] = std::abs(world[0].z) * local.x + std::abs(world[1].z) * local.y + std::abs(world[2].z) * local.z;
+			++moved;
+		}
+		return moved;
+	}
+};
+
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+//
+//  FrameArena.h
+//  Memory for data that lives a frame: bump-allocated from one of two halves,
+//  dropped wholesale at frame boundaries, with an allocator for STL containers.
+//
+
+#ifndef FrameArena_h
+#define FrameArena_h
+
+// Freed memory is overwritten in debug builds unless FRAME_ARENA_POISON is forced
+#ifndef FRAME_ARENA_POISON
+#ifdef NDEBUG
+#define FRAME_ARENA_POISON 0
+#else
+#define FRAME_ARENA_POISON 1
+#endif
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+// beginFrame() moves to the other half and drops everything allocated in it, so what
+// a frame allocates stays valid through the next one: long enough to hand to the
+// following frame, never longer. Allocation is a pointer bump and freeing is free;
+// deallocate() only gives back the newest block, which is all a growing vector needs.
+//
+// A half that is full hands out heap blocks for the rest of the frame, and is grown
+// to fit what that frame wanted when it is next reset, so after a few frames the
+// halves fit a frame and the heap is left alone. One thread allocates: the one that
+// calls beginFrame(), the renderer.
+class FrameArena {
+public:
+	static const unsigned char POISON = 0xdd; // what freed memory reads as, with poisoning on
+
+	explicit FrameArena(size_t bytesPerFrame = 1 << 20) {
+		for (Half & half : halves) {
+			half.capacity = bytesPerFrame;
+			half.memory.reset(new unsigned char[bytesPerFrame]);
+			half.overflow.reserve(16);
+			poison(half.memory.get(), bytesPerFrame);
+		}
+	}
+
+	FrameArena(const FrameArena &) = delete;
+	FrameArena & operator=(const FrameArena &) = delete;
+
+	~FrameArena() {
+		for (Half & half : halves) {
+			freeOverflow(half);
+		}
+	}
+
+	// Drops what the frame before last allocated and allocates from its half from now on
+	void beginFrame() {
+		current ^= 1;
+		Half & half = halves[current];
+		const size_t wanted = half.head + half.overflowBytes;
+		peak = std::max(peak, wanted);
+		freeOverflow(half);
+		if (wanted > half.capacity) {
+			size_t capacity = half.capacity;
+			while (capacity < wanted) capacity *= 2;
+			half.memory.reset(new unsigned char[capacity]);
+			half.capacity = capacity;
+			++grows;
+			poison(half.memory.get(), capacity);
+		}
+		else {
+			poison(half.memory.get(), half.head);
+		}
+		half.head = 0;
+		half.overflowBytes = 0;
+		++frames;
+	}
+
+	// size bytes at a multiple of alignment (a power of two), valid until the
+	// beginFrame() after next
+	void * allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+		Half & half = halves[current];
+		const uintptr_t base = (uintptr_t)half.memory.get();
+		const size_t start = ((base + half.head + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+		if (start + size <= half.capacity) {
+			half.head = start + size;
+			++allocations;
+			return half.memory.get() + start;
+		}
+		// operator new aligns for any standard type, which is all containers ask for
+		void * block = ::operator new(size ? size : 1);
+		half.overflow.push_back(block);
+		half.overflowBytes += size + alignment;
+		++overflows;
+		return block;
+	}
+
+	// Gives the block back if it is the newest; anything else waits for its frame to end
+	void deallocate(void * block, size_t size) {
+		Half & half = halves[current];
+		const uintptr_t base = (uintptr_t)half.memory.get(), at = (uintptr_t)block;
+		if (at >= base && at + size == base + half.head) {
+			half.head = at - base;
+			poison((unsigned char *)block, size);
+		}
+	}
+
+	// Frames begun, blocks handed out and blocks that had to come from the heap
+	unsigned long long frameCount() const { return frames; }
+	unsigned long long allocationCount() const { return allocations; }
+	unsigned long long overflowCount() const { return overflows; }
+	// Times a half was grown to fit a frame
+	unsigned int growCount() const { return grows; }
+	// The most one frame has wanted, and what each half holds now
+	size_t peakBytes() const { return peak; }
+	size_t capacity() const { return halves[current].capacity; }
+
+private:
+	struct Half {
+		std::unique_ptr<unsigned char[]> memory;
+		size_t capacity{ 0 };
+		size_t head{ 0 };
+		std::vector<void *> overflow; // heap blocks handed out once it was full
+		size_t overflowBytes{ 0 };
+	};
+
+	Half halves[2];
+	unsigned int current{ 0 };
+	unsigned long long frames{ 0 }, allocations{ 0 }, overflows{ 0 };
+	unsigned int grows{ 0 };
+	size_t peak{ 0 };
+
+	static void poison(unsigned char * bytes, size_t size) {
+#if FRAME_ARENA_POISON
+		memset(bytes, POISON, size);
+#else
+		(void)bytes;
+		(void)size;
+#endif
+	}
+
+	static void freeOverflow(Half & half) {
+		for (void * block : half.overflow) {
+			::operator delete(block);
+		}
+		half.overflow.clear();
+	}
+};
+
+// An STL allocator over a FrameArena. Containers using it must not outlive the frame
+// after the one they were filled in; reserve() what is known up front, since every
+// reallocation leaves the old block behind until the frame ends.
+template <typename T>
+class FrameAllocator {
+public:
+	typedef T value_type;
+
+	FrameAllocator(FrameArena & arena) noexcept : arena(&arena) {}
+
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U> & other) noexcept : arena(other.arena) {}
+
+	T * allocate(size_t count) {
+		return (T *)arena->allocate(count * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T * block, size_t count) noexcept {
+		arena->deallocate(block, count * sizeof(T));
+	}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U> & other) const noexcept {
+		return arena == other.arena;
+	}
+
+	template <typename U>
+	bool operator!=(const FrameAllocator<U> & other) const noexcept {
+		return arena != other.arena;
+	}
+
+private:
+	template <typename U> friend class FrameAllocator;
+	FrameArena * arena;
+};
+
+// The container most frame temporaries want
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif
@@ -0,0 +1,181 @@
+#pragma once
+//
+//  FrameRing.h
+//  A buffer for data written fresh every frame: one region per frame in flight,
+//  persistently mapped, each guarded by a fence.
+//
+
+#ifndef FrameRing_h
+#define FrameRing_h
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+
+// The buffer is split into `slots` equal regions and a frame bump-allocates from one
+// of them. beginFrame() moves to the next region and waits on the fence endFrame()
+// placed after the last frame that used it, so with three slots the CPU fills frame
+// N+2 while the GPU still reads frame N, and the driver never has to synchronize a
+// write behind the app's back. A region that is full hands out empty ranges; callers
+// fall back to their own path for the rest of the frame. So does a region whose fence
+// has not signalled after a second, or could not be waited on: it is skipped for the
+// frame and waited on again the next time round.
+//
+// With ARB_buffer_storage the whole buffer is mapped once, persistent and coherent,
+// and ranges are written in place. Without it writes go through glBufferSubData.
+// Either way the buffer can be bound to any target: ranges for uniform blocks are
+// allocated with GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, vertex data needs much less.
+class FrameRingBuffer {
+public:
+	struct Range {
+		GLintptr offset{ 0 };
+		GLsizeiptr size{ 0 };
+		unsigned char * data{ nullptr }; // null unless the buffer is mapped
+
+		explicit operator bool() const {
+			return size > 0;
+		}
+	};
+
+	FrameRingBuffer(unsigned int slots = 3) : fences(slots, nullptr) {}
+
+	~FrameRingBuffer() {
+		release();
+	}
+
+	void init(GLsizeiptr bytesPerFrame) {
+		release();
+		regionSize = bytesPerFrame;
+		const GLsizeiptr size = regionSize * (GLsizeiptr)fences.size();
+		glGenBuffers(1, &ring);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ring);
+		if (GLEW_ARB_buffer_storage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+			mapped = (unsigned char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		}
+		else {
+			glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		slot = 0;
+		head = 0;
+		blocked = false;
+		frames = waits = timeouts = overflows = 0;
+		waitSeconds = 0.0;
+	}
+
+	void release() {
+		if (mapped) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ring);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			mapped = nullptr;
+		}
+		for (GLsync & fence : fences) {
+			if (fence) glDeleteSync(fence);
+			fence = nullptr;
+		}
+		if (ring) glDeleteBuffers(1, &ring);
+		ring = 0;
+		regionSize = 0;
+	}
+
+	// Moves to the next region, waiting for the GPU to finish the frame that used it last
+	void beginFrame() {
+		slot = (slot + 1) % (unsigned int)fences.size();
+		head = 0;
+		blocked = false;
+		if (!fences[slot]) {
+			return;
+		}
+		++frames;
+		GLenum status = glClientWaitSync(fences[slot], 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			auto start = std::chrono::steady_clock::now();
+			status = glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			++waits;
+		}
+		if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+			// the GPU may still read the region: keep its fence and write nothing there
+			blocked = true;
+			++timeouts;
+			return;
+		}
+		glDeleteSync(fences[slot]);
+		fences[slot] = nullptr;
+	}
+
+	// Fences the current region after everything reading it has been issued
+	void endFrame() {
+		if (ring && !blocked) {
+			fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	// size bytes of this frame's region at a multiple of alignment (a power of two),
+	// or an empty range if the region is full
+	Range allocate(GLsizeiptr size, GLintptr alignment) {
+		Range range;
+		GLintptr start = (head + alignment - 1) & ~(alignment - 1);
+		if (!ring || blocked || start + size > regionSize) {
+			++overflows;
+			return range;
+		}
+		head = start + size;
+		range.offset = slot * regionSize + start;
+		range.size = size;
+		range.data = mapped ? mapped + range.offset : nullptr;
+		return range;
+	}
+
+	// Copies into a range, for callers that don't write through range.data. A range
+	// may be rewritten until the GPU runs the commands reading it (see late latching).
+	void write(const Range & range, const void * source, GLsizeiptr size) {
+		if (mapped) {
+			memcpy(mapped + range.offset, source, size);
+		}
+		else {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ring);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset, size, source);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+	}
+
+	GLuint buffer() const {
+		return ring;
+	}
+
+	bool persistent() const {
+		return mapped != nullptr;
+	}
+
+	// Frames that found their region still in use, the time spent waiting for it, frames
+	// that gave up waiting, and allocations refused because a region was full or given
+	// up on, since init()
+	unsigned int stalledFrames() const { return waits; }
+	unsigned int fencedFrames() const { return frames; }
+	double stallSeconds() const { return waitSeconds; }
+	unsigned int timedOutFrames() const { return timeouts; }
+	unsigned int overflowCount() const { return overflows; }
+
+private:
+	GLuint ring{ 0 };
+	GLsizeiptr regionSize{ 0 };
+	unsigned char * mapped{ nullptr };
+	std::vector<GLsync> fences; // one per region
+	unsigned int slot{ 0 };
+	GLintptr head{ 0 };
+	bool blocked{ false }; // this frame's region is still fenced, nothing is allocated from it
+
+	unsigned int frames{ 0 };
+	unsigned int waits{ 0 };
+	unsigned int timeouts{ 0 };
+	double waitSeconds{ 0.0 };
+	unsigned int overflows{ 0 };
+};
+
+#endif
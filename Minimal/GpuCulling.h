@@ -0,0 +1,365 @@
+#pragma once
+//
+//  GpuCulling.h
+//  Frustum culling on the GPU for GL 4.3 contexts: a compute shader tests every
+//  instance against both eyes and writes glMultiDrawElementsIndirect commands.
+//
+
+#ifndef GpuCulling_h
+#define GpuCulling_h
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "EntityStore.h"
+#include "HiZ.h"
+#include "shader.h"
+
+// The instances are the entities on one layer, grouped into one draw command per mesh
+// for each eye. Every frame cull() resets the commands' instance counts and the compute
+// shader appends each visible instance to its eye's command, so the CPU issues the
+// same handful of calls however many instances there are. Bounds and model matrices
+// live in storage buffers and are only re-uploaded when the entities move.
+// Given depth pyramids (setOcclusion), the shader also drops instances hidden in them.
+class GpuCuller {
+public:
+	// What glMultiDrawElementsIndirect reads, one per command
+	struct DrawCommand {
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+
+	// Storage buffer bindings shared with shader_cull.comp and shader_cube_indirect.vert
+	enum Binding : GLuint {
+		BOUNDS_BINDING = 0,
+		SLOTS_BINDING = 1,
+		COMMANDS_BINDING = 2,
+		VISIBLE_BINDING = 3,
+		MODELS_BINDING = 4,
+		OCCLUDED_BINDING = 5,
+		EXTENTS_BINDING = 6,
+	};
+
+	static const GLuint GROUP_SIZE = 64; // local_size_x of the cull shader
+
+	// Compute shaders, storage buffers and indirect multi-draws are all core in 4.3
+	static bool supported() {
+		return GLEW_VERSION_4_3 != 0;
+	}
+
+	~GpuCuller() {
+		release();
+	}
+
+	// Builds the programs and a VAO over the mesh buffers, whose first indexCount indices
+	// are drawn per instance. Every mesh on the layer must share this geometry: they
+	// differ only in the state the caller binds. False if a program fails to build.
+	bool init(const char * cullPath, const char * vertPath, const char * fragPath,
+		GLuint vertexBuffer, GLuint indexBuffer, GLsizei indexCount) {
+		release();
+		cullProgram = LoadComputeShader(cullPath);
+		drawProgram = LoadShaders(vertPath, fragPath);
+		GLint linked = GL_FALSE;
+		if (drawProgram) {
+			glGetProgramiv(drawProgram, GL_LINK_STATUS, &linked);
+		}
+		if (!cullProgram || linked != GL_TRUE) {
+			release();
+			return false;
+		}
+		uPlanes = glGetUniformLocation(cullProgram, "planes");
+		uTotalInstances = glGetUniformLocation(cullProgram, "totalInstances");
+		uCommandsPerEye = glGetUniformLocation(cullProgram, "commandsPerEye");
+		elementCount = (GLuint)indexCount;
+
+		glGenBuffers(1, &boundsBuffer);
+		glGenBuffers(1, &slotsBuffer);
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &visibleBuffer);
+		glGenBuffers(1, &modelsBuffer);
+		uOcclusionEyes = glGetUniformLocation(cullProgram, "occlusionEyes");
+		uOcclusionViewProjections = glGetUniformLocation(cullProgram, "occlusionViewProjections");
+		uHiz = glGetUniformLocation(cullProgram, "hiz");
+		glGenBuffers(1, &occludedBuffer);
+		glGenBuffers(1, &extentsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, occludedBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+		// the culled instance list doubles as a per-instance attribute; each command's
+		// baseInstance offsets into it
+		glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+		glEnableVertexAttribArray(1);
+		glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+		glVertexAttribDivisor(1, 1);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return true;
+	}
+
+	void release() {
+		if (vao) glDeleteVertexArrays(1, &vao);
+		GLuint buffers[] = { boundsBuffer, slotsBuffer, commandBuffer, visibleBuffer, modelsBuffer, occludedBuffer, extentsBuffer };
+		for (GLuint buffer : buffers) {
+			if (buffer) glDeleteBuffers(1, &buffer);
+		}
+		if (hizTexture) glDeleteTextures(1, &hizTexture);
+		if (cullProgram) glDeleteProgram(cullProgram);
+		if (drawProgram) glDeleteProgram(drawProgram);
+		vao = boundsBuffer = slotsBuffer = commandBuffer = visibleBuffer = modelsBuffer = occludedBuffer = extentsBuffer = hizTexture = 0;
+		hizWidth = hizHeight = 0;
+		occlusionEyes = 0;
+		cullProgram = drawProgram = 0;
+		entityOf.clear();
+		commandMeshes.clear();
+		commandTemplate.clear();
+	}
+
+	bool ready() const {
+		return cullProgram != 0;
+	}
+
+	// Takes the entities on layerMask as the instances and sizes every buffer for them
+	void setInstances(const EntityStore & entities, uint32_t layerMask) {
+		entityOf.clear();
+		commandMeshes.clear();
+		std::vector<GLuint> slots;
+		std::vector<GLuint> perCommand;
+		for (EntityStore::Entity entity = 0; entity < entities.size(); ++entity) {
+			if (!(entities.layers[entity] & layerMask)) {
+				continue;
+			}
+			GLuint slot = 0;
+			while (slot < commandMeshes.size() && commandMeshes[slot] != entities.meshes[entity]) ++slot;
+			if (slot == commandMeshes.size()) {
+				commandMeshes.push_back(entities.meshes[entity]);
+				perCommand.push_back(0);
+			}
+			++perCommand[slot];
+			slots.push_back(slot);
+			entityOf.push_back(entity);
+		}
+
+		// each eye gets a range of the visible list the size of the whole instance set,
+		// split between its commands by how many instances each could draw
+		const GLuint total = (GLuint)entityOf.size();
+		commandTemplate.clear();
+		for (GLuint eye = 0; eye < 2; ++eye) {
+			GLuint first = eye * total;
+			for (GLuint count : perCommand) {
+				DrawCommand command = { elementCount, 0, 0, 0, first };
+				commandTemplate.push_back(command);
+				first += count;
+			}
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, slotsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(slots.size(), 1) * sizeof(GLuint), slots.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(total, 1) * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, extentsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(total, 1) * sizeof(glm::vec4), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(total, 1) * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(2 * total, 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, std::max<size_t>(commandTemplate.size(), 1) * sizeof(DrawCommand), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		updateInstances(entities);
+	}
+
+	// Uploads the instances' world bounds (spheres for the frustum, boxes for occlusion)
+	// and model matrices, after the entities moved
+	void updateInstances(const EntityStore & entities) {
+		const size_t total = entityOf.size();
+		if (!total) {
+			return;
+		}
+		boundsScratch.resize(total);
+		extentsScratch.resize(total);
+		modelsScratch.resize(total);
+		for (size_t i = 0; i < total; ++i) {
+			EntityStore::Entity entity = entityOf[i];
+			boundsScratch[i] = glm::vec4(entities.centerX[entity], entities.centerY[entity], entities.centerZ[entity], entities.radius[entity]);
+			extentsScratch[i] = glm::vec4(entities.extentX[entity], entities.extentY[entity], entities.extentZ[entity], 0.0f);
+			modelsScratch[i] = entities.worlds[entity];
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, total * sizeof(glm::vec4), boundsScratch.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, extentsBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, total * sizeof(glm::vec4), extentsScratch.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelsBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, total * sizeof(glm::mat4), modelsScratch.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Uploads the eyes' depth pyramids for the next cull() to test against, one array
+	// layer per eye. Eyes without a valid pyramid, or null, switch the test off. The
+	// pyramid has to halve exactly down to 1x1 (a power-of-two grid) to match GL's mips.
+	void setOcclusion(const HiZBuffer * eyes) {
+		occlusionEyes = 0;
+		if (!eyes) {
+			return;
+		}
+		for (int eye = 0; eye < 2; ++eye) {
+			const std::vector<HiZBuffer::Level> & levels = eyes[eye].pyramid();
+			if (levels.empty()) {
+				continue;
+			}
+			const int width = levels[0].width, height = levels[0].height;
+			bool matchesMips = true;
+			for (size_t l = 0; l < levels.size(); ++l) {
+				matchesMips = matchesMips && levels[l].width == std::max(width >> l, 1) && levels[l].height == std::max(height >> l, 1);
+			}
+			if (!matchesMips) {
+				continue;
+			}
+			if (width != hizWidth || height != hizHeight) {
+				createHiz(width, height, (GLint)levels.size());
+			}
+			glBindTexture(GL_TEXTURE_2D_ARRAY, hizTexture);
+			for (size_t l = 0; l < levels.size(); ++l) {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)l, 0, 0, eye, levels[l].width, levels[l].height, 1, GL_RED, GL_FLOAT, levels[l].depth.data());
+			}
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+			occlusionViewProjections[eye] = eyes[eye].viewProjection();
+			occlusionEyes |= 1 << eye;
+		}
+	}
+
+	// Resets the commands and culls every instance against both eyes' planes. The
+	// barrier makes the draws that follow wait for the commands it writes.
+	void cull(const glm::vec4 planes[2][6]) {
+		const GLuint total = (GLuint)entityOf.size();
+		if (!total) {
+			return;
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandTemplate.size() * sizeof(DrawCommand), commandTemplate.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		const GLuint zeros[2] = { 0, 0 };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, occludedBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glUseProgram(cullProgram);
+		glUniform4fv(uPlanes, 12, &planes[0][0].x);
+		glUniform1ui(uTotalInstances, total);
+		glUniform1ui(uCommandsPerEye, (GLuint)commandMeshes.size());
+		glUniform1i(uOcclusionEyes, occlusionEyes);
+		if (occlusionEyes) {
+			glUniformMatrix4fv(uOcclusionViewProjections, 2, GL_FALSE, &occlusionViewProjections[0][0][0]);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, hizTexture);
+			glUniform1i(uHiz, 0);
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, boundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SLOTS_BINDING, slotsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMANDS_BINDING, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_BINDING, visibleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUDED_BINDING, occludedBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, EXTENTS_BINDING, extentsBuffer);
+		glDispatchCompute((total + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glUseProgram(0);
+	}
+
+	// Instances the last cull() found hidden, per eye. Reading it waits for that cull to
+	// finish on the GPU, so it is for the occasional stats dump, not every frame.
+	void occludedCounts(unsigned int counts[2]) const {
+		GLuint values[2] = { 0, 0 };
+		if (occludedBuffer) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, occludedBuffer);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(values), values);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		counts[0] = values[0];
+		counts[1] = values[1];
+	}
+
+	// The visible instances of one eye's commands [first, first + count) in a single
+	// call, by default all of them. drawProgram must be in use with its uniforms and
+	// the state of every mesh those commands draw already bound.
+	void draw(int eye, size_t first = 0, size_t count = ~(size_t)0) const {
+		const size_t commandsPerEye = commandMeshes.size();
+		count = std::min(count, commandsPerEye - std::min(first, commandsPerEye));
+		if (entityOf.empty() || !count) {
+			return;
+		}
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MODELS_BINDING, modelsBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBindVertexArray(vao);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(const GLvoid *)((eye * commandsPerEye + first) * sizeof(DrawCommand)), (GLsizei)count, 0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	GLuint program() const {
+		return drawProgram;
+	}
+
+	size_t instanceCount() const {
+		return entityOf.size();
+	}
+
+	// The mesh each of an eye's commands draws
+	const std::vector<uint16_t> & meshes() const {
+		return commandMeshes;
+	}
+
+private:
+	GLuint cullProgram{ 0 };
+	GLuint drawProgram{ 0 };
+	GLint uPlanes{ -1 }, uTotalInstances{ -1 }, uCommandsPerEye{ -1 };
+	GLuint vao{ 0 };
+	GLuint boundsBuffer{ 0 }, slotsBuffer{ 0 }, commandBuffer{ 0 }, visibleBuffer{ 0 }, modelsBuffer{ 0 };
+	GLuint elementCount{ 0 };
+
+	// occlusion: the eyes' pyramids as layers of one mipmapped array texture
+	GLint uOcclusionEyes{ -1 }, uOcclusionViewProjections{ -1 }, uHiz{ -1 };
+	GLuint occludedBuffer{ 0 };
+	GLuint extentsBuffer{ 0 }; // world box half sizes in xyz, around the bounds' centres
+	GLuint hizTexture{ 0 };
+	int hizWidth{ 0 }, hizHeight{ 0 };
+	int occlusionEyes{ 0 }; // bit per eye with a pyramid uploaded
+	glm::mat4 occlusionViewProjections[2];
+
+	std::vector<EntityStore::Entity> entityOf; // instance -> entity
+	std::vector<uint16_t> commandMeshes;       // command slot -> mesh
+	std::vector<DrawCommand> commandTemplate;  // both eyes' commands with no instances yet
+	std::vector<glm::vec4> boundsScratch;
+	std::vector<glm::vec4> extentsScratch;
+	std::vector<glm::mat4> modelsScratch;
+
+	void createHiz(int width, int height, GLint levels) {
+		if (hizTexture) glDeleteTextures(1, &hizTexture);
+		glGenTextures(1, &hizTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, hizTexture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_R32F, width, height, 2);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		hizWidth = width;
+		hizHeight = height;
+	}
+};
+
+#endif
@@ -0,0 +1,243 @@
+#pragma once
+//
+//  GpuTimer.h
+//  Times named render passes on the GPU with pooled GL_TIMESTAMP queries.
+//
+
+#ifndef GpuTimer_h
+#define GpuTimer_h
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <ostream>
+#include <iomanip>
+
+#include <GL/glew.h>
+
+// Every pass is bracketed by two GL_TIMESTAMP queries (timestamps nest, unlike
+// GL_TIME_ELAPSED). Queries are pooled per frame slot and a slot is only read
+// back when it comes around again, `latency` frames later, so reading never
+// stalls the pipeline. Results that still aren't ready then are dropped.
+class GpuTimer {
+public:
+	struct PassStats {
+		float average; // milliseconds
+		float p50;
+		float p95;
+		float p99;
+		float max;
+		unsigned int samples;
+	};
+
+	// RAII helper, does nothing when given a null timer
+	class Scope {
+		GpuTimer * timer;
+		unsigned int pass;
+	public:
+		Scope(GpuTimer * t, const char * name) : timer(t), pass(0) {
+			if (timer) pass = timer->begin(name);
+		}
+		~Scope() {
+			if (timer) timer->end(pass);
+		}
+	};
+
+	GpuTimer(unsigned int latency = 4, unsigned int history = 128)
+		: slots(latency), historySize(history) {}
+
+	~GpuTimer() {
+		release();
+	}
+
+	void release() {
+		for (auto & slot : slots) {
+			if (!slot.pool.empty()) {
+				glDeleteQueries((GLsizei)slot.pool.size(), slot.pool.data());
+				slot.pool.clear();
+			}
+			slot.records.clear();
+		}
+	}
+
+	// Call once per frame before the first pass is timed
+	void beginFrame() {
+		current = (current + 1) % slots.size();
+		collect(slots[current]);
+	}
+
+	unsigned int begin(const char * name) {
+		unsigned int pass = passIndex(name);
+		Slot & slot = slots[current];
+		Record record;
+		record.pass = pass;
+		record.beginQuery = acquire(slot);
+		record.endQuery = 0;
+		glQueryCounter(record.beginQuery, GL_TIMESTAMP);
+		slot.open.push_back((unsigned int)slot.records.size());
+		slot.records.push_back(record);
+		return pass;
+	}
+
+	void end(unsigned int pass) {
+		Slot & slot = slots[current];
+		// close the innermost open record of this pass
+		for (auto it = slot.open.rbegin(); it != slot.open.rend(); ++it) {
+			Record & record = slot.records[*it];
+			if (record.pass == pass) {
+				record.endQuery = acquire(slot);
+				glQueryCounter(record.endQuery, GL_TIMESTAMP);
+				slot.open.erase(std::next(it).base());
+				return;
+			}
+		}
+	}
+
+	bool stats(const std::string & name, PassStats & out) const {
+		for (const auto & pass : passes) {
+			if (pass.name == name) {
+				out = summarize(pass);
+				return out.samples > 0;
+			}
+		}
+		return false;
+	}
+
+	unsigned int droppedFrames() const {
+		return dropped;
+	}
+
+	void dump(std::ostream & out) const {
+		out << "GPU pass timings (ms over the last " << historySize << " frames)" << std::endl;
+		out << std::fixed << std::setprecision(3);
+		for (const auto & pass : passes) {
+			PassStats s = summarize(pass);
+			if (!s.samples) {
+				continue;
+			}
+			out << "  " << std::left << std::setw(16) << pass.name << std::right
+				<< " avg " << s.average << "  p50 " << s.p50 << "  p95 " << s.p95
+				<< "  p99 " << s.p99 << "  max " << s.max << std::endl;
+		}
+		if (dropped) {
+			out << "  (" << dropped << " frames of results were not ready in time and were dropped)" << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+private:
+	struct Record {
+		unsigned int pass;
+		GLuint beginQuery;
+		GLuint endQuery;
+	};
+
+	struct Slot {
+		std::vector<GLuint> pool; // grows to the largest number of queries one frame needed
+		unsigned int used{ 0 };
+		std::vector<Record> records;
+		std::vector<unsigned int> open;
+	};
+
+	struct Pass {
+		std::string name;
+		std::vector<float> history; // ring of the last historySize timings
+		unsigned int head{ 0 };
+		float accumulated{ 0.0f }; // a pass may run several times per frame
+	};
+
+	std::vector<Slot> slots;
+	std::vector<Pass> passes;
+	unsigned int current{ 0 };
+	unsigned int historySize;
+	unsigned int dropped{ 0 };
+
+	unsigned int passIndex(const char * name) {
+		for (unsigned int i = 0; i < passes.size(); ++i) {
+			if (passes[i].name == name) {
+				return i;
+			}
+		}
+		Pass pass;
+		pass.name = name;
+		pass.history.reserve(historySize);
+		passes.push_back(pass);
+		return (unsigned int)passes.size() - 1;
+	}
+
+	GLuint acquire(Slot & slot) {
+		if (slot.used == slot.pool.size()) {
+			GLuint query;
+			glGenQueries(1, &query);
+			slot.pool.push_back(query);
+		}
+		return slot.pool[slot.used++];
+	}
+
+	void collect(Slot & slot) {
+		if (!slot.records.empty()) {
+			// queries complete in order, so the last one tells us about the whole frame
+			GLuint available = 0;
+			glGetQueryObjectuiv(slot.pool[slot.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				++dropped;
+			}
+			else {
+				for (const Record & record : slot.records) {
+					if (!record.endQuery) {
+						continue;
+					}
+					GLuint64 begin, end;
+					glGetQueryObjectui64v(record.beginQuery, GL_QUERY_RESULT, &begin);
+					glGetQueryObjectui64v(record.endQuery, GL_QUERY_RESULT, &end);
+					passes[record.pass].accumulated += (float)(end - begin) / 1.0e6f;
+				}
+				for (auto & pass : passes) {
+					if (pass.accumulated > 0.0f) {
+						push(pass, pass.accumulated);
+						pass.accumulated = 0.0f;
+					}
+				}
+			}
+		}
+		slot.used = 0;
+		slot.records.clear();
+		slot.open.clear();
+	}
+
+	void push(Pass & pass, float ms) {
+		if (pass.history.size() < historySize) {
+			pass.history.push_back(ms);
+		}
+		else {
+			pass.history[pass.head] = ms;
+		}
+		pass.head = (pass.head + 1) % historySize;
+	}
+
+	static PassStats summarize(const Pass & pass) {
+		PassStats s = {};
+		s.samples = (unsigned int)pass.history.size();
+		if (!s.samples) {
+			return s;
+		}
+		std::vector<float> sorted(pass.history);
+		std::sort(sorted.begin(), sorted.end());
+		float sum = 0.0f;
+		for (float ms : sorted) {
+			sum += ms;
+		}
+		auto percentile = [&](float p) {
+			return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5f))];
+		};
+		s.average = sum / s.samples;
+		s.p50 = percentile(0.50f);
+		s.p95 = percentile(0.95f);
+		s.p99 = percentile(0.99f);
+		s.max = sorted.back();
+		return s;
+	}
+};
+
+#endif
@@ -0,0 +1,234 @@
+#pragma once
+//
+//  HiZ.h
+//  Occlusion culling against a depth pyramid built from last frame's depth,
+//  reprojected into this frame's view.
+//
+
+#ifndef HiZ_h
+#define HiZ_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Culling.h"
+
+// One eye's depth as read back from the GPU: the farthest window-space depth in each
+// cell of a coarse grid, row 0 at the bottom, and the view-projection it was drawn with.
+// 0 is the hidden area mask (on the near plane), 1 is nothing drawn.
+struct DepthGrid {
+	int width{ 0 };
+	int height{ 0 };
+	std::vector<float> depth;
+	glm::mat4 viewProjection;
+};
+
+// A max-depth pyramid over one eye's viewport. build() scatters every cell of an older
+// grid into the new view, keeping the farthest depth that lands in each cell. Cells
+// nothing lands in count as far, and a 3x3 max filter then covers the gaps a forward
+// splat leaves, so a reprojected occluder only ever shrinks. Mask cells are dropped the
+// same way. Each coarser level keeps the farthest of the 2x2 cells below it.
+//
+// Only the camera is reprojected: an occluder that moved since the grid was read back
+// is still where it was, for the frame or two until a newer grid arrives.
+class HiZBuffer {
+public:
+	struct Level {
+		int width;
+		int height;
+		std::vector<float> depth;
+	};
+
+	void build(const DepthGrid & previous, const glm::mat4 & viewProjection) {
+		const int width = previous.width, height = previous.height;
+		if (width <= 0 || height <= 0 || previous.depth.size() < (size_t)(width * height)) {
+			levels.clear();
+			return;
+		}
+		current = viewProjection;
+		for (int r = 0; r < 4; ++r) {
+			rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+			absRows[r] = glm::abs(glm::vec3(rows[r]));
+		}
+		depthSlope = glm::dot(glm::vec3(rows[2]), glm::vec3(rows[3])) / glm::dot(glm::vec3(rows[3]), glm::vec3(rows[3]));
+
+		scatter.assign(width * height, -1.0f);
+		const glm::mat4 toCurrent = viewProjection * glm::inverse(previous.viewProjection);
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				float d = previous.depth[y * width + x];
+				if (d <= 0.0f || d >= 1.0f) {
+					continue;
+				}
+				glm::vec4 clip = toCurrent * glm::vec4((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f, d * 2.0f - 1.0f, 1.0f);
+				if (clip.w <= 0.0f) {
+					continue;
+				}
+				float fx = (clip.x / clip.w * 0.5f + 0.5f) * width;
+				float fy = (clip.y / clip.w * 0.5f + 0.5f) * height;
+				if (!(fx >= 0.0f && fx < width && fy >= 0.0f && fy < height)) {
+					continue;
+				}
+				float & cell = scatter[(int)fy * width + (int)fx];
+				cell = std::max(cell, clip.z / clip.w * 0.5f + 0.5f);
+			}
+		}
+
+		levels.resize(1);
+		Level & base = levels[0];
+		base.width = width;
+		base.height = height;
+		base.depth.resize(width * height);
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				float farthest = 0.0f;
+				for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny) {
+					for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx) {
+						float d = scatter[ny * width + nx];
+						farthest = std::max(farthest, d < 0.0f ? 1.0f : d);
+					}
+				}
+				base.depth[y * width + x] = farthest;
+			}
+		}
+
+		while (levels.back().width > 1 || levels.back().height > 1) {
+			const Level & below = levels.back();
+			Level level;
+			level.width = (below.width + 1) / 2;
+			level.height = (below.height + 1) / 2;
+			level.depth.resize(level.width * level.height);
+			for (int y = 0; y < level.height; ++y) {
+				for (int x = 0; x < level.width; ++x) {
+					int x0 = 2 * x, x1 = std::min(2 * x + 1, below.width - 1);
+					int y0 = 2 * y, y1 = std::min(2 * y + 1, below.height - 1);
+					level.depth[y * level.width + x] = std::max(
+						std::max(below.depth[y0 * below.width + x0], below.depth[y0 * below.width + x1]),
+						std::max(below.depth[y1 * below.width + x0], below.depth[y1 * below.width + x1]));
+				}
+			}
+			levels.push_back(std::move(level));
+		}
+	}
+
+	void clear() {
+		levels.clear();
+	}
+
+	bool valid() const {
+		return !levels.empty();
+	}
+
+	// The view-projection the pyramid was built for
+	const glm::mat4 & viewProjection() const {
+		return current;
+	}
+
+	const std::vector<Level> & pyramid() const {
+		return levels;
+	}
+
+	// True if the world-space box (center, half extent) is certainly behind the depth in
+	// the pyramid. Its clip-space extent is bounded with interval arithmetic on the
+	// view-projection rows (eight dot products, no corner transforms); a box reaching
+	// behind the eye is never occluded. In a perspective projection clip z is a linear
+	// function of w alone, so the nearest depth comes from the box's w range exactly
+	// rather than from a z/w interval. The level is picked so the screen rectangle
+	// covers at most 3x3 cells: one level coarser (2x2) would test against up to
+	// twice the box's size, and small occluders would never hide anything.
+	bool occluded(const glm::vec3 & boxCenter, const glm::vec3 & halfExtent) const {
+		if (levels.empty()) {
+			return false;
+		}
+		const glm::vec4 center(boxCenter, 1.0f);
+		float cx = glm::dot(rows[0], center), cy = glm::dot(rows[1], center);
+		float cz = glm::dot(rows[2], center), cw = glm::dot(rows[3], center);
+		float rx = glm::dot(absRows[0], halfExtent), ry = glm::dot(absRows[1], halfExtent), rw = glm::dot(absRows[3], halfExtent);
+		float minW = cw - rw, maxW = cw + rw;
+		if (minW <= 1.0e-5f) {
+			return false;
+		}
+		float minX = lowerRatio(cx - rx, minW, maxW), maxX = upperRatio(cx + rx, minW, maxW);
+		float minY = lowerRatio(cy - ry, minW, maxW), maxY = upperRatio(cy + ry, minW, maxW);
+		float depthOffset = cz - depthSlope * cw; // z = depthSlope * w + depthOffset
+		float nearest = std::min(depthOffset / minW, depthOffset / maxW) * 0.5f + depthSlope * 0.5f + 0.5f;
+		if (nearest <= 0.0f) {
+			return false;
+		}
+		minX = std::max(minX, -1.0f);
+		minY = std::max(minY, -1.0f);
+		maxX = std::min(maxX, 1.0f);
+		maxY = std::min(maxY, 1.0f);
+		if (minX >= maxX || minY >= maxY) {
+			return false; // off screen, the frustum cull's business
+		}
+
+		const Level & base = levels[0];
+		float x0 = (minX * 0.5f + 0.5f) * base.width, x1 = (maxX * 0.5f + 0.5f) * base.width;
+		float y0 = (minY * 0.5f + 0.5f) * base.height, y1 = (maxY * 0.5f + 0.5f) * base.height;
+		float extent = std::max(x1 - x0, y1 - y0);
+		int level = extent > 2.0f ? (int)std::ceil(std::log2(extent)) - 1 : 0;
+		level = std::min(level, (int)levels.size() - 1);
+		const Level & cells = levels[level];
+		const float scale = 1.0f / (float)(1 << level);
+		int ix0 = std::min((int)(x0 * scale), cells.width - 1), ix1 = std::min((int)(x1 * scale), cells.width - 1);
+		int iy0 = std::min((int)(y0 * scale), cells.height - 1), iy1 = std::min((int)(y1 * scale), cells.height - 1);
+		float farthest = 0.0f;
+		for (int iy = iy0; iy <= iy1; ++iy) {
+			for (int ix = ix0; ix <= ix1; ++ix) {
+				farthest = std::max(farthest, cells.depth[iy * cells.width + ix]);
+			}
+		}
+		return nearest > farthest;
+	}
+
+private:
+	std::vector<Level> levels;
+	std::vector<float> scatter;
+	glm::mat4 current;
+	glm::vec4 rows[4];
+	glm::vec3 absRows[4];
+	float depthSlope; // clip z per unit of clip w
+
+	// Bounds of value / w over w in [minW, maxW] (minW > 0)
+	static float lowerRatio(float value, float minW, float maxW) {
+		return value / (value >= 0.0f ? maxW : minW);
+	}
+	static float upperRatio(float value, float minW, float maxW) {
+		return value / (value >= 0.0f ? minW : maxW);
+	}
+};
+
+namespace culling {
+
+	// Clears the eye bits of boxes on layerMask that are hidden in that eye's pyramid,
+	// after cullStereo() has set them. Eyes without a valid pyramid are left alone.
+	// Boxes rather than the culling spheres: a sphere around a cube is half as wide
+	// again, and a cube only just hidden behind another would never count as occluded.
+	inline void occlusionCull(const Boxes & boxes, uint32_t layerMask, const HiZBuffer eyes[2], uint8_t * visible, StereoStats & stats) {
+		const bool valid[2] = { eyes[0].valid(), eyes[1].valid() };
+		if (!valid[0] && !valid[1]) {
+			return;
+		}
+		for (size_t i = 0; i < boxes.count; ++i) {
+			if (!visible[i] || !(boxes.layers[i] & layerMask)) {
+				continue;
+			}
+			const glm::vec3 center(boxes.x[i], boxes.y[i], boxes.z[i]);
+			const glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+			for (int eye = 0; eye < 2; ++eye) {
+				if (valid[eye] && (visible[i] >> eye & 1) && eyes[eye].occluded(center, extent)) {
+					visible[i] &= (uint8_t)~(1 << eye);
+					--stats.visible[eye];
+					++stats.occluded[eye];
+				}
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+//
+//  ImageCache.h
+//  Image files decoded ahead of time on the startup tasks, so the cube map
+//  uploads find their pixels ready instead of decoding on the GL thread.
+//
+
+#ifndef ImageCache_h
+#define ImageCache_h
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Cube.h has included it already, with the implementation
+#include "stb_image.h"
+
+#include "StartupTasks.h"
+
+// Pixels as stbi_load returns them, rows top to bottom, channels bytes each
+struct DecodedImage {
+	int width{ 0 };
+	int height{ 0 };
+	int channels{ 0 };
+	std::unique_ptr<unsigned char, void (*)(void *)> pixels{ nullptr, free };
+};
+
+// Null if the file can't be read or decoded. stbi_load keeps no state between calls
+// apart from its last failure reason, which Cube.h makes thread_local, so decodes may
+// run on several threads at once; stbi_failure_reason() is only meaningful on the
+// thread whose decode failed.
+inline std::shared_ptr<DecodedImage> decodeImage(const std::string & path, int channels) {
+	std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+	int fileChannels = 0;
+	image->pixels = std::unique_ptr<unsigned char, void (*)(void *)>(
+		stbi_load(path.c_str(), &image->width, &image->height, &fileChannels, channels), stbi_image_free);
+	if (!image->pixels) {
+		return nullptr;
+	}
+	image->channels = channels ? channels : fileChannels;
+	return image;
+}
+
+// Every file is decoded once, as RGB, the layout both cube map paths upload. get()
+// waits for a decode still in flight; a file nobody prefetched is the caller's to
+// decode. clear() once the uploads are done gives the memory back.
+class PrefetchedImages {
+public:
+	static const int CHANNELS = 3;
+
+	explicit PrefetchedImages(StartupTasks & tasks) : tasks(tasks) {}
+
+	// Queues the decode unless the file already is; returns its task
+	StartupTasks::Task prefetch(const std::string & path) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = entries.find(path);
+		if (found != entries.end()) {
+			return found->second.task;
+		}
+		Entry & entry = entries[path];
+		entry.task = tasks.add("decode " + path, [this, path, &entry] {
+			std::shared_ptr<const DecodedImage> image = decodeImage(path, CHANNELS);
+			std::lock_guard<std::mutex> lock(mutex);
+			entry.image = image;
+		});
+		return entry.task;
+	}
+
+	// The decoded file, null if it was never prefetched, failed to decode or was cleared
+	std::shared_ptr<const DecodedImage> get(const std::string & path) {
+		StartupTasks::Task task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto found = entries.find(path);
+			if (found == entries.end()) {
+				return nullptr;
+			}
+			task = found->second.task;
+		}
+		tasks.wait(task);
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries[path].image;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto & entry : entries) {
+			entry.second.image.reset();
+		}
+	}
+
+private:
+	struct Entry {
+		StartupTasks::Task task{ 0 };
+		std::shared_ptr<const DecodedImage> image;
+	};
+
+	StartupTasks & tasks;
+	std::mutex mutex;
+	std::map<std::string, Entry> entries; // a map so entries stay put for their tasks
+};
+
+#endif
@@ -0,0 +1,192 @@
+#pragma once
+//
+//  InputSampler.h
+//  Samples the Touch controllers on their own thread at a fixed rate and
+//  turns state changes into timestamped events for the frame loop.
+//
+
+#ifndef InputSampler_h
+#define InputSampler_h
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <timeapi.h> // timeBeginPeriod, so short sleeps aren't rounded up to the 15.6 ms tick
+#endif
+
+#include <OVR_CAPI.h>
+
+#include "Profiler.h"
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+template <typename T, size_t Capacity>
+class SpscQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	T items[Capacity];
+	std::atomic<size_t> head{ 0 }; // next slot to read, owned by the consumer
+	std::atomic<size_t> tail{ 0 }; // next slot to write, owned by the producer
+
+public:
+	bool push(const T & item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		items[t & (Capacity - 1)] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Items waiting; exact on either side's own thread, at most stale by the other's progress
+	size_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	bool pop(T & item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = items[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+struct InputEvent {
+	// Resync replaces the consumer's whole state after events were dropped
+	enum Type { ButtonDown, ButtonUp, Thumbstick, Resync };
+
+	Type type;
+	double time;           // ovr_GetTimeInSeconds() at which the controller state was sampled
+	unsigned int button;   // ovrButton_* bit for button events, every button held for Resync
+	int hand;              // ovrHand_* for thumbstick events
+	float x, y;            // thumbstick deflection
+	ovrVector2f sticks[2]; // both thumbsticks, for Resync
+};
+
+// The sampler only counts a change as sent once it is in the queue. A button event that
+// doesn't fit is dropped and a Resync with the full state follows as soon as one fits,
+// so the consumer can't be left holding a released button. Thumbstick changes only use
+// the first half of the queue; past that each stick's latest value waits, merged, for
+// room, and buttons keep the rest.
+class InputSampler {
+	static const size_t QUEUE_CAPACITY = 1024;
+	static const size_t STICK_ROOM = QUEUE_CAPACITY / 2;
+
+	ovrSession session{ nullptr };
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::atomic<unsigned int> dropped{ 0 };
+	double rateHz{ 500.0 };
+
+	SpscQueue<InputEvent, QUEUE_CAPACITY> queue;
+
+	void run() {
+		PROFILE_THREAD("input");
+#ifdef _WIN32
+		timeBeginPeriod(1);
+#endif
+		const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(1.0 / rateHz));
+		auto next = std::chrono::steady_clock::now();
+
+		// the state the consumer has once it has applied everything queued so far
+		unsigned int buttons = 0;
+		ovrVector2f thumbstick[2] = { { 0.0f, 0.0f },{ 0.0f, 0.0f } };
+		bool resync = false;
+
+		while (running.load(std::memory_order_relaxed)) {
+			ovrInputState state;
+			if (OVR_SUCCESS(ovr_GetInputState(session, ovrControllerType_Touch, &state))) {
+				InputEvent e = {};
+				e.time = state.TimeInSeconds;
+
+				if (resync) {
+					e.type = InputEvent::Resync;
+					e.button = state.Buttons;
+					e.sticks[ovrHand_Left] = state.Thumbstick[ovrHand_Left];
+					e.sticks[ovrHand_Right] = state.Thumbstick[ovrHand_Right];
+					if (queue.push(e)) {
+						resync = false;
+						buttons = state.Buttons;
+						thumbstick[ovrHand_Left] = state.Thumbstick[ovrHand_Left];
+						thumbstick[ovrHand_Right] = state.Thumbstick[ovrHand_Right];
+					}
+				}
+				else {
+					unsigned int changed = state.Buttons ^ buttons;
+					for (unsigned int bit = 1; changed; bit <<= 1) {
+						if (changed & bit) {
+							changed &= ~bit;
+							e.type = (state.Buttons & bit) ? InputEvent::ButtonDown : InputEvent::ButtonUp;
+							e.button = bit;
+							if (!queue.push(e)) {
+								++dropped;
+								resync = true;
+								break;
+							}
+							buttons ^= bit;
+						}
+					}
+
+					for (int hand = ovrHand_Left; hand < ovrHand_Count && !resync; ++hand) {
+						const ovrVector2f & stick = state.Thumbstick[hand];
+						if ((stick.x != thumbstick[hand].x || stick.y != thumbstick[hand].y) && queue.size() < STICK_ROOM) {
+							e.type = InputEvent::Thumbstick;
+							e.button = 0;
+							e.hand = hand;
+							e.x = stick.x;
+							e.y = stick.y;
+							if (queue.push(e)) {
+								thumbstick[hand] = stick;
+							}
+						}
+					}
+				}
+			}
+
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+#ifdef _WIN32
+		timeEndPeriod(1);
+#endif
+	}
+
+public:
+	~InputSampler() {
+		stop();
+	}
+
+	void start(ovrSession s, double hz = 500.0) {
+		stop();
+		session = s;
+		rateHz = hz;
+		running = true;
+		thread = std::thread([this] { run(); });
+	}
+
+	void stop() {
+		running = false;
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	// Consumer side, call from one thread only
+	bool poll(InputEvent & e) {
+		return queue.pop(e);
+	}
+
+	// Button events that didn't fit in the queue, each followed by a Resync
+	unsigned int droppedEvents() const {
+		return dropped.load();
+	}
+};
+
+#endif
@@ -0,0 +1,356 @@
+#pragma once
+//
+//  JobSystem.h
+//  Work-stealing job system: a queue per worker that the others steal from,
+//  counters to wait on or chain jobs after, and jobs bound to the GL thread.
+//
+
+#ifndef JobSystem_h
+#define JobSystem_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A worker pops its own queue newest first (what it pushed last is warmest in its
+// cache); when that is empty it takes the oldest job from the shared queue, then
+// steals the oldest from another worker. Threads outside the pool (main, render) push
+// to the shared queue. A thread waiting on a counter runs jobs meanwhile, so waiting
+// inside a job can't starve the pool, and with no workers everything simply runs on
+// the waiting thread.
+//
+// GL_THREAD jobs only run on the thread that owns the context: in its wait() calls and
+// in runGlJobs(), which it calls once a frame. That is the thread that made the job
+// system until another one calls bindGlThread() (the render thread, when pipelined).
+//
+// Jobs must not throw. Each queue is a ring under its own mutex that grows but never
+// shrinks, so once warm a frame's jobs are queued without touching the heap (the
+// std::function in run() may still allocate for large captures; parallelFor never does).
+class JobSystem {
+public:
+	typedef std::function<void()> Job;
+
+	enum Affinity { ANY_THREAD, GL_THREAD };
+
+	class Counter;
+
+private:
+	struct Task {
+		Job job;
+		void (*range)(const void * body, size_t begin, size_t end){ nullptr }; // parallelFor slices
+		const void * body{ nullptr };
+		size_t begin{ 0 }, end{ 0 };
+		Counter * counter{ nullptr };
+		Affinity affinity{ ANY_THREAD };
+	};
+
+public:
+	// How many jobs counted on it haven't finished. Jobs queued with runAfter() are let
+	// go when it drops to zero. Only destroy a counter after wait() on it has returned.
+	class Counter {
+	public:
+		Counter() {}
+		Counter(const Counter &) = delete;
+		Counter & operator=(const Counter &) = delete;
+
+		bool done() const {
+			return pending.load(std::memory_order_acquire) == 0;
+		}
+
+	private:
+		friend class JobSystem;
+		std::atomic<int> pending{ 0 };
+		std::mutex mutex;
+		std::vector<Task> continuations; // waiting for pending to reach zero
+	};
+
+	explicit JobSystem(unsigned int workers = defaultWorkers()) : glThread(std::this_thread::get_id()) {
+		queues.emplace_back(new Queue()); // shared, for threads outside the pool
+		for (unsigned int i = 0; i < workers; ++i) {
+			queues.emplace_back(new Queue());
+		}
+		for (unsigned int i = 0; i < workers; ++i) {
+			threads.emplace_back([this, i] { workerLoop(i + 1); });
+		}
+	}
+
+	JobSystem(const JobSystem &) = delete;
+	JobSystem & operator=(const JobSystem &) = delete;
+
+	// Jobs still queued are dropped: wait on what you queued first
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread & thread : threads) {
+			thread.join();
+		}
+	}
+
+	// Queues job; counter, if given, counts it until it has run
+	void run(Job job, Counter * counter = nullptr, Affinity affinity = ANY_THREAD) {
+		push(makeTask(std::move(job), counter, affinity));
+	}
+
+	// Queues job once after reaches zero, at once if it is zero now
+	void runAfter(Counter & after, Job job, Counter * counter = nullptr, Affinity affinity = ANY_THREAD) {
+		Task task = makeTask(std::move(job), counter, affinity);
+		{
+			std::lock_guard<std::mutex> lock(after.mutex);
+			if (!after.done()) {
+				after.continuations.push_back(std::move(task));
+				return;
+			}
+		}
+		push(std::move(task));
+	}
+
+	// Runs jobs until counter reaches zero
+	void wait(Counter & counter) {
+		const unsigned int index = currentThread();
+		const bool onGlThread = std::this_thread::get_id() == glThread.load();
+		unsigned int idle = 0;
+		while (!counter.done()) {
+			Task task;
+			if ((onGlThread && glQueue.popOldest(task)) || take(index, task)) {
+				execute(task);
+				idle = 0;
+			}
+			else if (++idle < 64) {
+				std::this_thread::yield();
+			}
+			else {
+				// a long job elsewhere, say a file read at startup: stop spinning a core
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		}
+		std::lock_guard<std::mutex> lock(counter.mutex); // finish() has let go of it
+	}
+
+	// body(begin, end) over [0, count) in slices of grain, spread over the pool. The
+	// calling thread takes the first slice, then helps until every slice is done.
+	template <typename Body>
+	void parallelFor(size_t count, size_t grain, const Body & body) {
+		grain = std::max<size_t>(grain, 1);
+		if (count <= grain || threads.empty()) {
+			body(0, count);
+			return;
+		}
+		Counter counter;
+		for (size_t begin = grain; begin < count; begin += grain) {
+			Task task;
+			task.range = &invokeRange<Body>;
+			task.body = &body;
+			task.begin = begin;
+			task.end = std::min(count, begin + grain);
+			task.counter = &counter;
+			counter.pending.fetch_add(1, std::memory_order_relaxed);
+			push(std::move(task));
+		}
+		body(0, grain);
+		wait(counter);
+	}
+
+	// Runs the GL jobs queued so far; only does anything on the GL thread
+	void runGlJobs() {
+		if (std::this_thread::get_id() != glThread.load()) {
+			return;
+		}
+		Task task;
+		while (glQueue.popOldest(task)) {
+			execute(task);
+		}
+	}
+
+	// The calling thread is the one with the GL context from now on
+	void bindGlThread() {
+		glThread.store(std::this_thread::get_id());
+	}
+
+	unsigned int workerCount() const {
+		return (unsigned int)threads.size();
+	}
+
+	// 1 to workerCount() on this system's workers, 0 on any other thread
+	unsigned int currentThread() const {
+		const ThreadSlot & slot = threadSlot();
+		return slot.system == this ? slot.index : 0;
+	}
+
+	// Jobs run and, of those, taken from another worker's queue, since construction
+	unsigned long long jobsRun() const { return executed.load(); }
+	unsigned long long jobsStolen() const { return stolen.load(); }
+
+	// One worker per core besides the calling thread, which waits by working
+	static unsigned int defaultWorkers() {
+		unsigned int cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 1;
+	}
+
+private:
+	// A ring of tasks that doubles when full
+	class Queue {
+	public:
+		void push(Task && task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (count == ring.size()) {
+				std::vector<Task> bigger(std::max<size_t>(16, ring.size() * 2));
+				for (size_t i = 0; i < count; ++i) {
+					bigger[i] = std::move(ring[(head + i) % ring.size()]);
+				}
+				ring.swap(bigger);
+				head = 0;
+			}
+			ring[(head + count) % ring.size()] = std::move(task);
+			++count;
+		}
+
+		bool popNewest(Task & task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!count) {
+				return false;
+			}
+			--count;
+			task = std::move(ring[(head + count) % ring.size()]);
+			return true;
+		}
+
+		bool popOldest(Task & task) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!count) {
+				return false;
+			}
+			task = std::move(ring[head]);
+			head = (head + 1) % ring.size();
+			--count;
+			return true;
+		}
+
+	private:
+		std::mutex mutex;
+		std::vector<Task> ring;
+		size_t head{ 0 };
+		size_t count{ 0 };
+	};
+
+	struct ThreadSlot {
+		const JobSystem * system;
+		unsigned int index;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues; // 0 shared, then one per worker
+	Queue glQueue;
+	std::vector<std::thread> threads;
+	std::atomic<std::thread::id> glThread;
+	std::atomic<int> queued{ 0 };   // tasks in queues, GL queue aside
+	std::atomic<int> sleeping{ 0 }; // workers waiting on wake
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping{ false };
+	std::atomic<unsigned long long> executed{ 0 };
+	std::atomic<unsigned long long> stolen{ 0 };
+
+	static ThreadSlot & threadSlot() {
+		static thread_local ThreadSlot slot = { nullptr, 0 };
+		return slot;
+	}
+
+	template <typename Body>
+	static void invokeRange(const void * body, size_t begin, size_t end) {
+		(*(const Body *)body)(begin, end);
+	}
+
+	static Task makeTask(Job && job, Counter * counter, Affinity affinity) {
+		Task task;
+		task.job = std::move(job);
+		task.counter = counter;
+		task.affinity = affinity;
+		if (counter) {
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	void push(Task && task) {
+		if (task.affinity == GL_THREAD) {
+			glQueue.push(std::move(task));
+			return;
+		}
+		queues[currentThread()]->push(std::move(task));
+		// a worker about to sleep has counted itself in sleeping before it checks queued
+		queued.fetch_add(1);
+		if (sleeping.load() > 0) {
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			wake.notify_one();
+		}
+	}
+
+	bool take(unsigned int index, Task & task) {
+		bool found = index ? queues[index]->popNewest(task) : false;
+		found = found || queues[0]->popOldest(task);
+		for (size_t k = 1; !found && k < queues.size(); ++k) {
+			size_t victim = (index + k) % queues.size();
+			if (victim != 0 && queues[victim]->popOldest(task)) {
+				found = true;
+				++stolen;
+			}
+		}
+		if (found) {
+			queued.fetch_sub(1);
+		}
+		return found;
+	}
+
+	void execute(Task & task) {
+		if (task.range) {
+			task.range(task.body, task.begin, task.end);
+		}
+		else {
+			task.job();
+		}
+		++executed;
+		if (task.counter) {
+			finish(*task.counter);
+		}
+		task.job = nullptr;
+	}
+
+	// Under the counter's mutex, so wait() can tell when it is safe to let it go
+	void finish(Counter & counter) {
+		std::lock_guard<std::mutex> lock(counter.mutex);
+		if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			for (Task & task : counter.continuations) {
+				push(std::move(task));
+			}
+			counter.continuations.clear();
+		}
+	}
+
+	void workerLoop(unsigned int index) {
+		threadSlot() = { this, index };
+		while (true) {
+			Task task;
+			if (take(index, task)) {
+				execute(task);
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			++sleeping;
+			wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+			--sleeping;
+			if (stopping) {
+				return;
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+//
+//  Logger.h
+//  printf-style logging that never blocks the calling thread: messages are
+//  formatted into a lock-free ring and written out by a background thread.
+//
+
+#ifndef Logger_h
+#define Logger_h
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// Calls below this level compile to nothing, arguments included
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// Every call site may log at most LOG_RATE_LIMIT messages per second; the rest are
+// counted and reported once the next second starts
+#ifndef LOG_RATE_LIMIT
+#define LOG_RATE_LIMIT 20
+#endif
+
+#define LOG_AT(level, ...) do { \
+	static logging::RateLimit logRateLimit_(LOG_RATE_LIMIT); \
+	logging::write(logRateLimit_, level, __VA_ARGS__); \
+} while (0)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace logging {
+
+	struct Record {
+		int64_t time; // nanoseconds on the steady clock
+		int level;
+		char text[244];
+	};
+
+	// Bounded multi-producer single-consumer ring. Each cell carries a sequence number
+	// that tells producers and the consumer whose turn it is, so nobody takes a lock.
+	template <size_t Capacity>
+	class MpscRing {
+		static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+		struct Cell {
+			std::atomic<size_t> sequence;
+			Record record;
+		};
+
+		std::unique_ptr<Cell[]> cells{ new Cell[Capacity] };
+		std::atomic<size_t> tail{ 0 }; // next slot to claim, shared by the producers
+		size_t head{ 0 };              // next slot to read, owned by the consumer
+
+	public:
+		MpscRing() {
+			for (size_t i = 0; i < Capacity; ++i) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		// Claims a cell, lets fill() write it and publishes it. False when the ring is full.
+		template <typename Fill>
+		bool push(Fill fill) {
+			size_t position = tail.load(std::memory_order_relaxed);
+			while (true) {
+				Cell & cell = cells[position & (Capacity - 1)];
+				size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+				if (difference == 0) {
+					if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						fill(cell.record);
+						cell.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (difference < 0) {
+					return false;
+				}
+				else {
+					position = tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool pop(Record & record) {
+			Cell & cell = cells[head & (Capacity - 1)];
+			if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+				return false;
+			}
+			record = cell.record;
+			cell.sequence.store(head + Capacity, std::memory_order_release);
+			++head;
+			return true;
+		}
+	};
+
+	inline int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	class RateLimit {
+		std::atomic<int64_t> windowStart{ 0 };
+		std::atomic<unsigned int> count{ 0 };
+		std::atomic<unsigned int> suppressed{ 0 };
+		const unsigned int perSecond;
+
+	public:
+		explicit RateLimit(unsigned int messagesPerSecond) : perSecond(messagesPerSecond) {}
+
+		// False if this call site is over its budget. `dropped` returns how many messages
+		// were suppressed in the window that just ended, so the caller can say so.
+		bool allow(int64_t time, unsigned int & dropped) {
+			dropped = 0;
+			int64_t start = windowStart.load(std::memory_order_relaxed);
+			if (time - start >= 1000000000 && windowStart.compare_exchange_strong(start, time)) {
+				count.store(0, std::memory_order_relaxed);
+				dropped = suppressed.exchange(0);
+			}
+			if (count.fetch_add(1, std::memory_order_relaxed) < perSecond) {
+				return true;
+			}
+			++suppressed;
+			return false;
+		}
+	};
+
+	class Logger {
+		MpscRing<1024> ring;
+		std::thread thread;
+		std::atomic<bool> running{ false };
+		std::atomic<unsigned int> overflowed{ 0 };
+		const int64_t startTime{ now() };
+
+		void flush() {
+			Record record;
+			while (ring.pop(record)) {
+				static const char * const names[] = { "debug", "info ", "warn ", "error" };
+				FILE * out = record.level >= LOG_LEVEL_WARN ? stderr : stdout;
+				if (out == stderr) fflush(stdout); // keep the two streams in order on a console
+				fprintf(out, "[%9.3f] %s %s\n", (record.time - startTime) / 1.0e9, names[record.level], record.text);
+			}
+			unsigned int lost = overflowed.exchange(0);
+			if (lost) {
+				fprintf(stderr, "[%9.3f] warn  log buffer full, %u messages lost\n", (now() - startTime) / 1.0e9, lost);
+			}
+			fflush(stdout);
+		}
+
+		void run() {
+			while (running.load(std::memory_order_relaxed)) {
+				flush();
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			}
+			flush();
+		}
+
+	public:
+		static Logger & instance() {
+			static Logger logger;
+			return logger;
+		}
+
+		Logger() {
+			running = true;
+			thread = std::thread([this] { run(); });
+		}
+
+		~Logger() {
+			shutdown();
+		}
+
+		// Writes out whatever is queued and stops the flush thread; later messages are dropped
+		void shutdown() {
+			running = false;
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+
+		void push(int level, int64_t time, const char * format, va_list args) {
+			if (!running.load(std::memory_order_relaxed)) {
+				return;
+			}
+			bool queued = ring.push([&](Record & record) {
+				record.time = time;
+				record.level = level;
+				vsnprintf(record.text, sizeof(record.text), format, args);
+			});
+			if (!queued) {
+				++overflowed;
+			}
+		}
+	};
+
+	inline void pushf(int level, int64_t time, const char * format, ...) {
+		va_list args;
+		va_start(args, format);
+		Logger::instance().push(level, time, format, args);
+		va_end(args);
+	}
+
+	inline void write(RateLimit & limit, int level, const char * format, ...) {
+		int64_t time = now();
+		unsigned int dropped;
+		bool allowed = limit.allow(time, dropped);
+		if (dropped) {
+			pushf(level, time, "(%u more messages from here were suppressed)", dropped);
+		}
+		if (allowed) {
+			va_list args;
+			va_start(args, format);
+			Logger::instance().push(level, time, format, args);
+			va_end(args);
+		}
+	}
+
+	// Multi-line text such as a report, one record per line and not rate limited
+	inline void lines(int level, const std::string & text) {
+		if (level < LOG_MIN_LEVEL) {
+			return;
+		}
+		int64_t time = now();
+		size_t begin = 0;
+		while (begin < text.size()) {
+			size_t end = text.find('\n', begin);
+			if (end == std::string::npos) end = text.size();
+			if (end > begin) {
+				pushf(level, time, "%.*s", (int)(end - begin), text.c_str() + begin);
+			}
+			begin = end + 1;
+		}
+	}
+
+	inline void shutdown() {
+		Logger::instance().shutdown();
+	}
+}
+
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+//
+//  PosePipeline.h
+//  Chained stages that turn the tracked head pose into the one the scene is
+//  rendered from: freezing, super-rotation and smoothing.
+//
+
+#ifndef PosePipeline_h
+#define PosePipeline_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "RigidMath.h"
+
+struct RigidPose {
+	glm::quat orientation{ 1.0f, 0.0f, 0.0f, 0.0f };
+	glm::vec3 position{ 0.0f };
+};
+
+// A stage is evaluated on the output of the previous one. evaluate() must not change
+// the stage, so the same frame can be evaluated again for a later sample (late latching);
+// commit() is called once per frame with what the stage produced.
+class PoseStage {
+public:
+	bool enabled{ false };
+
+	virtual ~PoseStage() {}
+	virtual RigidPose evaluate(const RigidPose & in, double dt) const = 0;
+	virtual void commit(const RigidPose & out) {}
+};
+
+// Holds the position it last produced while enabled
+class FreezePositionStage : public PoseStage {
+	glm::vec3 held{ 0.0f };
+public:
+	RigidPose evaluate(const RigidPose & in, double dt) const override {
+		RigidPose out = in;
+		if (enabled) out.position = held;
+		return out;
+	}
+	void commit(const RigidPose & out) override {
+		held = out.position;
+	}
+};
+
+// Holds the orientation it last produced while enabled
+class FreezeOrientationStage : public PoseStage {
+	glm::quat held{ 1.0f, 0.0f, 0.0f, 0.0f };
+public:
+	RigidPose evaluate(const RigidPose & in, double dt) const override {
+		RigidPose out = in;
+		if (enabled) out.orientation = held;
+		return out;
+	}
+	void commit(const RigidPose & out) override {
+		held = out.orientation;
+	}
+};
+
+// Turning the head by some angle about the vertical turns the view by twice that.
+// The yaw is the twist of a swing-twist decomposition about world up, so pitch and
+// roll are left alone and there is no Euler gimbal to flip at the poles.
+class SuperRotationStage : public PoseStage {
+public:
+	RigidPose evaluate(const RigidPose & in, double dt) const override {
+		RigidPose out = in;
+		if (!enabled) return out;
+		const glm::quat & q = in.orientation;
+		float length = std::sqrt(q.w * q.w + q.y * q.y);
+		if (length < 1.0e-4f) {
+			return out; // upside down, the yaw is undefined
+		}
+		glm::quat twist(q.w / length, 0.0f, q.y / length, 0.0f);
+		out.orientation = rigid::compose(twist, q);
+		return out;
+	}
+};
+
+// Exponential smoothing towards the input; halfLife is in seconds
+class SmoothingStage : public PoseStage {
+	RigidPose state;
+	bool primed{ false };
+public:
+	float halfLife{ 0.05f };
+
+	RigidPose evaluate(const RigidPose & in, double dt) const override {
+		if (!enabled || !primed || halfLife <= 0.0f) return in;
+		float t = 1.0f - std::pow(0.5f, (float)dt / halfLife);
+		RigidPose out;
+		out.orientation = glm::slerp(state.orientation, in.orientation, t);
+		out.position = glm::mix(state.position, in.position, t);
+		return out;
+	}
+	void commit(const RigidPose & out) override {
+		state = out;
+		primed = true;
+	}
+};
+
+// Runs the stages in the order they were added. The pipeline doesn't own them.
+class PosePipeline {
+	std::vector<PoseStage *> stages;
+	double lastTime{ 0.0 };
+
+	double elapsed(double time) const {
+		return lastTime > 0.0 ? std::max(0.0, time - lastTime) : 0.0;
+	}
+
+public:
+	void add(PoseStage & stage) {
+		stages.push_back(&stage);
+	}
+
+	// Once per frame: evaluates every stage and lets it remember the result
+	RigidPose process(const RigidPose & head, double time) {
+		double dt = elapsed(time);
+		RigidPose pose = head;
+		for (PoseStage * stage : stages) {
+			pose = stage->evaluate(pose, dt);
+			stage->commit(pose);
+		}
+		lastTime = time;
+		return pose;
+	}
+
+	// A later sample of the same frame, evaluated from the state process() left behind
+	RigidPose preview(const RigidPose & head, double time) const {
+		double dt = elapsed(time);
+		RigidPose pose = head;
+		for (const PoseStage * stage : stages) {
+			pose = stage->evaluate(pose, dt);
+		}
+		return pose;
+	}
+};
+
+#endif
@@ -0,0 +1,169 @@
+#pragma once
+//
+//  Profiler.h
+//  Scoped CPU zones recorded into per-thread ring buffers, exported as a
+//  Chrome trace (load the file in chrome://tracing or ui.perfetto.dev).
+//
+
+#ifndef Profiler_h
+#define Profiler_h
+
+// Zones are compiled out of release builds unless PROFILER_ENABLED is forced on
+#ifndef PROFILER_ENABLED
+#ifdef NDEBUG
+#define PROFILER_ENABLED 0
+#else
+#define PROFILER_ENABLED 1
+#endif
+#endif
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#if PROFILER_ENABLED
+// name must be a string literal (or otherwise outlive the profiler)
+#define PROFILE_ZONE(name) profiler::Zone PROFILE_CONCAT(profileZone_, __LINE__)(name)
+#define PROFILE_THREAD(name) profiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace profiler {
+
+	struct Event {
+		const char * name;
+		int64_t start; // nanoseconds on the steady clock
+		int64_t end;
+	};
+
+	// Written only by its own thread. Readers take a snapshot of `written` and may
+	// see the very oldest entries being overwritten, which only costs a few zones.
+	struct ThreadBuffer {
+		static const size_t Capacity = 16384;
+
+		uint32_t threadId;
+		std::string threadName;
+		std::atomic<uint64_t> written{ 0 };
+		Event events[Capacity];
+
+		void push(const Event & e) {
+			uint64_t index = written.load(std::memory_order_relaxed);
+			events[index % Capacity] = e;
+			written.store(index + 1, std::memory_order_release);
+		}
+	};
+
+	class Registry {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers; // kept after their thread exits
+
+	public:
+		static Registry & instance() {
+			static Registry registry;
+			return registry;
+		}
+
+		ThreadBuffer * create() {
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.emplace_back(new ThreadBuffer());
+			ThreadBuffer * buffer = buffers.back().get();
+			buffer->threadId = (uint32_t)buffers.size();
+			buffer->threadName = "thread " + std::to_string(buffer->threadId);
+			return buffer;
+		}
+
+		template <typename Function>
+		void forEach(Function function) {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto & buffer : buffers) {
+				function(*buffer);
+			}
+		}
+	};
+
+	inline int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline ThreadBuffer & threadBuffer() {
+		thread_local ThreadBuffer * buffer = Registry::instance().create();
+		return *buffer;
+	}
+
+	inline void setThreadName(const char * name) {
+		threadBuffer().threadName = name;
+	}
+
+	class Zone {
+		const char * name;
+		int64_t start;
+	public:
+		explicit Zone(const char * zoneName) : name(zoneName), start(now()) {}
+		~Zone() {
+			Event e = { name, start, now() };
+			threadBuffer().push(e);
+		}
+	};
+
+	inline void writeJsonString(std::ostream & out, const std::string & s) {
+		out << '"';
+		for (char c : s) {
+			if (c == '"' || c == '\\') out << '\\';
+			out << c;
+		}
+		out << '"';
+	}
+
+	// Writes every zone that ended within the last `seconds` as Chrome trace_event JSON
+	inline bool writeChromeTrace(const char * path, double seconds) {
+		std::ofstream out(path);
+		if (!out.is_open()) {
+			return false;
+		}
+
+		const int64_t cutoff = now() - (int64_t)(seconds * 1.0e9);
+		bool first = true;
+		auto separator = [&]() {
+			out << (first ? "\n" : ",\n");
+			first = false;
+		};
+
+		out << "{\"traceEvents\":[";
+		Registry::instance().forEach([&](ThreadBuffer & buffer) {
+			separator();
+			out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer.threadId << ",\"args\":{\"name\":";
+			writeJsonString(out, buffer.threadName);
+			out << "}}";
+
+			uint64_t written = buffer.written.load(std::memory_order_acquire);
+			uint64_t oldest = written > ThreadBuffer::Capacity ? written - ThreadBuffer::Capacity : 0;
+			for (uint64_t i = oldest; i < written; ++i) {
+				const Event & e = buffer.events[i % ThreadBuffer::Capacity];
+				if (e.end < cutoff) {
+					continue;
+				}
+				separator();
+				out << "{\"name\":";
+				writeJsonString(out, e.name);
+				out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer.threadId
+					<< ",\"ts\":" << e.start / 1000 << "." << (e.start % 1000) / 100
+					<< ",\"dur\":" << (e.end - e.start) / 1000 << "." << ((e.end - e.start) % 1000) / 100 << "}";
+			}
+		});
+		out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return true;
+	}
+}
+
+#endif
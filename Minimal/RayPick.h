@@ -0,0 +1,300 @@
+#pragma once
+//
+//  RayPick.h
+//  Closest-hit ray picking against every box in a flat structure-of-arrays
+//  list, eight boxes per AVX slab test (four with SSE on older CPUs).
+//
+
+#ifndef RayPick_h
+#define RayPick_h
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <xmmintrin.h>
+#if defined(_MSC_VER) || defined(__AVX__)
+#define RAYPICK_AVX 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+class RayPicker {
+public:
+	static const uint32_t NoHit = ~0u;
+
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction; // need not be normalised; distances are in its units
+	};
+
+	struct Hit {
+		uint32_t id{ NoHit };
+		float distance{ FLT_MAX };
+	};
+
+	// What the last pick() did
+	struct Stats {
+		size_t boxesTested{ 0 };
+		double microseconds{ 0.0 };
+		bool complete{ true }; // false if it ran out of budget before the last box
+		bool avx{ false };
+	};
+
+	RayPicker() : useAvx(avxSupported()) {}
+
+	void clear() {
+		minX.clear(); minY.clear(); minZ.clear();
+		maxX.clear(); maxY.clear(); maxZ.clear();
+		ids.clear();
+		boxCount = 0;
+		paddedCount = 0;
+	}
+
+	void reserve(size_t count) {
+		count += Lanes;
+		minX.reserve(count); minY.reserve(count); minZ.reserve(count);
+		maxX.reserve(count); maxY.reserve(count); maxZ.reserve(count);
+		ids.reserve(count);
+	}
+
+	// The world-space box around the -1..1 cube under `world`; exact while the world
+	// matrix only scales and translates, conservative once it rotates
+	void addCube(uint32_t id, const glm::mat4 & world) {
+		glm::vec3 center(world[3]);
+		glm::vec3 half(
+			std::fabs(world[0].x) + std::fabs(world[1].x) + std::fabs(world[2].x),
+			std::fabs(world[0].y) + std::fabs(world[1].y) + std::fabs(world[2].y),
+			std::fabs(world[0].z) + std::fabs(world[1].z) + std::fabs(world[2].z));
+		addBox(id, center - half, center + half);
+	}
+
+	// Boxes are added in bulk; pick() sees them once finish() has run
+	void addBox(uint32_t id, const glm::vec3 & min, const glm::vec3 & max) {
+		if (paddedCount) {
+			// the padding after the last finish() goes, to be put back after the new boxes
+			trimPadding();
+			paddedCount = 0;
+		}
+		minX.push_back(min.x); minY.push_back(min.y); minZ.push_back(min.z);
+		maxX.push_back(max.x); maxY.push_back(max.y); maxZ.push_back(max.z);
+		ids.push_back(id);
+		++boxCount;
+	}
+
+	// Pads the arrays to whole lanes after the last addBox()
+	void finish() {
+		pad();
+	}
+
+	size_t size() const {
+		return boxCount;
+	}
+
+	// AVX is used whenever the CPU has it; benchmarks turn it off to compare
+	void setAvx(bool enabled) {
+		useAvx = enabled && avxSupported();
+	}
+
+	bool avx() const {
+		return useAvx;
+	}
+
+	// Closest box along each ray (at most MaxRays), within maxDistance, among the boxes
+	// there were at the last finish() (none if boxes were added since). Every box is
+	// tested against all rays while it is in registers. If budgetMicroseconds > 0 the
+	// sweep stops once it is spent and the hits found so far are returned.
+	Stats pick(const Ray * rays, int rayCount, Hit * hits, float maxDistance, double budgetMicroseconds = 0.0) const {
+		auto start = std::chrono::steady_clock::now();
+		rayCount = std::min(rayCount, (int)MaxRays);
+		RayData data[MaxRays];
+		for (int r = 0; r < rayCount; ++r) {
+			hits[r] = Hit();
+			data[r].origin = rays[r].origin;
+			data[r].inverse = glm::vec3(1.0f / rays[r].direction.x, 1.0f / rays[r].direction.y, 1.0f / rays[r].direction.z);
+			data[r].best = maxDistance;
+			data[r].bestBox = NoHit;
+		}
+		const int64_t budgetTicks = (int64_t)(budgetMicroseconds * 1000.0);
+		Stats stats;
+		stats.avx = useAvx;
+		size_t tested = 0;
+#ifdef RAYPICK_AVX
+		if (useAvx) {
+			tested = sweepAvx(data, rayCount, start, budgetTicks);
+		}
+		else
+#endif
+		{
+			tested = sweepSse(data, rayCount, start, budgetTicks);
+		}
+		for (int r = 0; r < rayCount; ++r) {
+			if (data[r].bestBox != NoHit) {
+				hits[r].id = ids[data[r].bestBox];
+				hits[r].distance = data[r].best;
+			}
+		}
+		stats.boxesTested = std::min(tested, boxCount);
+		stats.complete = paddedCount >= boxCount && tested >= boxCount;
+		stats.microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+		return stats;
+	}
+
+	static const int MaxRays = 2;
+
+private:
+	static const size_t Lanes = 8;      // the arrays are padded to a multiple of this
+	static const size_t CheckEvery = 1024; // boxes between looks at the clock
+
+	// Boxes beyond boxCount are padding: a single point far out, which every ray
+	// either misses or reaches beyond any maxDistance
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	std::vector<uint32_t> ids;
+	size_t boxCount{ 0 };
+	size_t paddedCount{ 0 }; // what finish() padded the arrays to, 0 while boxes are being added
+	bool useAvx;
+
+	struct RayData {
+		glm::vec3 origin;
+		glm::vec3 inverse;
+		float best;
+		uint32_t bestBox;
+	};
+
+	void trimPadding() {
+		minX.resize(boxCount); minY.resize(boxCount); minZ.resize(boxCount);
+		maxX.resize(boxCount); maxY.resize(boxCount); maxZ.resize(boxCount);
+		ids.resize(boxCount);
+	}
+
+	void pad() {
+		const float farAway = 1.0e30f;
+		size_t padded = (boxCount + Lanes - 1) / Lanes * Lanes;
+		minX.resize(padded, farAway); minY.resize(padded, farAway); minZ.resize(padded, farAway);
+		maxX.resize(padded, farAway); maxY.resize(padded, farAway); maxZ.resize(padded, farAway);
+		ids.resize(padded, (uint32_t)NoHit);
+		paddedCount = padded;
+	}
+
+	bool overBudget(std::chrono::steady_clock::time_point start, int64_t budgetTicks) const {
+		return budgetTicks > 0 && std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() > budgetTicks;
+	}
+
+	// A lane that hit closer than the ray's best so far; entry distance in `entry`
+	void takeClosest(RayData & ray, int mask, const float * entry, size_t base) const {
+		while (mask) {
+			int lane = 0;
+			while (!(mask & 1 << lane)) ++lane;
+			mask &= ~(1 << lane);
+			if (entry[lane] < ray.best) {
+				ray.best = entry[lane];
+				ray.bestBox = (uint32_t)(base + lane);
+			}
+		}
+	}
+
+	size_t sweepSse(RayData * rays, int rayCount, std::chrono::steady_clock::time_point start, int64_t budgetTicks) const {
+		const size_t padded = paddedCount;
+		const __m128 zero = _mm_setzero_ps();
+		// the rays live in registers for the whole sweep, not behind a pointer the box
+		// arrays might alias
+		__m128 ox[MaxRays], oy[MaxRays], oz[MaxRays], ix[MaxRays], iy[MaxRays], iz[MaxRays], best[MaxRays];
+		for (int r = 0; r < rayCount; ++r) {
+			ox[r] = _mm_set1_ps(rays[r].origin.x); oy[r] = _mm_set1_ps(rays[r].origin.y); oz[r] = _mm_set1_ps(rays[r].origin.z);
+			ix[r] = _mm_set1_ps(rays[r].inverse.x); iy[r] = _mm_set1_ps(rays[r].inverse.y); iz[r] = _mm_set1_ps(rays[r].inverse.z);
+			best[r] = _mm_set1_ps(rays[r].best);
+		}
+		for (size_t i = 0; i < padded; i += 4) {
+			if (i % CheckEvery == 0 && i && overBudget(start, budgetTicks)) {
+				return i;
+			}
+			const __m128 bx0 = _mm_loadu_ps(&minX[i]), by0 = _mm_loadu_ps(&minY[i]), bz0 = _mm_loadu_ps(&minZ[i]);
+			const __m128 bx1 = _mm_loadu_ps(&maxX[i]), by1 = _mm_loadu_ps(&maxY[i]), bz1 = _mm_loadu_ps(&maxZ[i]);
+			for (int r = 0; r < rayCount; ++r) {
+				__m128 t0 = _mm_mul_ps(_mm_sub_ps(bx0, ox[r]), ix[r]), t1 = _mm_mul_ps(_mm_sub_ps(bx1, ox[r]), ix[r]);
+				__m128 tmin = _mm_min_ps(t0, t1), tmax = _mm_max_ps(t0, t1);
+				t0 = _mm_mul_ps(_mm_sub_ps(by0, oy[r]), iy[r]);
+				t1 = _mm_mul_ps(_mm_sub_ps(by1, oy[r]), iy[r]);
+				tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+				tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+				t0 = _mm_mul_ps(_mm_sub_ps(bz0, oz[r]), iz[r]);
+				t1 = _mm_mul_ps(_mm_sub_ps(bz1, oz[r]), iz[r]);
+				tmin = _mm_max_ps(_mm_max_ps(tmin, _mm_min_ps(t0, t1)), zero);
+				tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+				int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tmin, tmax), _mm_cmplt_ps(tmin, best[r])));
+				if (mask) {
+					alignas(16) float entry[4];
+					_mm_store_ps(entry, tmin);
+					takeClosest(rays[r], mask, entry, i);
+					best[r] = _mm_set1_ps(rays[r].best);
+				}
+			}
+		}
+		return padded;
+	}
+
+#ifdef RAYPICK_AVX
+	size_t sweepAvx(RayData * rays, int rayCount, std::chrono::steady_clock::time_point start, int64_t budgetTicks) const {
+		const size_t padded = paddedCount;
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 ox[MaxRays], oy[MaxRays], oz[MaxRays], ix[MaxRays], iy[MaxRays], iz[MaxRays], best[MaxRays];
+		for (int r = 0; r < rayCount; ++r) {
+			ox[r] = _mm256_set1_ps(rays[r].origin.x); oy[r] = _mm256_set1_ps(rays[r].origin.y); oz[r] = _mm256_set1_ps(rays[r].origin.z);
+			ix[r] = _mm256_set1_ps(rays[r].inverse.x); iy[r] = _mm256_set1_ps(rays[r].inverse.y); iz[r] = _mm256_set1_ps(rays[r].inverse.z);
+			best[r] = _mm256_set1_ps(rays[r].best);
+		}
+		for (size_t i = 0; i < padded; i += 8) {
+			if (i % CheckEvery == 0 && i && overBudget(start, budgetTicks)) {
+				return i;
+			}
+			const __m256 bx0 = _mm256_loadu_ps(&minX[i]), by0 = _mm256_loadu_ps(&minY[i]), bz0 = _mm256_loadu_ps(&minZ[i]);
+			const __m256 bx1 = _mm256_loadu_ps(&maxX[i]), by1 = _mm256_loadu_ps(&maxY[i]), bz1 = _mm256_loadu_ps(&maxZ[i]);
+			for (int r = 0; r < rayCount; ++r) {
+				__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(bx0, ox[r]), ix[r]), t1 = _mm256_mul_ps(_mm256_sub_ps(bx1, ox[r]), ix[r]);
+				__m256 tmin = _mm256_min_ps(t0, t1), tmax = _mm256_max_ps(t0, t1);
+				t0 = _mm256_mul_ps(_mm256_sub_ps(by0, oy[r]), iy[r]);
+				t1 = _mm256_mul_ps(_mm256_sub_ps(by1, oy[r]), iy[r]);
+				tmin = _mm256_max_ps(tmin, _mm256_min_ps(t0, t1));
+				tmax = _mm256_min_ps(tmax, _mm256_max_ps(t0, t1));
+				t0 = _mm256_mul_ps(_mm256_sub_ps(bz0, oz[r]), iz[r]);
+				t1 = _mm256_mul_ps(_mm256_sub_ps(bz1, oz[r]), iz[r]);
+				tmin = _mm256_max_ps(_mm256_max_ps(tmin, _mm256_min_ps(t0, t1)), zero);
+				tmax = _mm256_min_ps(tmax, _mm256_max_ps(t0, t1));
+				int mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ), _mm256_cmp_ps(tmin, best[r], _CMP_LT_OQ)));
+				if (mask) {
+					alignas(32) float entry[8];
+					_mm256_store_ps(entry, tmin);
+					takeClosest(rays[r], mask, entry, i);
+					best[r] = _mm256_set1_ps(rays[r].best);
+				}
+			}
+		}
+		return padded;
+	}
+
+#endif
+
+	// AVX needs the CPU to have it and the OS to save the wider registers
+	static bool avxSupported() {
+#if !defined(RAYPICK_AVX)
+		return false;
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+		return __builtin_cpu_supports("avx");
+#endif
+	}
+};
+
+#endif
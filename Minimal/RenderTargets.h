@@ -0,0 +1,133 @@
+#pragma once
+//
+//  RenderTargets.h
+//  The eye swap chain with one complete framebuffer per chain image, built once
+//  and rebuilt only when the eye buffer size changes.
+//
+
+#ifndef RenderTargets_h
+#define RenderTargets_h
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+
+// Attaching the current chain texture to a shared framebuffer every frame makes the
+// driver revalidate it every frame. Here every chain image gets its own framebuffer,
+// checked complete once at create(), all sharing one depth texture (a texture so
+// occlusion culling can read it). bind() only picks the one for the current index.
+// create() with a new size releases everything first, swap chain included.
+class EyeRenderTargets {
+public:
+	~EyeRenderTargets() {
+		release();
+	}
+
+	void create(ovrSession session, const ovrSizei & size) {
+		release();
+		this->session = session;
+		targetSize = size;
+
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = size.w;
+		desc.Height = size.h;
+		desc.MipLevels = 1;
+		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+		if (!OVR_SUCCESS(ovr_CreateTextureSwapChainGL(session, &desc, &chain))) {
+			chain = nullptr;
+			throw std::runtime_error("Failed to create swap textures");
+		}
+		int length = 0;
+		if (!OVR_SUCCESS(ovr_GetTextureSwapChainLength(session, chain, &length)) || !length) {
+			release();
+			throw std::runtime_error("Unable to count swap chain textures");
+		}
+
+		glGenTextures(1, &depth);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, size.w, size.h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		framebuffers.resize(length);
+		glGenFramebuffers(length, framebuffers.data());
+		for (int i = 0; i < length; ++i) {
+			GLuint color = 0;
+			ovr_GetTextureSwapChainBufferGL(session, chain, i, &color);
+			glBindTexture(GL_TEXTURE_2D, color);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[i]);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+			glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+			GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+			if (status != GL_FRAMEBUFFER_COMPLETE) {
+				glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+				glBindTexture(GL_TEXTURE_2D, 0);
+				release();
+				throw std::runtime_error("Eye framebuffer " + std::to_string(i) + " incomplete, status " + std::to_string(status));
+			}
+		}
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	void release() {
+		if (!framebuffers.empty()) {
+			glDeleteFramebuffers((GLsizei)framebuffers.size(), framebuffers.data());
+			framebuffers.clear();
+		}
+		if (depth) glDeleteTextures(1, &depth);
+		depth = 0;
+		if (chain) ovr_DestroyTextureSwapChain(session, chain);
+		chain = nullptr;
+		targetSize = ovrSizei{ 0, 0 };
+	}
+
+	// Binds the framebuffer of the chain image to draw into this frame
+	void bind() const {
+		int index = 0;
+		ovr_GetTextureSwapChainCurrentIndex(session, chain, &index);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[index]);
+	}
+
+	void commit() const {
+		ovr_CommitTextureSwapChain(session, chain);
+	}
+
+	ovrTextureSwapChain swapChain() const {
+		return chain;
+	}
+
+	GLuint depthTexture() const {
+		return depth;
+	}
+
+	const ovrSizei & size() const {
+		return targetSize;
+	}
+
+	unsigned int count() const {
+		return (unsigned int)framebuffers.size();
+	}
+
+private:
+	ovrSession session{ nullptr };
+	ovrTextureSwapChain chain{ nullptr };
+	ovrSizei targetSize{ 0, 0 };
+	GLuint depth{ 0 };
+	std::vector<GLuint> framebuffers; // one per chain image, by index
+};
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+//
+//  RigidMath.h
+//  SSE kernels for rigid transforms (rotation + translation, no scale):
+//  pose to matrix, closed-form inverse and quaternion composition.
+//
+
+#ifndef RigidMath_h
+#define RigidMath_h
+
+#include <xmmintrin.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Matrices are glm's column-major mat4, quaternions glm::quat. A head or eye pose is
+// only ever rotated and translated, so its inverse is the transposed rotation and the
+// negated, rotated translation; no general 4x4 inverse is needed.
+namespace rigid {
+
+	// lanes are listed in output order x, y, z, w
+#define RIGID_SHUFFLE(v, a, b, c, d) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(d, c, b, a))
+
+	inline __m128 loadQuat(const glm::quat & q) {
+		return _mm_set_ps(q.w, q.z, q.y, q.x);
+	}
+
+	inline glm::quat storeQuat(__m128 v) {
+		float f[4];
+		_mm_storeu_ps(f, v);
+		return glm::quat(f[3], f[0], f[1], f[2]);
+	}
+
+	// Rotation columns of a unit quaternion (x, y, z, w), with w = 0 in every column
+	inline void rotationColumns(__m128 q, __m128 & c0, __m128 & c1, __m128 & c2) {
+		const __m128 q2 = _mm_add_ps(q, q);
+
+		// column 0: 1 - 2yy - 2zz, 2xy + 2wz, 2xz - 2wy
+		__m128 a = _mm_mul_ps(RIGID_SHUFFLE(q, 1, 0, 0, 3), RIGID_SHUFFLE(q2, 1, 1, 2, 3));
+		__m128 b = _mm_mul_ps(RIGID_SHUFFLE(q, 2, 3, 3, 3), RIGID_SHUFFLE(q2, 2, 2, 1, 3));
+		c0 = _mm_add_ps(_mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f), _mm_add_ps(
+			_mm_mul_ps(a, _mm_setr_ps(-1.0f, 1.0f, 1.0f, 0.0f)),
+			_mm_mul_ps(b, _mm_setr_ps(-1.0f, 1.0f, -1.0f, 0.0f))));
+
+		// column 1: 2xy - 2wz, 1 - 2xx - 2zz, 2yz + 2wx
+		a = _mm_mul_ps(RIGID_SHUFFLE(q, 0, 0, 1, 3), RIGID_SHUFFLE(q2, 1, 0, 2, 3));
+		b = _mm_mul_ps(RIGID_SHUFFLE(q, 3, 2, 3, 3), RIGID_SHUFFLE(q2, 2, 2, 0, 3));
+		c1 = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f), _mm_add_ps(
+			_mm_mul_ps(a, _mm_setr_ps(1.0f, -1.0f, 1.0f, 0.0f)),
+			_mm_mul_ps(b, _mm_setr_ps(-1.0f, -1.0f, 1.0f, 0.0f))));
+
+		// column 2: 2xz + 2wy, 2yz - 2wx, 1 - 2xx - 2yy
+		a = _mm_mul_ps(RIGID_SHUFFLE(q, 0, 1, 0, 3), RIGID_SHUFFLE(q2, 2, 2, 0, 3));
+		b = _mm_mul_ps(RIGID_SHUFFLE(q, 3, 3, 1, 3), RIGID_SHUFFLE(q2, 1, 0, 1, 3));
+		c2 = _mm_add_ps(_mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f), _mm_add_ps(
+			_mm_mul_ps(a, _mm_setr_ps(1.0f, 1.0f, -1.0f, 0.0f)),
+			_mm_mul_ps(b, _mm_setr_ps(1.0f, -1.0f, -1.0f, 0.0f))));
+	}
+
+	// c0 * t.x + c1 * t.y + c2 * t.z
+	inline __m128 rotate(__m128 c0, __m128 c1, __m128 c2, __m128 t) {
+		return _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(c0, RIGID_SHUFFLE(t, 0, 0, 0, 0)),
+			_mm_mul_ps(c1, RIGID_SHUFFLE(t, 1, 1, 1, 1))),
+			_mm_mul_ps(c2, RIGID_SHUFFLE(t, 2, 2, 2, 2)));
+	}
+
+	inline glm::mat4 storeMatrix(__m128 c0, __m128 c1, __m128 c2, __m128 c3) {
+		glm::mat4 m;
+		float * f = &m[0][0];
+		_mm_storeu_ps(f, c0);
+		_mm_storeu_ps(f + 4, c1);
+		_mm_storeu_ps(f + 8, c2);
+		_mm_storeu_ps(f + 12, c3);
+		return m;
+	}
+
+	// Same as translate(t) * mat4_cast(q)
+	inline glm::mat4 poseToMatrix(const glm::quat & q, const glm::vec3 & t) {
+		__m128 c0, c1, c2;
+		rotationColumns(loadQuat(q), c0, c1, c2);
+		return storeMatrix(c0, c1, c2, _mm_setr_ps(t.x, t.y, t.z, 1.0f));
+	}
+
+	// Same as inverse(poseToMatrix(q, t)), the view matrix of a camera at that pose
+	inline glm::mat4 viewFromPose(const glm::quat & q, const glm::vec3 & t) {
+		__m128 c0, c1, c2;
+		const __m128 conjugate = _mm_mul_ps(loadQuat(q), _mm_setr_ps(-1.0f, -1.0f, -1.0f, 1.0f));
+		rotationColumns(conjugate, c0, c1, c2);
+		__m128 c3 = _mm_sub_ps(_mm_setzero_ps(), rotate(c0, c1, c2, _mm_setr_ps(t.x, t.y, t.z, 0.0f)));
+		c3 = _mm_add_ps(c3, _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f));
+		return storeMatrix(c0, c1, c2, c3);
+	}
+
+	// Inverse of a rotation + translation matrix. Not valid for scaled or projective matrices.
+	inline glm::mat4 inverse(const glm::mat4 & m) {
+		const float * f = &m[0][0];
+		__m128 c0 = _mm_loadu_ps(f);
+		__m128 c1 = _mm_loadu_ps(f + 4);
+		__m128 c2 = _mm_loadu_ps(f + 8);
+		const __m128 t = _mm_loadu_ps(f + 12);
+		__m128 c3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3); // c3 picks up the zero w lanes of the columns
+		c3 = _mm_sub_ps(_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), rotate(c0, c1, c2, t));
+		return storeMatrix(c0, c1, c2, c3);
+	}
+
+	// Hamilton product, same as a * b: rotates by b first, then by a
+	inline glm::quat compose(const glm::quat & a, const glm::quat & b) {
+		const __m128 va = loadQuat(a);
+		const __m128 vb = loadQuat(b);
+		__m128 r = _mm_mul_ps(RIGID_SHUFFLE(va, 3, 3, 3, 3), vb);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(RIGID_SHUFFLE(va, 0, 0, 0, 0), RIGID_SHUFFLE(vb, 3, 2, 1, 0)),
+			_mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(RIGID_SHUFFLE(va, 1, 1, 1, 1), RIGID_SHUFFLE(vb, 2, 3, 0, 1)),
+			_mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f)));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(RIGID_SHUFFLE(va, 2, 2, 2, 2), RIGID_SHUFFLE(vb, 1, 0, 3, 2)),
+			_mm_setr_ps(-1.0f, 1.0f, 1.0f, -1.0f)));
+		return storeQuat(r);
+	}
+
+#undef RIGID_SHUFFLE
+}
+
+#endif
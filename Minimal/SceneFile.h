@@ -0,0 +1,573 @@
+#pragma once
+//
+//  SceneFile.h
+//  Compact binary scene description, memory-mapped and fixed up in place
+//  rather than parsed, plus the offline compiler from the text form.
+//
+
+#ifndef SceneFile_h
+#define SceneFile_h
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "EntityStore.h"
+
+namespace scene {
+
+	const uint32_t MAGIC = 0x424e4353; // "SCNB"
+	const uint32_t VERSION = 1;
+
+	// EntityStore keeps mesh and material indices in 16 bits
+	const uint32_t MAX_MESHES = 1u << 16;
+	const uint32_t MAX_MATERIAL = 0xffff;
+
+	// An offset from the start of the file on disk, a pointer once the file is opened
+	template <typename T>
+	union Ref {
+		uint64_t offset;
+		T * pointer;
+	};
+	static_assert(sizeof(void *) <= sizeof(uint64_t), "pointers must fit in a Ref");
+
+	// Which Cube texture slot a mesh uses; Cube.h keeps one texture per slot
+	enum MeshKind : uint32_t {
+		MESH_CUBE,
+		MESH_SKYBOX_LEFT,
+		MESH_SKYBOX_RIGHT,
+		MESH_SKYBOX_ROOM,
+		MESH_KIND_COUNT
+	};
+
+	enum NodeFlags : uint32_t {
+		NODE_RESIZABLE = 1 << 0, // the application may scale it further about its pivot
+	};
+
+	// Every record is a multiple of 8 bytes, so all sections stay 8-byte aligned
+
+	// The six face images of a cube map, in the order Cube loads them
+	struct Texture {
+		Ref<const char> name;
+		Ref<const char> faces[6];
+	};
+
+	struct Mesh {
+		Ref<const char> name;
+		uint32_t kind;    // MeshKind
+		uint32_t texture; // index into the texture table
+	};
+
+	// local = translate(translation) * [scale by `scale` about pivot]
+	struct Node {
+		Ref<const char> name;
+		int32_t parent; // lower index than the node itself, or -1
+		uint32_t flags; // NodeFlags
+		float translation[3];
+		float scale;
+		float pivot[3];
+		uint32_t reserved;
+	};
+
+	struct Object {
+		uint32_t node;
+		uint32_t mesh;
+		uint32_t material;
+		uint32_t layers; // EntityLayer bits
+		float radius;    // model-space bounding sphere around the origin
+		uint32_t reserved;
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t fileSize;
+		uint32_t textureCount;
+		uint32_t meshCount;
+		uint32_t nodeCount;
+		uint32_t objectCount;
+		Ref<Texture> textures;
+		Ref<Mesh> meshes;
+		Ref<Node> nodes;
+		Ref<Object> objects;
+		Ref<const char> strings; // NUL-terminated strings back to back
+		uint64_t stringBytes;
+	};
+
+	static_assert(sizeof(Texture) % 8 == 0 && sizeof(Mesh) % 8 == 0 && sizeof(Node) % 8 == 0
+		&& sizeof(Object) % 8 == 0 && sizeof(Header) % 8 == 0, "records must keep 8-byte alignment");
+
+	// The node's local transform, with resize applied about the pivot if it is resizable
+	inline glm::mat4 nodeLocal(const Node & node, float resize = 1.0f) {
+		float scale = node.scale * ((node.flags & NODE_RESIZABLE) ? resize : 1.0f);
+		glm::mat4 local(scale);
+		local[3] = glm::vec4(
+			node.translation[0] + node.pivot[0] * (1.0f - scale),
+			node.translation[1] + node.pivot[1] * (1.0f - scale),
+			node.translation[2] + node.pivot[2] * (1.0f - scale),
+			1.0f);
+		return local;
+	}
+
+	// A compiled scene mapped copy-on-write: the fix-ups turn offsets into pointers in
+	// private pages, the file itself is never written and nothing is copied up front.
+	class SceneFile {
+		char * base{ nullptr };
+		uint64_t size{ 0 };
+#ifdef _WIN32
+		HANDLE file{ INVALID_HANDLE_VALUE };
+		HANDLE mapping{ nullptr };
+#endif
+
+		void fail(const std::string & path, const char * what) {
+			close();
+			throw std::runtime_error(path + ": " + what);
+		}
+
+		bool inFile(uint64_t offset, uint64_t count, uint64_t recordSize) const {
+			return offset % 8 == 0 && offset <= size && count <= (size - offset) / recordSize;
+		}
+
+		bool isString(uint64_t offset) const {
+			const Header & h = header();
+			return offset >= h.strings.offset && offset < h.strings.offset + h.stringBytes;
+		}
+
+		template <typename T>
+		void fixUp(Ref<T> & ref) {
+			uint64_t offset = ref.offset;
+			ref.pointer = (T *)(base + offset);
+		}
+
+		bool map(const std::string & path) {
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize)) {
+				fail(path, "unable to read the file size");
+			}
+			size = (uint64_t)fileSize.QuadPart;
+			if (size < sizeof(Header)) {
+				fail(path, "too small to be a scene");
+			}
+			mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			if (!mapping) {
+				fail(path, "unable to map the file");
+			}
+			base = (char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			if (!base) {
+				fail(path, "unable to map the file");
+			}
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat info;
+			if (fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(Header)) {
+				::close(fd);
+				fail(path, "too small to be a scene");
+			}
+			size = (uint64_t)info.st_size;
+			void * view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (view == MAP_FAILED) {
+				fail(path, "unable to map the file");
+			}
+			base = (char *)view;
+#endif
+			return true;
+		}
+
+	public:
+		SceneFile() {}
+		SceneFile(const SceneFile &) = delete;
+		SceneFile & operator=(const SceneFile &) = delete;
+
+		~SceneFile() {
+			close();
+		}
+
+		// False if there is no such file. Throws if it is not a valid scene; every offset is
+		// checked before it becomes a pointer.
+		bool open(const std::string & path) {
+			close();
+			if (!map(path)) {
+				return false;
+			}
+			Header & h = *(Header *)base;
+			if (h.magic != MAGIC) fail(path, "not a compiled scene");
+			if (h.version != VERSION) fail(path, "compiled for another version, recompile it");
+			if (h.fileSize != size) fail(path, "truncated");
+			if (!inFile(h.textures.offset, h.textureCount, sizeof(Texture))
+				|| !inFile(h.meshes.offset, h.meshCount, sizeof(Mesh))
+				|| !inFile(h.nodes.offset, h.nodeCount, sizeof(Node))
+				|| !inFile(h.objects.offset, h.objectCount, sizeof(Object))
+				|| !inFile(h.strings.offset, h.stringBytes, 1)) {
+				fail(path, "section out of bounds");
+			}
+			// a terminated last string means every string ends inside the table
+			if (h.stringBytes == 0 || base[h.strings.offset + h.stringBytes - 1] != '\0') {
+				fail(path, "unterminated string table");
+			}
+
+			Texture * textures = (Texture *)(base + h.textures.offset);
+			Mesh * meshes = (Mesh *)(base + h.meshes.offset);
+			Node * nodes = (Node *)(base + h.nodes.offset);
+			Object * objects = (Object *)(base + h.objects.offset);
+			for (uint32_t i = 0; i < h.textureCount; ++i) {
+				bool valid = isString(textures[i].name.offset);
+				for (int face = 0; face < 6; ++face) {
+					valid = valid && isString(textures[i].faces[face].offset);
+				}
+				if (!valid) fail(path, "bad texture record");
+			}
+			for (uint32_t i = 0; i < h.meshCount; ++i) {
+				if (!isString(meshes[i].name.offset) || meshes[i].kind >= MESH_KIND_COUNT || meshes[i].texture >= h.textureCount) {
+					fail(path, "bad mesh record");
+				}
+			}
+			for (uint32_t i = 0; i < h.nodeCount; ++i) {
+				if (!isString(nodes[i].name.offset) || nodes[i].parent >= (int32_t)i || nodes[i].parent < -1) {
+					fail(path, "bad node record");
+				}
+			}
+			for (uint32_t i = 0; i < h.objectCount; ++i) {
+				if (objects[i].node >= h.nodeCount || objects[i].mesh >= h.meshCount
+					|| objects[i].mesh >= MAX_MESHES || objects[i].material > MAX_MATERIAL) {
+					fail(path, "bad object record");
+				}
+			}
+
+			for (uint32_t i = 0; i < h.textureCount; ++i) {
+				fixUp(textures[i].name);
+				for (int face = 0; face < 6; ++face) {
+					fixUp(textures[i].faces[face]);
+				}
+			}
+			for (uint32_t i = 0; i < h.meshCount; ++i) {
+				fixUp(meshes[i].name);
+			}
+			for (uint32_t i = 0; i < h.nodeCount; ++i) {
+				fixUp(nodes[i].name);
+			}
+			fixUp(h.textures);
+			fixUp(h.meshes);
+			fixUp(h.nodes);
+			fixUp(h.objects);
+			fixUp(h.strings);
+			return true;
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (base) UnmapViewOfFile(base);
+			if (mapping) CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (base) munmap(base, size);
+#endif
+			base = nullptr;
+			size = 0;
+		}
+
+		bool isOpen() const {
+			return base != nullptr;
+		}
+
+		const Header & header() const {
+			return *(const Header *)base;
+		}
+
+		uint32_t textureCount() const { return header().textureCount; }
+		uint32_t meshCount() const { return header().meshCount; }
+		uint32_t nodeCount() const { return header().nodeCount; }
+		uint32_t objectCount() const { return header().objectCount; }
+
+		const Texture & texture(uint32_t i) const { return header().textures.pointer[i]; }
+		const Mesh & mesh(uint32_t i) const { return header().meshes.pointer[i]; }
+		const Node & node(uint32_t i) const { return header().nodes.pointer[i]; }
+		const Object & object(uint32_t i) const { return header().objects.pointer[i]; }
+
+		std::vector<std::string> faces(uint32_t textureIndex) const {
+			std::vector<std::string> faces;
+			for (const Ref<const char> & face : texture(textureIndex).faces) {
+				faces.push_back(face.pointer);
+			}
+			return faces;
+		}
+	};
+
+	// Text form, one record per line, '#' starts a comment. Names must be defined
+	// before they are referenced.
+	//   texture <name> <face> x6
+	//   mesh <name> <texture> cube|skybox_left|skybox_right|skybox_room
+	//   node <name> <parent>|- [translate x y z] [pivot x y z] [scale s] [resizable]
+	//   object <node> <mesh> <layer>[|<layer>...] <radius> [material n]
+	// Layers are cubes, skybox_left, skybox_right and skybox_room.
+	class Compiler {
+		struct Strings {
+			std::string bytes;
+			std::map<std::string, uint64_t> offsets;
+
+			uint64_t add(const std::string & s) {
+				auto found = offsets.find(s);
+				if (found != offsets.end()) return found->second;
+				uint64_t offset = bytes.size();
+				bytes.append(s).push_back('\0');
+				offsets[s] = offset;
+				return offset;
+			}
+		};
+
+		std::vector<Texture> textures;
+		std::vector<Mesh> meshes;
+		std::vector<Node> nodes;
+		std::vector<Object> objects;
+		std::map<std::string, uint32_t> textureIndex, meshIndex, nodeIndex;
+		Strings strings;
+		std::string source;
+		int line{ 0 };
+
+		void fail(const std::string & what) const {
+			throw std::runtime_error(source + ":" + std::to_string(line) + ": " + what);
+		}
+
+		uint32_t lookup(const std::map<std::string, uint32_t> & index, const std::string & name, const char * what) const {
+			auto found = index.find(name);
+			if (found == index.end()) fail(std::string("unknown ") + what + " '" + name + "'");
+			return found->second;
+		}
+
+		void define(std::map<std::string, uint32_t> & index, const std::string & name, uint32_t value, const char * what) {
+			if (!index.insert(std::make_pair(name, value)).second) fail(std::string("duplicate ") + what + " '" + name + "'");
+		}
+
+		template <typename T>
+		T read(std::istringstream & in, const char * what) const {
+			T value;
+			if (!(in >> value)) fail(std::string("expected ") + what);
+			return value;
+		}
+
+		uint32_t layerBits(const std::string & names) const {
+			static const std::pair<const char *, uint32_t> table[] = {
+				{ "cubes", LAYER_CUBES },
+				{ "skybox_left", LAYER_SKYBOX_LEFT },
+				{ "skybox_right", LAYER_SKYBOX_RIGHT },
+				{ "skybox_room", LAYER_SKYBOX_ROOM },
+			};
+			uint32_t bits = 0;
+			std::istringstream in(names);
+			std::string name;
+			while (std::getline(in, name, '|')) {
+				uint32_t bit = 0;
+				for (const auto & entry : table) {
+					if (name == entry.first) bit = entry.second;
+				}
+				if (!bit) fail("unknown layer '" + name + "'");
+				bits |= bit;
+			}
+			return bits;
+		}
+
+		void parseLine(const std::string & text) {
+			std::istringstream in(text.substr(0, text.find('#')));
+			std::string keyword;
+			if (!(in >> keyword)) return;
+
+			if (keyword == "texture") {
+				Texture texture = {};
+				std::string name = read<std::string>(in, "texture name");
+				texture.name.offset = strings.add(name);
+				for (int face = 0; face < 6; ++face) {
+					texture.faces[face].offset = strings.add(read<std::string>(in, "six face images"));
+				}
+				define(textureIndex, name, (uint32_t)textures.size(), "texture");
+				textures.push_back(texture);
+			}
+			else if (keyword == "mesh") {
+				static const char * const kinds[MESH_KIND_COUNT] = { "cube", "skybox_left", "skybox_right", "skybox_room" };
+				Mesh mesh = {};
+				std::string name = read<std::string>(in, "mesh name");
+				mesh.name.offset = strings.add(name);
+				mesh.texture = lookup(textureIndex, read<std::string>(in, "texture"), "texture");
+				std::string kind = read<std::string>(in, "mesh kind");
+				mesh.kind = MESH_KIND_COUNT;
+				for (uint32_t k = 0; k < MESH_KIND_COUNT; ++k) {
+					if (kind == kinds[k]) mesh.kind = k;
+				}
+				if (mesh.kind == MESH_KIND_COUNT) fail("unknown mesh kind '" + kind + "'");
+				if (meshes.size() >= MAX_MESHES) fail("more than " + std::to_string(MAX_MESHES) + " meshes");
+				define(meshIndex, name, (uint32_t)meshes.size(), "mesh");
+				meshes.push_back(mesh);
+			}
+			else if (keyword == "node") {
+				Node node = {};
+				node.scale = 1.0f;
+				std::string name = read<std::string>(in, "node name");
+				node.name.offset = strings.add(name);
+				std::string parent = read<std::string>(in, "parent node or -");
+				node.parent = parent == "-" ? -1 : (int32_t)lookup(nodeIndex, parent, "node");
+				std::string option;
+				while (in >> option) {
+					if (option == "translate" || option == "pivot") {
+						float * v = option == "translate" ? node.translation : node.pivot;
+						for (int i = 0; i < 3; ++i) v[i] = read<float>(in, "x y z");
+					}
+					else if (option == "scale") {
+						node.scale = read<float>(in, "scale");
+					}
+					else if (option == "resizable") {
+						node.flags |= NODE_RESIZABLE;
+					}
+					else {
+						fail("unknown node option '" + option + "'");
+					}
+				}
+				define(nodeIndex, name, (uint32_t)nodes.size(), "node");
+				nodes.push_back(node);
+			}
+			else if (keyword == "object") {
+				Object object = {};
+				object.node = lookup(nodeIndex, read<std::string>(in, "node"), "node");
+				object.mesh = lookup(meshIndex, read<std::string>(in, "mesh"), "mesh");
+				object.layers = layerBits(read<std::string>(in, "layer"));
+				object.radius = read<float>(in, "radius");
+				std::string option;
+				while (in >> option) {
+					if (option == "material") {
+						object.material = read<uint32_t>(in, "material");
+						if (object.material > MAX_MATERIAL) fail("material above " + std::to_string(MAX_MATERIAL));
+					}
+					else fail("unknown object option '" + option + "'");
+				}
+				objects.push_back(object);
+			}
+			else {
+				fail("unknown record '" + keyword + "'");
+			}
+		}
+
+		template <typename T>
+		static void append(std::string & out, const std::vector<T> & records) {
+			if (!records.empty()) {
+				out.append((const char *)records.data(), records.size() * sizeof(T));
+			}
+		}
+
+	public:
+		void parse(const std::string & path) {
+			std::ifstream in(path);
+			if (!in) {
+				throw std::runtime_error("Unable to open " + path);
+			}
+			source = path;
+			line = 0;
+			std::string text;
+			while (std::getline(in, text)) {
+				++line;
+				parseLine(text);
+			}
+		}
+
+		// Sections follow the header in a fixed order, each 8-byte aligned
+		void write(const std::string & path) const {
+			Header header = {};
+			header.magic = MAGIC;
+			header.version = VERSION;
+			header.textureCount = (uint32_t)textures.size();
+			header.meshCount = (uint32_t)meshes.size();
+			header.nodeCount = (uint32_t)nodes.size();
+			header.objectCount = (uint32_t)objects.size();
+			uint64_t offset = sizeof(Header);
+			header.textures.offset = offset;
+			offset += textures.size() * sizeof(Texture);
+			header.meshes.offset = offset;
+			offset += meshes.size() * sizeof(Mesh);
+			header.nodes.offset = offset;
+			offset += nodes.size() * sizeof(Node);
+			header.objects.offset = offset;
+			offset += objects.size() * sizeof(Object);
+			header.strings.offset = offset;
+			header.stringBytes = std::max<uint64_t>(8, (strings.bytes.size() + 7) & ~(uint64_t)7);
+			header.fileSize = offset + header.stringBytes;
+
+			// string offsets so far are relative to the table
+			auto place = [&](Ref<const char> & ref) { ref.offset += header.strings.offset; };
+			std::vector<Texture> placedTextures = textures;
+			std::vector<Mesh> placedMeshes = meshes;
+			std::vector<Node> placedNodes = nodes;
+			for (Texture & t : placedTextures) {
+				place(t.name);
+				for (Ref<const char> & face : t.faces) place(face);
+			}
+			for (Mesh & m : placedMeshes) place(m.name);
+			for (Node & n : placedNodes) place(n.name);
+
+			std::string out((const char *)&header, sizeof(Header));
+			append(out, placedTextures);
+			append(out, placedMeshes);
+			append(out, placedNodes);
+			append(out, objects);
+			out.append(strings.bytes);
+			out.resize((size_t)header.fileSize, '\0');
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file.write(out.data(), out.size())) {
+				throw std::runtime_error("Unable to write " + path);
+			}
+		}
+
+		size_t nodeCount() const { return nodes.size(); }
+		size_t objectCount() const { return objects.size(); }
+	};
+
+	// The --compile-scene tool: text in, binary out
+	inline void compile(const std::string & textPath, const std::string & binaryPath) {
+		Compiler compiler;
+		compiler.parse(textPath);
+		compiler.write(binaryPath);
+	}
+
+	// True if both files exist and the text form was saved after the binary
+	inline bool sourceNewer(const std::string & textPath, const std::string & binaryPath) {
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA text, binary;
+		if (!GetFileAttributesExA(textPath.c_str(), GetFileExInfoStandard, &text)
+			|| !GetFileAttributesExA(binaryPath.c_str(), GetFileExInfoStandard, &binary)) {
+			return false;
+		}
+		return CompareFileTime(&text.ftLastWriteTime, &binary.ftLastWriteTime) > 0;
+#else
+		struct stat text, binary;
+		if (stat(textPath.c_str(), &text) != 0 || stat(binaryPath.c_str(), &binary) != 0) {
+			return false;
+		}
+		return text.st_mtime > binary.st_mtime;
+#endif
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+//
+//  SceneGraph.h
+//  Transform hierarchy kept in flat arrays. World matrices are only
+//  recomputed for nodes whose local transform, or an ancestor's, changed.
+//
+
+#ifndef SceneGraph_h
+#define SceneGraph_h
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Nodes are only ever appended and a parent always exists before its children, so
+// parents sit at lower indices and one forward pass over the arrays updates the
+// whole hierarchy, each node after its parent.
+class SceneGraph {
+public:
+	typedef unsigned int Node;
+	static const Node None = ~0u;
+
+	Node create(Node parent = None, const glm::mat4 & local = glm::mat4(1.0f)) {
+		Node node = (Node)parents.size();
+		parents.push_back(parent);
+		locals.push_back(local);
+		worlds.push_back(local);
+		dirty.push_back(1);
+		changed.push_back(0);
+		return node;
+	}
+
+	void setLocal(Node node, const glm::mat4 & local) {
+		locals[node] = local;
+		dirty[node] = 1;
+	}
+
+	const glm::mat4 & local(Node node) const {
+		return locals[node];
+	}
+
+	// As of the last update()
+	const glm::mat4 & world(Node node) const {
+		return worlds[node];
+	}
+
+	Node parent(Node node) const {
+		return parents[node];
+	}
+
+	// True if the last update() gave this node a new world matrix
+	bool worldChanged(Node node) const {
+		return changed[node] != 0;
+	}
+
+	size_t size() const {
+		return parents.size();
+	}
+
+	// Recomputes the world matrices of dirty nodes and their descendants, returns how many
+	unsigned int update() {
+		unsigned int updated = 0;
+		const size_t count = parents.size();
+		for (size_t i = 0; i < count; ++i) {
+			const Node p = parents[i];
+			const bool parentChanged = p != None && changed[p];
+			if (dirty[i] || parentChanged) {
+				worlds[i] = p != None ? worlds[p] * locals[i] : locals[i];
+				changed[i] = 1;
+				++updated;
+			}
+			else {
+				changed[i] = 0;
+			}
+			dirty[i] = 0;
+		}
+		return updated;
+	}
+
+private:
+	std::vector<Node> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint8_t> dirty;   // local transform set since the last update
+	std::vector<uint8_t> changed; // world transform recomputed by the last update
+};
+
+#endif
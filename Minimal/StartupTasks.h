@@ -0,0 +1,260 @@
+#pragma once
+//
+//  StartupTasks.h
+//  A small dependency graph for startup work, run on the job system so file
+//  reads and decodes overlap with the runtime, window and GL context coming up.
+//
+
+#ifndef StartupTasks_h
+#define StartupTasks_h
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "JobSystem.h"
+
+// A task is handed to the job system once every task it was added after has finished.
+// GL_THREAD tasks run only on the thread that owns the context, the rest anywhere, so
+// only work that needs the context waits for it; the GL thread wait()s on the tasks
+// whose results it uploads, and runs jobs while it does. A task that throws fails
+// every task after it, and wait() rethrows. add() may be called from inside a task,
+// to queue work on files the task has just found out about.
+//
+// Without a job system nothing runs ahead: wait() runs a task, and whatever it still
+// needs, inline the first time it is wanted, which keeps startup in its serial order
+// for comparison.
+class StartupTasks {
+public:
+	typedef unsigned int Task;
+
+	explicit StartupTasks(JobSystem * jobs) : launch(std::chrono::steady_clock::now()), jobs(jobs) {}
+
+	StartupTasks(const StartupTasks &) = delete;
+	StartupTasks & operator=(const StartupTasks &) = delete;
+
+	~StartupTasks() {
+		stop();
+	}
+
+	// Queues nothing more and waits for what is queued; tasks not started yet fail
+	// without running. Owners whose members tasks write into call this before those
+	// members go away, and before anything a GL task uses does.
+	void stop() {
+		std::vector<Task> queued;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			for (Task task = 0; task < (Task)tasks.size(); ++task) {
+				if (tasks[task].state == QUEUED || tasks[task].state == RUNNING) {
+					queued.push_back(task);
+				}
+			}
+		}
+		for (Task task : queued) {
+			jobs->wait(tasks[task].counter);
+		}
+	}
+
+	Task add(const std::string & name, std::function<void()> work, const std::vector<Task> & after = {},
+		JobSystem::Affinity affinity = JobSystem::ANY_THREAD) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Task task = (Task)tasks.size();
+		tasks.emplace_back();
+		Entry & entry = tasks.back();
+		entry.name = name;
+		entry.work = std::move(work);
+		entry.after = after;
+		entry.affinity = affinity;
+		if (jobs) {
+			queueIfReady(task);
+		}
+		return task;
+	}
+
+	// Returns once the task has run, rethrowing what it (or a task it needed) threw
+	void wait(Task task) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			Entry & entry = tasks[task];
+			if (entry.state == DONE) {
+				return;
+			}
+			if (entry.state == FAILED) {
+				std::rethrow_exception(entry.error);
+			}
+			if (entry.state == QUEUED || entry.state == RUNNING) {
+				lock.unlock();
+				jobs->wait(entry.counter);
+				lock.lock();
+				continue;
+			}
+			if (stopping) {
+				throw std::runtime_error("startup task " + entry.name + " was never started");
+			}
+			// pending: what it needs comes first, and finishing the last of it queues this one
+			auto unfinished = std::find_if(entry.after.begin(), entry.after.end(), [this](Task before) {
+				return tasks[before].state != DONE;
+			});
+			if (unfinished != entry.after.end()) {
+				Task before = *unfinished;
+				lock.unlock();
+				wait(before);
+				lock.lock();
+			}
+			else if (!jobs) {
+				lock.unlock();
+				execute(task);
+				lock.lock();
+			}
+		}
+	}
+
+	bool isParallel() const {
+		return jobs != nullptr;
+	}
+
+	// Milliseconds since the graph was made, the first thing main() does
+	double elapsedMs() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - launch).count();
+	}
+
+	// Records what the calling thread did since the previous mark (or launch), so the
+	// timeline shows the main thread's steps next to the tasks
+	void mark(const std::string & name) {
+		std::lock_guard<std::mutex> lock(mutex);
+		double now = elapsedMs();
+		marks.push_back({ name, lastMark, now });
+		lastMark = now;
+	}
+
+	// Every mark and finished task by start time, with the thread it ran on
+	void dump(std::ostream & out) const {
+		struct Span {
+			std::string name;
+			double startMs, endMs;
+			unsigned int thread;
+			bool failed;
+		};
+		std::vector<Span> spans;
+		double busyMs = 0.0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const Mark & mark : marks) {
+				spans.push_back({ mark.name, mark.startMs, mark.endMs, 0, false });
+			}
+			for (const Entry & entry : tasks) {
+				if (entry.state == DONE || (entry.state == FAILED && entry.endMs > 0.0)) {
+					spans.push_back({ entry.name, entry.startMs, entry.endMs, entry.thread, entry.state == FAILED });
+					busyMs += entry.endMs - entry.startMs;
+				}
+			}
+		}
+		std::stable_sort(spans.begin(), spans.end(), [](const Span & a, const Span & b) { return a.startMs < b.startMs; });
+		out << std::fixed << std::setprecision(1);
+		out << "Startup (" << (jobs ? "parallel, " + std::to_string(jobs->workerCount()) + " workers" : std::string("serial"))
+			<< "), " << busyMs << " ms of tasks" << std::endl;
+		for (const Span & span : spans) {
+			out << "  " << std::setw(8) << span.startMs << " " << std::setw(8) << span.endMs << " ms  "
+				<< std::left << std::setw(9) << (span.thread ? "worker " + std::to_string(span.thread) : std::string("main"))
+				<< std::right << " " << span.name << (span.failed ? " (failed)" : "") << std::endl;
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+private:
+	enum State { PENDING, QUEUED, RUNNING, DONE, FAILED };
+
+	struct Entry {
+		std::string name;
+		std::function<void()> work;
+		std::vector<Task> after;
+		JobSystem::Affinity affinity{ JobSystem::ANY_THREAD };
+		State state{ PENDING };
+		std::exception_ptr error;
+		JobSystem::Counter counter; // the job, once queued
+		double startMs{ 0.0 }, endMs{ 0.0 };
+		unsigned int thread{ 0 }; // the job system's worker, 0 any other thread
+	};
+
+	struct Mark {
+		std::string name;
+		double startMs, endMs;
+	};
+
+	std::chrono::steady_clock::time_point launch;
+	JobSystem * jobs;
+	mutable std::mutex mutex;
+	std::deque<Entry> tasks; // by Task; a deque so entries stay put as it grows
+	bool stopping{ false };
+	std::vector<Mark> marks;
+	double lastMark{ 0.0 };
+
+	// Hands a pending task whose tasks before it are all done to the job system, or
+	// fails it if one of them failed. Called with the mutex held.
+	void queueIfReady(Task task) {
+		Entry & entry = tasks[task];
+		for (Task before : entry.after) {
+			const Entry & needed = tasks[before];
+			if (needed.state == FAILED) {
+				entry.state = FAILED;
+				entry.error = needed.error;
+				return;
+			}
+			if (needed.state != DONE) {
+				return;
+			}
+		}
+		if (stopping) {
+			return;
+		}
+		entry.state = QUEUED;
+		jobs->run([this, task] { execute(task); }, &entry.counter, entry.affinity);
+	}
+
+	void execute(Task task) {
+		std::function<void()> work;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Entry & entry = tasks[task];
+			if (stopping && jobs) {
+				entry.state = FAILED;
+				entry.error = std::make_exception_ptr(std::runtime_error("startup stopped before " + entry.name));
+				return;
+			}
+			entry.state = RUNNING;
+			entry.thread = jobs ? jobs->currentThread() : 0;
+			entry.startMs = elapsedMs();
+			work = std::move(entry.work);
+		}
+		std::exception_ptr error;
+		try {
+			work();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		Entry & entry = tasks[task];
+		entry.endMs = elapsedMs();
+		entry.state = error ? FAILED : DONE;
+		entry.error = error;
+		// tasks only ever come after older ones, so one pass in order reaches every
+		// task this one lets go of, and every one a failure fails in turn
+		for (Task later = task + 1; jobs && later < (Task)tasks.size(); ++later) {
+			if (tasks[later].state == PENDING) {
+				queueIfReady(later);
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,273 @@
+#pragma once
+//
+//  Telemetry.h
+//  Compositor performance stats from ovr_GetPerfStats: dropped frames, GPU
+//  times, latency and ASW, over a rolling window and per rendering mode.
+//
+
+#ifndef Telemetry_h
+#define Telemetry_h
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <OVR_CAPI.h>
+
+// poll() once per frame after ovr_EndFrame. The runtime hands back up to five
+// compositor frames since the last call, newest first; they are taken oldest first
+// and the runtime's running counters (dropped frames, ASW) turned into per-frame
+// counts. Every frame goes into a rolling window and into the totals of the mode
+// passed with it. The stats trail the submitted frame by a frame or two, so the
+// frames right after a mode change are counted against the old mode.
+class PerfTelemetry {
+public:
+	// One compositor frame
+	struct Sample {
+		int appDropped;        // app frames missed since the previous sample
+		int compositorDropped; // compositor frames missed since the previous sample
+		float appCpuMs;
+		float appGpuMs;
+		float compositorGpuMs;
+		float motionToPhotonMs; // the app's, before timewarp
+		float compositorLatencyMs;
+		float queueAheadMs;
+		bool aswActive;
+		int aswActivations; // ASW switched on since the previous sample
+		int aswFailed;      // extrapolated frames the compositor could not present
+	};
+
+	struct Spread {
+		float average;
+		float p95; // only over the rolling window; 0 in the per-mode totals
+		float max;
+	};
+
+	struct Summary {
+		unsigned int frames;
+		unsigned int appDropped;
+		unsigned int compositorDropped;
+		unsigned int aswFrames; // frames with ASW active
+		unsigned int aswActivations;
+		unsigned int aswFailed;
+		Spread appGpuMs;
+		Spread compositorGpuMs;
+		Spread motionToPhotonMs;
+		Spread compositorLatencyMs;
+	};
+
+	PerfTelemetry(unsigned int windowFrames = 450) // five seconds at 90 Hz
+		: windowSize(windowFrames) {
+		history.reserve(windowSize);
+	}
+
+	void poll(ovrSession session, const std::string & mode) {
+		ovrPerfStats stats;
+		if (!OVR_SUCCESS(ovr_GetPerfStats(session, &stats))) {
+			return;
+		}
+		aswAvailable = stats.AswIsAvailable != ovrFalse;
+		adaptiveGpuScale = stats.AdaptiveGpuPerformanceScale;
+		if (stats.AnyFrameStatsDropped) {
+			++lostPolls;
+		}
+		Totals & totals = modes[mode];
+		for (int i = stats.FrameStatsCount - 1; i >= 0; --i) {
+			const ovrPerfStatsPerCompositorFrame & frame = stats.FrameStats[i];
+			if (havePrevious && frame.CompositorFrameIndex <= previous.CompositorFrameIndex) {
+				continue;
+			}
+			Sample sample;
+			sample.appDropped = counted(frame.AppDroppedFrameCount, previous.AppDroppedFrameCount);
+			sample.compositorDropped = counted(frame.CompositorDroppedFrameCount, previous.CompositorDroppedFrameCount);
+			sample.appCpuMs = frame.AppCpuElapsedTime * 1000.0f;
+			sample.appGpuMs = frame.AppGpuElapsedTime * 1000.0f;
+			sample.compositorGpuMs = frame.CompositorGpuElapsedTime * 1000.0f;
+			sample.motionToPhotonMs = frame.AppMotionToPhotonLatency * 1000.0f;
+			sample.compositorLatencyMs = frame.CompositorLatency * 1000.0f;
+			sample.queueAheadMs = frame.AppQueueAheadTime * 1000.0f;
+			sample.aswActive = frame.AswIsActive != ovrFalse;
+			sample.aswActivations = counted(frame.AswActivatedToggleCount, previous.AswActivatedToggleCount);
+			sample.aswFailed = counted(frame.AswFailedFrameCount, previous.AswFailedFrameCount);
+			previous = frame;
+			havePrevious = true;
+
+			if (history.size() < windowSize) {
+				history.push_back(sample);
+			}
+			else {
+				history[head] = sample;
+			}
+			head = (head + 1) % windowSize;
+			totals.add(sample);
+			overall.add(sample);
+		}
+	}
+
+	bool empty() const {
+		return history.empty();
+	}
+
+	// The newest compositor frame; only valid when !empty()
+	const Sample & latest() const {
+		return history[(head + windowSize - 1) % windowSize];
+	}
+
+	// The last windowFrames compositor frames
+	Summary window() const {
+		Totals totals;
+		std::vector<float> appGpu, compositorGpu, motionToPhoton, compositorLatency;
+		for (const Sample & sample : history) {
+			totals.add(sample);
+			appGpu.push_back(sample.appGpuMs);
+			compositorGpu.push_back(sample.compositorGpuMs);
+			motionToPhoton.push_back(sample.motionToPhotonMs);
+			compositorLatency.push_back(sample.compositorLatencyMs);
+		}
+		Summary summary = totals.summary();
+		summary.appGpuMs.p95 = percentile(appGpu, 0.95f);
+		summary.compositorGpuMs.p95 = percentile(compositorGpu, 0.95f);
+		summary.motionToPhotonMs.p95 = percentile(motionToPhoton, 0.95f);
+		summary.compositorLatencyMs.p95 = percentile(compositorLatency, 0.95f);
+		return summary;
+	}
+
+	// Every frame since the start
+	Summary total() const {
+		return overall.summary();
+	}
+
+	// Every frame since the start that was polled in one mode, by mode
+	std::map<std::string, Summary> byMode() const {
+		std::map<std::string, Summary> summaries;
+		for (const auto & mode : modes) {
+			summaries[mode.first] = mode.second.summary();
+		}
+		return summaries;
+	}
+
+	bool aswIsAvailable() const {
+		return aswAvailable;
+	}
+
+	// The runtime's hint: desired over current GPU utilization, 1 when on budget
+	float gpuPerformanceScale() const {
+		return adaptiveGpuScale;
+	}
+
+	// Polls that missed compositor frames, called too far apart to get them all
+	unsigned int lostPollCount() const {
+		return lostPolls;
+	}
+
+	void dump(std::ostream & out, bool perMode) const {
+		out << std::fixed << std::setprecision(2);
+		out << "Compositor stats, last " << history.size() << " frames (ms: avg / p95 / max)" << std::endl;
+		write(out, "  ", window(), true);
+		out << "  ASW " << (aswAvailable ? "available" : "unavailable") << ", GPU performance scale " << adaptiveGpuScale << std::endl;
+		if (perMode) {
+			out << "Compositor stats since start (ms: avg / max)" << std::endl;
+			write(out, "  ", total(), false);
+			for (const auto & mode : byMode()) {
+				out << "  mode " << mode.first << ":" << std::endl;
+				write(out, "    ", mode.second, false);
+			}
+			if (lostPolls) {
+				out << "  (" << lostPolls << " polls came too late to see every compositor frame)" << std::endl;
+			}
+		}
+		out.unsetf(std::ios::floatfield);
+	}
+
+private:
+	struct Totals {
+		unsigned int frames{ 0 };
+		unsigned int appDropped{ 0 }, compositorDropped{ 0 };
+		unsigned int aswFrames{ 0 }, aswActivations{ 0 }, aswFailed{ 0 };
+		double appGpu{ 0.0 }, compositorGpu{ 0.0 }, motionToPhoton{ 0.0 }, compositorLatency{ 0.0 };
+		float appGpuMax{ 0.0f }, compositorGpuMax{ 0.0f }, motionToPhotonMax{ 0.0f }, compositorLatencyMax{ 0.0f };
+
+		void add(const Sample & sample) {
+			++frames;
+			appDropped += sample.appDropped;
+			compositorDropped += sample.compositorDropped;
+			aswFrames += sample.aswActive ? 1 : 0;
+			aswActivations += sample.aswActivations;
+			aswFailed += sample.aswFailed;
+			appGpu += sample.appGpuMs;
+			compositorGpu += sample.compositorGpuMs;
+			motionToPhoton += sample.motionToPhotonMs;
+			compositorLatency += sample.compositorLatencyMs;
+			appGpuMax = std::max(appGpuMax, sample.appGpuMs);
+			compositorGpuMax = std::max(compositorGpuMax, sample.compositorGpuMs);
+			motionToPhotonMax = std::max(motionToPhotonMax, sample.motionToPhotonMs);
+			compositorLatencyMax = std::max(compositorLatencyMax, sample.compositorLatencyMs);
+		}
+
+		Summary summary() const {
+			Summary s = {};
+			s.frames = frames;
+			s.appDropped = appDropped;
+			s.compositorDropped = compositorDropped;
+			s.aswFrames = aswFrames;
+			s.aswActivations = aswActivations;
+			s.aswFailed = aswFailed;
+			if (frames) {
+				s.appGpuMs = { (float)(appGpu / frames), 0.0f, appGpuMax };
+				s.compositorGpuMs = { (float)(compositorGpu / frames), 0.0f, compositorGpuMax };
+				s.motionToPhotonMs = { (float)(motionToPhoton / frames), 0.0f, motionToPhotonMax };
+				s.compositorLatencyMs = { (float)(compositorLatency / frames), 0.0f, compositorLatencyMax };
+			}
+			return s;
+		}
+	};
+
+	unsigned int windowSize;
+	std::vector<Sample> history; // ring of the last windowSize samples
+	unsigned int head{ 0 };
+	Totals overall;
+	std::map<std::string, Totals> modes;
+	ovrPerfStatsPerCompositorFrame previous;
+	bool havePrevious{ false };
+	bool aswAvailable{ false };
+	float adaptiveGpuScale{ 1.0f };
+	unsigned int lostPolls{ 0 };
+
+	// The step in one of the runtime's running counters; ovr_ResetPerfStats or a
+	// first sample restarts it
+	int counted(int value, int before) const {
+		return havePrevious && value >= before ? value - before : 0;
+	}
+
+	static float percentile(std::vector<float> & values, float fraction) {
+		if (values.empty()) {
+			return 0.0f;
+		}
+		size_t rank = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+		return values[rank];
+	}
+
+	static void write(std::ostream & out, const char * indent, const Summary & s, bool withP95) {
+		out << indent << s.frames << " frames, " << s.appDropped << " app and " << s.compositorDropped << " compositor frames dropped, "
+			<< "ASW active " << s.aswFrames << " frames (" << s.aswActivations << " activations, " << s.aswFailed << " failed)" << std::endl;
+		out << indent << "app GPU " << spread(s.appGpuMs, withP95) << "  compositor GPU " << spread(s.compositorGpuMs, withP95) << std::endl;
+		out << indent << "motion-to-photon " << spread(s.motionToPhotonMs, withP95) << "  compositor latency " << spread(s.compositorLatencyMs, withP95) << std::endl;
+	}
+
+	static std::string spread(const Spread & s, bool withP95) {
+		std::ostringstream text;
+		text << std::fixed << std::setprecision(2) << s.average << " / ";
+		if (withP95) {
+			text << s.p95 << " / ";
+		}
+		text << s.max;
+		return text.str();
+	}
+};
+
+#endif
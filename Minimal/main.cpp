@@ -19,11 +19,40 @@ limitations under the License.
 
 #include "Cube.h"
 #include "shader.h"
+#include "GpuTimer.h"
+#include "Profiler.h"
+#include "InputSampler.h"
+#include "RigidMath.h"
+#include "PosePipeline.h"
+#include "Benchmarks.h"
+#include "Logger.h"
+#include "SceneGraph.h"
+#include "EntityStore.h"
+#include "SceneFile.h"
+#include "Bvh.h"
+#include "RayPick.h"
+#include "GpuCulling.h"
+#include "HiZ.h"
+#include "DepthReadback.h"
+#include "FrameRing.h"
+#include "FrameArena.h"
+#include "RenderTargets.h"
+#include "Telemetry.h"
+#include "JobSystem.h"
+#include "StartupTasks.h"
+#include "ImageCache.h"
 
 #include <iostream>
+#include <sstream>
 #include <memory>
 #include <exception>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <new>
+#include <cstdlib>
 #include <Windows.h>
 #include <math.h>
 
@@ -34,6 +63,108 @@ limitations under the License.
 
 #define FAIL(X) throw std::runtime_error(X)
 
+// Heap allocation audit: every form of the global operator new is replaced to count
+// allocations per thread, so the render thread can show it leaves the heap alone once
+// warm whatever the main thread and workers do (see RiftApp::countHeapAllocations).
+// Built into debug builds unless HEAP_AUDIT is forced either way.
+#ifndef HEAP_AUDIT
+#ifdef NDEBUG
+#define HEAP_AUDIT 0
+#else
+#define HEAP_AUDIT 1
+#endif
+#endif
+
+#if HEAP_AUDIT
+static thread_local unsigned long long threadHeapAllocations = 0;
+
+// malloc, calling the new handler and retrying while it fails as operator new must
+static void * auditedAllocate(size_t size) {
+	++threadHeapAllocations;
+	void * block;
+	while (!(block = malloc(size ? size : 1))) {
+		if (std::new_handler handler = std::get_new_handler()) {
+			handler();
+		}
+		else {
+			throw std::bad_alloc();
+		}
+	}
+	return block;
+}
+
+static void * auditedAllocateNothrow(size_t size) noexcept {
+	try {
+		return auditedAllocate(size);
+	}
+	catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+void * operator new(size_t size) { return auditedAllocate(size); }
+void * operator new[](size_t size) { return auditedAllocate(size); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept { return auditedAllocateNothrow(size); }
+void * operator new[](size_t size, const std::nothrow_t &) noexcept { return auditedAllocateNothrow(size); }
+void operator delete(void * block) noexcept { free(block); }
+void operator delete[](void * block) noexcept { free(block); }
+void operator delete(void * block, size_t) noexcept { free(block); }
+void operator delete[](void * block, size_t) noexcept { free(block); }
+void operator delete(void * block, const std::nothrow_t &) noexcept { free(block); }
+void operator delete[](void * block, const std::nothrow_t &) noexcept { free(block); }
+
+#ifdef __cpp_aligned_new
+// Over-aligned types, from C++17 on
+static void * auditedAllocate(size_t size, std::align_val_t alignment) {
+	++threadHeapAllocations;
+	const size_t align = (size_t)alignment;
+	size = (size ? size + align - 1 : align) & ~(align - 1); // aligned_alloc wants a multiple
+	void * block;
+#ifdef _MSC_VER
+	while (!(block = _aligned_malloc(size, align))) {
+#else
+	while (!(block = aligned_alloc(align, size))) {
+#endif
+		if (std::new_handler handler = std::get_new_handler()) {
+			handler();
+		}
+		else {
+			throw std::bad_alloc();
+		}
+	}
+	return block;
+}
+
+static void alignedFree(void * block) noexcept {
+#ifdef _MSC_VER
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+static void * auditedAllocateNothrow(size_t size, std::align_val_t alignment) noexcept {
+	try {
+		return auditedAllocate(size, alignment);
+	}
+	catch (const std::bad_alloc &) {
+		return nullptr;
+	}
+}
+
+void * operator new(size_t size, std::align_val_t alignment) { return auditedAllocate(size, alignment); }
+void * operator new[](size_t size, std::align_val_t alignment) { return auditedAllocate(size, alignment); }
+void * operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return auditedAllocateNothrow(size, alignment); }
+void * operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return auditedAllocateNothrow(size, alignment); }
+void operator delete(void * block, std::align_val_t) noexcept { alignedFree(block); }
+void operator delete[](void * block, std::align_val_t) noexcept { alignedFree(block); }
+void operator delete(void * block, size_t, std::align_val_t) noexcept { alignedFree(block); }
+void operator delete[](void * block, size_t, std::align_val_t) noexcept { alignedFree(block); }
+void operator delete(void * block, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(block); }
+void operator delete[](void * block, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(block); }
+#endif
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // GLM is a C++ math library meant to mirror the syntax of GLSL 
@@ -70,15 +201,11 @@ using namespace std;
 #include <GL/glew.h>
 
 /////// Custom variables
-bool cube_size_up = false; // set to true with LThumbStick to right
-bool cube_size_down = false; // set to true with LThumbStick to left
-bool cube_size_reset = false; // set to true with LThumbStick pressed in
+// Cube size: LThumbStick right grows, left shrinks, pressed in resets (ColorCubeScene::simulate)
 
+// RThumbStick right widens, left narrows, pressed in resets (RiftApp::simulate)
 double iod = 0.0;
 double original_iod = 0.0;
-bool iod_up = false; // true when RThumbStick to right
-bool iod_down = false; // true when RThumbStick to left
-bool iod_reset = false; // true when RThumbStick pressed in
 
 // Button X controls
 bool x1 = true; // show entire scene (cubes and sky box in stereo)
@@ -102,21 +229,6 @@ bool b4 = false; // no tracking (position and orientation frozen to what they ju
 // Button Y controls
 bool superRotation = false; // toggled by Y button
 
-bool isPressed = false; // true if any button is pressed
-
-// HMD transformation matrices
-glm::mat4 headPos_left_curr = glm::mat4(1.0f);
-glm::mat4 headPos_right_curr = glm::mat4(1.0f);
-glm::mat4 headPos_left_prev = glm::mat4(1.0f); // use this matrix to track head position each frame
-glm::mat4 headPos_right_prev = glm::mat4(1.0f);
-
-// euler angles of HMD's rotation matrix
-
-float theta_x_curr, theta_y_curr, theta_z_curr = 0.0f;
-float theta_x_prev, theta_y_prev, theta_z_prev = 0.0f;
-glm::mat4 headPos_curr = glm::mat4(1.0f);
-glm::mat4 headPos_prev = glm::mat4(1.0f);
-
 float pi = atanf(1) * 4;
 
 //////////////////////
@@ -129,35 +241,35 @@ bool checkFramebufferStatus(GLenum target = GL_FRAMEBUFFER) {
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-		std::cerr << "framebuffer incomplete attachment" << std::endl;
+		LOG_ERROR("framebuffer incomplete attachment");
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-		std::cerr << "framebuffer missing attachment" << std::endl;
+		LOG_ERROR("framebuffer missing attachment");
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:
-		std::cerr << "framebuffer incomplete draw buffer" << std::endl;
+		LOG_ERROR("framebuffer incomplete draw buffer");
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:
-		std::cerr << "framebuffer incomplete read buffer" << std::endl;
+		LOG_ERROR("framebuffer incomplete read buffer");
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:
-		std::cerr << "framebuffer incomplete multisample" << std::endl;
+		LOG_ERROR("framebuffer incomplete multisample");
 		break;
 
 	case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:
-		std::cerr << "framebuffer incomplete layer targets" << std::endl;
+		LOG_ERROR("framebuffer incomplete layer targets");
 		break;
 
 	case GL_FRAMEBUFFER_UNSUPPORTED:
-		std::cerr << "framebuffer unsupported internal format or image" << std::endl;
+		LOG_ERROR("framebuffer unsupported internal format or image");
 		break;
 
 	default:
-		std::cerr << "other framebuffer error" << std::endl;
+		LOG_ERROR("other framebuffer error");
 		break;
 	}
 
@@ -172,25 +284,25 @@ bool checkGlError() {
 	else {
 		switch (error) {
 		case GL_INVALID_ENUM:
-			std::cerr << ": An unacceptable value is specified for an enumerated argument.The offending command is ignored and has no other side effect than to set the error flag.";
+			LOG_ERROR("GL_INVALID_ENUM: An unacceptable value is specified for an enumerated argument.The offending command is ignored and has no other side effect than to set the error flag.");
 			break;
 		case GL_INVALID_VALUE:
-			std::cerr << ": A numeric argument is out of range.The offending command is ignored and has no other side effect than to set the error flag";
+			LOG_ERROR("GL_INVALID_VALUE: A numeric argument is out of range.The offending command is ignored and has no other side effect than to set the error flag");
 			break;
 		case GL_INVALID_OPERATION:
-			std::cerr << ": The specified operation is not allowed in the current state.The offending command is ignored and has no other side effect than to set the error flag..";
+			LOG_ERROR("GL_INVALID_OPERATION: The specified operation is not allowed in the current state.The offending command is ignored and has no other side effect than to set the error flag..");
 			break;
 		case GL_INVALID_FRAMEBUFFER_OPERATION:
-			std::cerr << ": The framebuffer object is not complete.The offending command is ignored and has no other side effect than to set the error flag.";
+			LOG_ERROR("GL_INVALID_FRAMEBUFFER_OPERATION: The framebuffer object is not complete.The offending command is ignored and has no other side effect than to set the error flag.");
 			break;
 		case GL_OUT_OF_MEMORY:
-			std::cerr << ": There is not enough memory left to execute the command.The state of the GL is undefined, except for the state of the error flags, after this error is recorded.";
+			LOG_ERROR("GL_OUT_OF_MEMORY: There is not enough memory left to execute the command.The state of the GL is undefined, except for the state of the error flags, after this error is recorded.");
 			break;
 		case GL_STACK_UNDERFLOW:
-			std::cerr << ": An attempt has been made to perform an operation that would cause an internal stack to underflow.";
+			LOG_ERROR("GL_STACK_UNDERFLOW: An attempt has been made to perform an operation that would cause an internal stack to underflow.");
 			break;
 		case GL_STACK_OVERFLOW:
-			std::cerr << ": An attempt has been made to perform an operation that would cause an internal stack to overflow.";
+			LOG_ERROR("GL_STACK_OVERFLOW: An attempt has been made to perform an operation that would cause an internal stack to overflow.");
 			break;
 		}
 		return true;
@@ -199,7 +311,7 @@ bool checkGlError() {
 
 void glDebugCallbackHandler(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *msg, GLvoid* data) {
 	OutputDebugStringA(msg);
-	std::cout << "debug call: " << msg << std::endl;
+	LOG_DEBUG("debug call: %s", msg);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -211,7 +323,15 @@ void glDebugCallbackHandler(GLenum source, GLenum type, GLuint id, GLenum severi
 
 namespace glfw {
 	inline GLFWwindow * createWindow(const uvec2 & size, const ivec2 & position = ivec2(INT_MIN)) {
+		// The hints ask for the newest context anything can use; everything but the
+		// optional GPU-driven paths runs on 4.1, so fall back to that quietly
+		GLFWerrorfun errorCallback = glfwSetErrorCallback(nullptr);
 		GLFWwindow * window = glfwCreateWindow(size.x, size.y, "glfw", nullptr, nullptr);
+		glfwSetErrorCallback(errorCallback);
+		if (!window) {
+			glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+			window = glfwCreateWindow(size.x, size.y, "glfw", nullptr, nullptr);
+		}
 		if (!window) {
 			FAIL("Unable to create rendering window");
 		}
@@ -253,7 +373,7 @@ public:
 		window = createRenderingTarget(windowSize, windowPosition);
 
 		if (!window) {
-			std::cout << "Unable to create OpenGL window" << std::endl;
+			LOG_ERROR("Unable to create OpenGL window");
 			return -1;
 		}
 
@@ -261,13 +381,8 @@ public:
 
 		initGl();
 
-		while (!glfwWindowShouldClose(window)) {
-			++frame;
-			glfwPollEvents();
-			update();
-			draw();
-			finishFrame();
-		}
+		PROFILE_THREAD("main");
+		runLoop();
 
 		shutdownGl();
 
@@ -280,10 +395,28 @@ protected:
 
 	virtual void draw() = 0;
 
+	// Polls input, updates and draws one frame after another on this thread
+	virtual void runLoop() {
+		while (!glfwWindowShouldClose(window)) {
+			PROFILE_ZONE("frame");
+			++frame;
+			{
+				PROFILE_ZONE("glfwPollEvents");
+				glfwPollEvents();
+			}
+			update();
+			draw();
+			{
+				PROFILE_ZONE("finishFrame");
+				finishFrame();
+			}
+		}
+	}
+
 	void preCreate() {
 		glfwWindowHint(GLFW_DEPTH_BITS, 16);
 		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3); // 4.1 if that's all there is, see glfw::createWindow
 		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
 	}
@@ -303,6 +436,7 @@ protected:
 			FAIL("Failed to initialize GLEW");
 		}
 		glGetError();
+		LOG_INFO("OpenGL %s, %s", (const char *)glGetString(GL_VERSION), (const char *)glGetString(GL_RENDERER));
 
 		if (GLEW_KHR_debug) {
 			GLint v;
@@ -338,6 +472,16 @@ protected:
 		case GLFW_KEY_ESCAPE:
 			glfwSetWindowShouldClose(window, 1);
 			return;
+		case GLFW_KEY_P:
+#if PROFILER_ENABLED
+			// dump the last few seconds of CPU zones for chrome://tracing
+			if (profiler::writeChromeTrace("trace.json", 10.0)) {
+				LOG_INFO("wrote the last 10 seconds of CPU zones to trace.json");
+			}
+#else
+			LOG_INFO("the CPU profiler is compiled out of release builds");
+#endif
+			return;
 		}
 	}
 
@@ -374,6 +518,7 @@ private:
 
 #include <OVR_CAPI.h>
 #include <OVR_CAPI_GL.h>
+#include <Extras/OVR_CAPI_Util.h>
 
 namespace ovr {
 
@@ -412,9 +557,12 @@ namespace ovr {
 	}
 
 	inline mat4 toGlm(const ovrPosef & op) {
-		mat4 orientation = glm::mat4_cast(toGlm(op.Orientation));
-		mat4 translation = glm::translate(mat4(), ovr::toGlm(op.Position));
-		return translation * orientation;
+		return rigid::poseToMatrix(toGlm(op.Orientation), toGlm(op.Position));
+	}
+
+	// The view matrix of a camera at this pose, inverse(toGlm(op)) without the general inverse
+	inline mat4 toView(const ovrPosef & op) {
+		return rigid::viewFromPose(toGlm(op.Orientation), toGlm(op.Position));
 	}
 
 	inline ovrMatrix4f fromGlm(const mat4 & m) {
@@ -454,6 +602,20 @@ namespace ovr {
 		result.w = q.w;
 		return result;
 	}
+
+	inline RigidPose toRigid(const ovrPosef & op) {
+		RigidPose result;
+		result.orientation = toGlm(op.Orientation);
+		result.position = toGlm(op.Position);
+		return result;
+	}
+
+	inline ovrPosef fromRigid(const RigidPose & pose) {
+		ovrPosef result;
+		result.Orientation = fromGlm(pose.orientation);
+		result.Position = fromGlm(pose.position);
+		return result;
+	}
 }
 
 class RiftManagerApp {
@@ -477,13 +639,32 @@ public:
 	}
 };
 
+// Uniform buffer binding the scene shader reads late-latched eye views from
+static const GLuint LATE_LATCH_BINDING = 0;
+
+// Everything rendering reads about the app, copied once per frame after the simulation
+// ticks. The renderer never looks at the globals above, only at this snapshot.
+struct FrameState {
+	bool x1{ true }, x2{ false }, x3{ false }, x4{ false };
+	bool a1{ true }, a2{ false }, a3{ false }, a4{ false }, a5{ false };
+	bool b1{ true }, b2{ false }, b3{ false }, b4{ false };
+	bool superRotation{ false };
+	bool smoothing{ false };
+	double iod{ 0.0 };
+	float pixelDensity{ 1.0f };
+	// keyboard toggles
+	bool hiddenAreaMask{ true };
+	bool lateLatch{ true };
+	bool occlusion{ true };
+	bool compositorSkybox{ false };
+	bool gpuCulling{ true };
+};
+
 class RiftApp : public GlfwApp, public RiftManagerApp {
 public:
 
 private:
-	GLuint _fbo{ 0 };
-	GLuint _depthBuffer{ 0 };
-	ovrTextureSwapChain _eyeTexture;
+	EyeRenderTargets _eyeTargets; // swap chain, one framebuffer per image, shared depth
 
 	GLuint _mirrorFbo{ 0 };
 	ovrMirrorTexture _mirrorTexture;
@@ -498,10 +679,219 @@ private:
 	uvec2 _renderTargetSize;
 	uvec2 _mirrorSize;
 
+	// Eye buffer pixels per display pixel at the lens centre, changed with [ and ].
+	// The keys set the request, which reaches the thread that renders in FrameState;
+	// that thread rebuilds the targets to match.
+	static constexpr float MIN_PIXEL_DENSITY = 0.5f;
+	static constexpr float MAX_PIXEL_DENSITY = 1.5f;
+	float _pixelDensity{ 1.0f };
+	float _builtPixelDensity{ 1.0f };
+
+	// Hidden area mask: lens-invisible pixels are written at the near plane first so
+	// every later fragment there fails the depth test. Toggled with the H key; the
+	// renderer sees the toggle in FrameState and keeps the last one it saw.
+	bool _hiddenAreaMask{ true };
+	bool _renderedHiddenAreaMask{ true };
+	GLuint _maskShader{ 0 };
+	GLuint _maskVao[2]{ 0, 0 };
+	GLuint _maskVbo[2]{ 0, 0 };
+	GLsizei _maskVertexCount[2]{ 0, 0 };
+	GLuint _maskQuery[2]{ 0, 0 };
+	bool _maskQueryPending[2]{ false, false };
+	float _maskCoverage[2]{ 0.0f, 0.0f }; // measured fraction of each eye viewport that is skipped
+	bool _maskReported{ false };
+
+	// Pipelined frame loop: the main thread polls input and updates frame N+1 while a
+	// render thread finishes frame N. The two hand the frame state over through
+	// _frameMutex, so update() and renderFrame() never run at the same time: update()
+	// also moves the scene graph and entity transforms renderFrame() draws from, which
+	// a second FrameState would not cover. The overlap is therefore update N+1 against
+	// frame N's ovr_EndFrame, mirror blit and swap and frame N+1's ovr_WaitToBeginFrame,
+	// not against its culling and GL issue.
+	bool _pipelined{ false };
+	std::mutex _frameMutex;
+	std::condition_variable _frameCondition;
+	unsigned int _updatedFrame{ 0 };  // last frame whose state update() has finished
+	unsigned int _consumedFrame{ 0 }; // last frame renderFrame() has finished reading
+	bool _stopRendering{ false };
+	bool _renderThreadRunning{ false };
+
+	// Jobs for the workers; GL jobs queued on it run at the start of renderFrame(), on
+	// whichever thread holds the context
+	JobSystem * _jobs{ nullptr };
+
+	// what renderFrame() hands to endFrame(), so update() may change the originals meanwhile
+	ovrLayerHeader * _underlay{ nullptr };
+	ovrViewScaleDesc _submittedViewScaleDesc;
+	std::string _submittedMode;
+	bool _dumpGpuTimings{ false };
+	bool _firstFrameSubmitted{ false };
+
+	// Compositor stats polled after every ovr_EndFrame, logged with the G key and on exit
+	PerfTelemetry _telemetry;
+
+	// Late latching: the eye views also live in this frame's slice of the frame ring.
+	// After every eye draw has been issued the head pose is sampled once more and the
+	// views are rewritten there, so the GPU picks up the newest pose when it executes,
+	// unless a fence shows it has already started them (best effort, see renderFrame).
+	// Only with a persistent mapping: through glBufferSubData the rewrite would be
+	// ordered after the draws. Toggled with the L key; the renderer sees the toggle in
+	// FrameState and reports and restarts its averages when it changes.
+	bool _lateLatch{ true };
+	bool _renderedLateLatch{ true };
+	bool _latchThisFrame{ false };
+	FrameRingBuffer::Range _latchRange;
+	double _latchGainSeconds{ 0.0 }; // summed time between the frame's first and late sample
+	unsigned int _latchCount{ 0 };
+	unsigned int _latchMissed{ 0 }; // frames whose draws the GPU had started before the late sample
+
+	// Occlusion culling: after the eyes are drawn their depth is reduced to coarse grids
+	// and read back without waiting. Each frame the newest grids are reprojected into
+	// the new eye views as depth pyramids, which cullScene() tests bounds against.
+	// Toggled with the O key.
+	static const unsigned int MAX_DEPTH_AGE = 4; // frames; older grids are not trusted
+	bool _occlusion{ true };
+	DepthReadback _depthReadback;
+	DepthGrid _depthGrids[2];
+	unsigned int _depthGridFrame{ 0 };
+	bool _haveDepthGrids{ false };
+	HiZBuffer _hiz[2];
+
+	// Touch controllers are sampled on their own thread; update() drains its events
+	InputSampler _inputSampler;
+	unsigned int _buttons{ 0 };
+	vec2 _thumbstick[2]{ vec2(0.0f), vec2(0.0f) };
+	InputEvent _nextInput;        // polled but sampled after the tick being run
+	bool _haveNextInput{ false };
+	double _inputLatencySeconds{ 0.0 };
+	unsigned int _inputLatencyCount{ 0 };
+
+	// The tracked head pose goes through these stages once per frame, before it is
+	// expanded to the eyes. They are switched on from the FrameState while rendering.
+	PosePipeline _posePipeline;
+	FreezePositionStage _freezePosition;
+	FreezeOrientationStage _freezeOrientation;
+	SuperRotationStage _superRotation;
+	SmoothingStage _smoothing;
+	bool _smoothPose{ false }; // toggled with the S key
+
+	// Simulation advances in fixed ticks, so rates don't depend on the (uncapped) frame rate
+	static constexpr double SIM_STEP = 1.0 / 90.0;
+	static constexpr double SIM_MAX_CATCH_UP = 0.25; // after a stall, drop time rather than spiral
+	static constexpr double IOD_SPEED = 0.9; // per second of right stick, 0.01 a 90 Hz tick
+	double _simTime{ 0.0 }; // ovr_GetTimeInSeconds() the simulation has been advanced to
+	FrameState _frameState; // written by update(), read-only while rendering
+
+protected:
+	GpuTimer _gpuTimer; // per-pass GPU timings, dumped with the G key
+
+	const PerfTelemetry & telemetry() const {
+		return _telemetry;
+	}
+
+	// The scene (x), view (a) and tracking (b) modes, as telemetry groups frames by them
+	static std::string modeName(const FrameState & state) {
+		const bool x[] = { state.x1, state.x2, state.x3, state.x4 };
+		const bool a[] = { state.a1, state.a2, state.a3, state.a4, state.a5 };
+		const bool b[] = { state.b1, state.b2, state.b3, state.b4 };
+		auto first = [](const bool * modes, int count) {
+			for (int i = 0; i < count; ++i) {
+				if (modes[i]) return std::to_string(i + 1);
+			}
+			return std::string("-");
+		};
+		return "x" + first(x, 4) + " a" + first(a, 5) + " b" + first(b, 4);
+	}
+
+	// Per-frame dynamic data: the latched views and the scene's instance transforms.
+	// Three frames of FRAME_RING_BYTES, persistently mapped where the driver allows.
+	static const GLsizeiptr FRAME_RING_BYTES = 4 << 20; // 64k model matrices a frame
+	FrameRingBuffer _frameRing;
+	GLint _uniformAlignment{ 256 };
+
+	// CPU-side temporaries of the frame being rendered, dropped two frames on
+	static const size_t FRAME_ARENA_BYTES = 1 << 20;
+	FrameArena _frameArena{ FRAME_ARENA_BYTES };
+
+	// Heap allocations the thread running renderFrame() makes between one call and the
+	// next, once the first HEAP_WARMUP_FRAMES are over. Run single threaded that thread
+	// also updates the app and polls events.
+	static const unsigned int HEAP_WARMUP_FRAMES = 90;
+	unsigned long long _heapAtFrameStart{ 0 };
+	unsigned long long _steadyHeapAllocations{ 0 };
+	unsigned int _steadyFrames{ 0 };
+	unsigned int _allocatingFrames{ 0 };
+
+	// This frame's depth pyramids, one per eye, or null with occlusion culling off.
+	// Only valid during cullScene().
+	const HiZBuffer * occlusionBuffers() const {
+		return _frameState.occlusion ? _hiz : nullptr;
+	}
+
+	const FrameState & frameState() const {
+		return _frameState;
+	}
+
+	const vec2 & thumbstick(int hand) const {
+		return _thumbstick[hand];
+	}
+
+	bool buttonDown(unsigned int button) const {
+		return (_buttons & button) != 0;
+	}
+
+	// One step of the simulation, dt seconds long (SIM_STEP from the tick loop). Rates are
+	// per second, so the tick length only changes how finely they are applied.
+	virtual void simulate(double dt) {
+		if (_thumbstick[ovrHand_Right].x > 0) {
+			if (iod < 0.3) iod += IOD_SPEED * dt;
+		}
+		else if (_thumbstick[ovrHand_Right].x < 0) {
+			if (iod > -0.1) iod -= IOD_SPEED * dt;
+		}
+		else if (_buttons & ovrButton_RThumb) {
+			iod = original_iod;
+		}
+	}
+
+	// Copies the simulated state rendering needs, once per frame after the ticks
+	virtual void publishFrameState(FrameState & state) {
+		state.x1 = x1; state.x2 = x2; state.x3 = x3; state.x4 = x4;
+		state.a1 = a1; state.a2 = a2; state.a3 = a3; state.a4 = a4; state.a5 = a5;
+		state.b1 = b1; state.b2 = b2; state.b3 = b3; state.b4 = b4;
+		state.superRotation = superRotation;
+		state.smoothing = _smoothPose;
+		state.iod = iod;
+		state.pixelDensity = _pixelDensity;
+		state.hiddenAreaMask = _hiddenAreaMask;
+		state.lateLatch = _lateLatch;
+		state.occlusion = _occlusion;
+	}
+
+	// Index of the latched eye view renderScene should use, or -1 for the view it was given
+	int latchedView(bool isLeft) const {
+		return _latchThisFrame ? (isLeft ? ovrEye_Left : ovrEye_Right) : -1;
+	}
+
 public:
 
+	// Choose between the serial and the pipelined frame loop before run()
+	void setPipelined(bool pipelined) {
+		_pipelined = pipelined;
+	}
+
+	// Spread per-frame and startup work over a job system's workers; serial without one
+	void setJobSystem(JobSystem * jobs) {
+		_jobs = jobs;
+	}
+
 	RiftApp() {
 		using namespace ovr;
+		_posePipeline.add(_freezePosition);
+		_posePipeline.add(_freezeOrientation);
+		_posePipeline.add(_superRotation);
+		_posePipeline.add(_smoothing);
+
 		_viewScaleDesc.HmdSpaceToWorldScaleInMeters = 1.0f;
 
 		memset(&_sceneLayer, 0, sizeof(ovrLayerEyeFov));
@@ -523,21 +913,44 @@ public:
 			
 			//cout << "original iod is: " << original_iod << endl;
 
-			ovrFovPort & fov = _sceneLayer.Fov[eye] = _eyeRenderDescs[eye].Fov;
-			auto eyeSize = ovr_GetFovTextureSize(_session, eye, fov, 1.0f);
+			_sceneLayer.Fov[eye] = _eyeRenderDescs[eye].Fov;
+		});
+		layoutEyeViewports(_pixelDensity);
+		// Make the on screen window 1/4 the resolution of the render target
+		_mirrorSize = _renderTargetSize;
+		_mirrorSize /= 2; // was 4 before
+
+	}
+
+protected:
+	// Sizes both eye viewports for a pixel density and packs them side by side into
+	// _renderTargetSize
+	void layoutEyeViewports(float density) {
+		_renderTargetSize = uvec2(0);
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			auto eyeSize = ovr_GetFovTextureSize(_session, eye, _sceneLayer.Fov[eye], density);
 			_sceneLayer.Viewport[eye].Size = eyeSize;
 			_sceneLayer.Viewport[eye].Pos = { (int)_renderTargetSize.x, 0 };
 
 			_renderTargetSize.y = std::max(_renderTargetSize.y, (uint32_t)eyeSize.h);
 			_renderTargetSize.x += eyeSize.w;
 		});
-		// Make the on screen window 1/4 the resolution of the render target
-		_mirrorSize = _renderTargetSize;
-		_mirrorSize /= 2; // was 4 before
+	}
 
+	// Rebuilds the eye targets if the requested pixel density changed. The old swap
+	// chain, framebuffers and depth texture are released before the new ones exist.
+	void applyPixelDensity(float density) {
+		if (density == _builtPixelDensity) {
+			return;
+		}
+		layoutEyeViewports(density);
+		_eyeTargets.create(_session, ovrSizei{ (int)_renderTargetSize.x, (int)_renderTargetSize.y });
+		_sceneLayer.ColorTexture[0] = _eyeTargets.swapChain();
+		_builtPixelDensity = density;
+		_maskReported = false;
+		LOG_INFO("pixel density %.1f, eye buffer %ux%u", density, _renderTargetSize.x, _renderTargetSize.y);
 	}
 
-protected:
 	GLFWwindow * createRenderingTarget(uvec2 & outSize, ivec2 & outPosition) override {
 		return glfw::createWindow(_mirrorSize);
 	}
@@ -548,46 +961,9 @@ protected:
 		// Disable the v-sync for buffer swap
 		glfwSwapInterval(0);
 
-		ovrTextureSwapChainDesc desc = {};
-		desc.Type = ovrTexture_2D;
-		desc.ArraySize = 1;
-		desc.Width = _renderTargetSize.x;
-		desc.Height = _renderTargetSize.y;
-		desc.MipLevels = 1;
-		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
-		desc.SampleCount = 1;
-		desc.StaticImage = ovrFalse;
-		ovrResult result = ovr_CreateTextureSwapChainGL(_session, &desc, &_eyeTexture);
-		_sceneLayer.ColorTexture[0] = _eyeTexture;
-		if (!OVR_SUCCESS(result)) {
-			FAIL("Failed to create swap textures");
-		}
-
-		int length = 0;
-		result = ovr_GetTextureSwapChainLength(_session, _eyeTexture, &length);
-		if (!OVR_SUCCESS(result) || !length) {
-			FAIL("Unable to count swap chain textures");
-		}
-		for (int i = 0; i < length; ++i) {
-			GLuint chainTexId;
-			ovr_GetTextureSwapChainBufferGL(_session, _eyeTexture, i, &chainTexId);
-			glBindTexture(GL_TEXTURE_2D, chainTexId);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		}
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		// Set up the framebuffer object
-		glGenFramebuffers(1, &_fbo);
-		glGenRenderbuffers(1, &_depthBuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-		glBindRenderbuffer(GL_RENDERBUFFER, _depthBuffer);
-		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, _renderTargetSize.x, _renderTargetSize.y);
-		glBindRenderbuffer(GL_RENDERBUFFER, 0);
-		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _depthBuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		_eyeTargets.create(_session, ovrSizei{ (int)_renderTargetSize.x, (int)_renderTargetSize.y });
+		_sceneLayer.ColorTexture[0] = _eyeTargets.swapChain();
+		LOG_INFO("eye buffer %ux%u, %u framebuffers", _renderTargetSize.x, _renderTargetSize.y, _eyeTargets.count());
 
 		ovrMirrorTextureDesc mirrorDesc;
 		memset(&mirrorDesc, 0, sizeof(mirrorDesc));
@@ -599,168 +975,423 @@ protected:
 		}
 		glGenFramebuffers(1, &_mirrorFbo);
 
+		buildHiddenAreaMask();
+		initFrameRing();
+		_depthReadback.init("shader_hiz.vert", "shader_hiz.frag");
+
+		_inputSampler.start(_session, 500.0);
 	}
 
-	void update() final override
-	{
-		ovrInputState inputState;
-		if (OVR_SUCCESS(ovr_GetInputState(_session, ovrControllerType_Touch, &inputState)))
-		{
-			// reset booleans
-			cube_size_up = false;
-			cube_size_down = false;
-			cube_size_reset = false;
-
-			// Logic to vary interocular distance
-			if (inputState.Thumbstick[ovrHand_Right].x > 0) {
-				//cout << "iod up" << endl;
-				iod_up = true;
-			}
-			else if (inputState.Thumbstick[ovrHand_Right].x < 0) {
-				//cout << "iod down" << endl;
-				iod_down = true;
-			}
-			else if (inputState.Buttons & ovrButton_RThumb) {
-				//cout << "iod reset" << endl;
-				iod_reset = true;
-			}
+	void initFrameRing() {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &_uniformAlignment);
+		_frameRing.init(FRAME_RING_BYTES);
+		if (!_frameRing.persistent()) {
+			LOG_INFO("ARB_buffer_storage unavailable, per-frame data goes through glBufferSubData");
+			// a write after the draws are queued would land after them too
+			LOG_WARN("late latching is off: it needs a persistently mapped frame ring");
+		}
+	}
 
-			////////////////////////
-			// Logic to resize cubes
-			if (inputState.Thumbstick[ovrHand_Left].x < 0) {
-				//cout << "left thumbstick to the left" << endl;
-				cube_size_down = true;
-				//cube_size_up = false;
-			}
-			else if (inputState.Thumbstick[ovrHand_Left].x > 0) { 
-				//cout << "left thumbstick to the right" << endl; 
-				cube_size_up = true;
-				//cube_size_down = false;
-			}
-			else if (inputState.Buttons && ovrButton_LThumb) {
-				//cout << "left thubstick pressed in" << endl;
-				cube_size_reset = true;
-			}
+	void writeLatchedViews(const ovrPosef eyePoses[2]) {
+		mat4 views[2] = {
+			ovr::toView(eyePoses[ovrEye_Left]),
+			ovr::toView(eyePoses[ovrEye_Right])
+		};
+		_frameRing.write(_latchRange, views, sizeof(views));
+	}
 
+	// Picks up the newest depth grids read back and reprojects them into this frame's
+	// eye views. The pyramids are cleared when there is nothing recent enough.
+	void buildOcclusionPyramids(const mat4 viewProjections[2]) {
+		unsigned int gridFrame = 0;
+		if (_depthReadback.collect(_depthGrids, gridFrame)) {
+			_depthGridFrame = gridFrame;
+			_haveDepthGrids = true;
+		}
+		bool usable = _frameState.occlusion && _haveDepthGrids && frame - _depthGridFrame <= MAX_DEPTH_AGE;
+		if (!usable) {
+			_hiz[0].clear();
+			_hiz[1].clear();
+			return;
+		}
+		if (!_jobs) {
+			_hiz[0].build(_depthGrids[0], viewProjections[0]);
+			_hiz[1].build(_depthGrids[1], viewProjections[1]);
+			return;
+		}
+		// the eyes share nothing, so the right one is built by a worker meanwhile
+		JobSystem::Counter rightEye;
+		_jobs->run([&] { _hiz[1].build(_depthGrids[1], viewProjections[1]); }, &rightEye);
+		_hiz[0].build(_depthGrids[0], viewProjections[0]);
+		_jobs->wait(rightEye);
+	}
 
-			if (!inputState.Buttons) {
-				isPressed = false;
-			}
+	void reportLateLatch() {
+		if (_latchCount) {
+			LOG_INFO("late latch: head pose sampled %.3f ms closer to scan-out on average over %u frames",
+				_latchGainSeconds / _latchCount * 1000.0, _latchCount);
+		}
+		if (_latchMissed) {
+			LOG_INFO("late latch: %u frames kept their first sample, the GPU had started drawing them", _latchMissed);
+		}
+	}
 
-			///////////////////////////////
-			// Logic to cycle between five modes with the 'A' button
-			if ((inputState.Buttons & ovrButton_A) && !isPressed) { 
-				//cout << "Button A pressed" << endl;
-				isPressed = true;
+	void reportFrameRing() {
+		LOG_INFO("frame ring: %u of %u frames waited for the GPU, %.3f ms in total; %u allocations did not fit",
+			_frameRing.stalledFrames(), _frameRing.fencedFrames(), _frameRing.stallSeconds() * 1000.0, _frameRing.overflowCount());
+		if (_frameRing.timedOutFrames()) {
+			LOG_WARN("frame ring: %u frames gave up waiting for the GPU and skipped their region", _frameRing.timedOutFrames());
+		}
+	}
 
-				if (a1) {
-					a1 = false;
-					a2 = true;
-					//cout << "monoscopic mode (left eye image rendered on both eyes)" << endl;
-				}
-				else if (a2) {
-					a2 = false;
-					a3 = true;
-					//cout << "only rendering to left eye" << endl;
-				}
-				else if (a3) {
-					a3 = false;
-					a4 = true;
-					//cout << "only rendering to right eye" << endl;
-				}
-				else if (a4) {
-					a4 = false;
-					a5 = true;
-					//cout << "inverted stereo mode" << endl;
-				}
-				else if (a5) {
-					a1 = true;
-					a5 = false;
-					//cout << "back to default mode" << endl;
+	// Called at the top of every renderFrame(), so a frame runs from one call to the next.
+	// Without the allocation audit there is nothing to count and nothing is reported.
+	void countHeapAllocations() {
+#if HEAP_AUDIT
+		const unsigned long long heap = threadHeapAllocations;
+		if (frame > HEAP_WARMUP_FRAMES) {
+			const unsigned long long allocations = heap - _heapAtFrameStart;
+			_steadyHeapAllocations += allocations;
+			++_steadyFrames;
+			if (allocations) ++_allocatingFrames;
+		}
+		_heapAtFrameStart = heap;
+#endif
+	}
+
+	void reportFrameMemory() {
+		LOG_INFO("frame arena: peak %u of %u bytes a frame, %llu allocations, %llu from the heap, grown %u times",
+			(unsigned int)_frameArena.peakBytes(), (unsigned int)_frameArena.capacity(), _frameArena.allocationCount(),
+			_frameArena.overflowCount(), _frameArena.growCount());
+		if (_steadyFrames) {
+			LOG_INFO("heap: %llu allocations in %u of the %u frames after the first %u (%.2f a frame)",
+				_steadyHeapAllocations, _allocatingFrames, _steadyFrames, HEAP_WARMUP_FRAMES,
+				(double)_steadyHeapAllocations / _steadyFrames);
+		}
+	}
+
+	void shutdownGl() override {
+		_inputSampler.stop();
+		if (_inputLatencyCount) {
+			LOG_INFO("button presses applied %.3f ms after they were sampled on average",
+				_inputLatencySeconds / _inputLatencyCount * 1000.0);
+		}
+		if (_inputSampler.droppedEvents()) {
+			LOG_WARN("%u controller events were dropped", _inputSampler.droppedEvents());
+		}
+		glDeleteVertexArrays(2, _maskVao);
+		glDeleteBuffers(2, _maskVbo);
+		glDeleteQueries(2, _maskQuery);
+		glDeleteProgram(_maskShader);
+		_depthReadback.release();
+		reportFrameRing();
+		_frameRing.release();
+		reportFrameMemory();
+		reportLateLatch();
+		_eyeTargets.release();
+		logGpuTimings();
+		logTelemetry(true);
+		_gpuTimer.release();
+		GlfwApp::shutdownGl();
+	}
+
+	void logGpuTimings() {
+		std::ostringstream report;
+		_gpuTimer.dump(report);
+		logging::lines(LOG_LEVEL_INFO, report.str());
+	}
+
+	void logTelemetry(bool perMode) {
+		if (_telemetry.empty()) {
+			return;
+		}
+		std::ostringstream report;
+		_telemetry.dump(report, perMode);
+		logging::lines(LOG_LEVEL_INFO, report.str());
+	}
+
+	// Triangles covering the parts of each eye viewport the lens never shows, in NDC
+	std::vector<vec2> hiddenAreaMesh(ovrEyeType eye) {
+		std::vector<vec2> triangles;
+		const ovrFovPort & fov = _sceneLayer.Fov[eye];
+
+#if (OVR_MAJOR_VERSION > 1) || (OVR_MINOR_VERSION >= 26)
+		ovrFovStencilDesc desc = {};
+		desc.StencilType = ovrFovStencil_HiddenArea;
+		desc.StencilFlags = ovrFovStencilFlag_MeshOriginAtBottomLeft;
+		desc.Eye = eye;
+		desc.FovPort = fov;
+		desc.HmdToEyeRotation = _eyeRenderDescs[eye].HmdToEyePose.Orientation;
+
+		ovrFovStencilMeshBuffer mesh = {};
+		if (OVR_SUCCESS(ovr_GetFovStencil(_session, &desc, &mesh)) && mesh.UsedIndexCount > 0) {
+			std::vector<ovrVector2f> vertices(mesh.UsedVertexCount);
+			std::vector<uint16_t> indices(mesh.UsedIndexCount);
+			mesh.AllocVertexCount = mesh.UsedVertexCount;
+			mesh.VertexBuffer = vertices.data();
+			mesh.AllocIndexCount = mesh.UsedIndexCount;
+			mesh.IndexBuffer = indices.data();
+			if (OVR_SUCCESS(ovr_GetFovStencil(_session, &desc, &mesh))) {
+				for (int i = 0; i < mesh.UsedIndexCount; ++i) {
+					// stencil vertices are in [0, 1] viewport coordinates
+					triangles.push_back(ovr::toGlm(vertices[indices[i]]) * 2.0f - 1.0f);
 				}
+				return triangles;
 			}
+		}
+#endif
+
+		// This runtime has no ovr_GetFovStencil, so approximate the visible area by the
+		// circle around the optical axis that reaches the widest FOV edge in tangent space.
+		// Only the corners beyond it are masked, which keeps the mask conservative.
+		float radius = std::max(std::max(fov.UpTan, fov.DownTan), std::max(fov.LeftTan, fov.RightTan));
+		auto toNdc = [&](float angle, float r) {
+			vec2 tan = vec2(cosf(angle), sinf(angle)) * r;
+			return vec2(
+				(tan.x + fov.LeftTan) / (fov.LeftTan + fov.RightTan) * 2.0f - 1.0f,
+				(tan.y + fov.DownTan) / (fov.UpTan + fov.DownTan) * 2.0f - 1.0f);
+		};
+		const int segments = 64;
+		for (int i = 0; i < segments; ++i) {
+			float a0 = 2.0f * pi * i / segments;
+			float a1 = 2.0f * pi * (i + 1) / segments;
+			vec2 inner0 = toNdc(a0, radius), inner1 = toNdc(a1, radius);
+			vec2 outer0 = toNdc(a0, radius * 2.0f), outer1 = toNdc(a1, radius * 2.0f);
+			triangles.insert(triangles.end(), { inner0, outer0, outer1, outer1, inner1, inner0 });
+		}
+		return triangles;
+	}
 
-			///////////////////////////////
-			// Logic to cycle between five modes with the 'X' button
-			else if ((inputState.Buttons & ovrButton_X) && !isPressed) {
+	void buildHiddenAreaMask() {
+		_maskShader = LoadShaders("shader_mask.vert", "shader_mask.frag");
+		glGenVertexArrays(2, _maskVao);
+		glGenBuffers(2, _maskVbo);
+		glGenQueries(2, _maskQuery);
 
-				isPressed = true;
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			std::vector<vec2> triangles = hiddenAreaMesh(eye);
+			_maskVertexCount[eye] = (GLsizei)triangles.size();
+
+			glBindVertexArray(_maskVao[eye]);
+			glBindBuffer(GL_ARRAY_BUFFER, _maskVbo[eye]);
+			glBufferData(GL_ARRAY_BUFFER, triangles.size() * sizeof(vec2), triangles.data(), GL_STATIC_DRAW);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (GLvoid*)0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glBindVertexArray(0);
+		});
+	}
 
-				if (x1) {
-					x1 = false;
-					x2 = true;
-					cout << "showing just the sky box in stereo" << endl;
-				}
-				else if (x2) {
-					x2 = false;
-					x3 = true;
-					cout << "showing just the sky box in mono" << endl;
-				}
-				else if (x3) {
-					x3 = false;
-					x4 = true;
-					cout << "showing my room" << endl;
-				}
-				else if (x4) {
-					x4 = false;
-					x1 = true;
-					cout << "showing the entire scene" << endl;
-				}							
+	// Writes the hidden area at the near plane of the current eye viewport. The number of
+	// samples written is counted with an occlusion query and read back on a later frame.
+	void drawHiddenAreaMask(ovrEyeType eye) {
+		if (!_frameState.hiddenAreaMask || !_maskVertexCount[eye]) {
+			return;
+		}
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_ALWAYS);
+		glDisable(GL_CULL_FACE);
+		glUseProgram(_maskShader);
+		glBindVertexArray(_maskVao[eye]);
+
+		bool measure = !_maskQueryPending[eye];
+		if (measure) {
+			glBeginQuery(GL_SAMPLES_PASSED, _maskQuery[eye]);
+		}
+		glDrawArrays(GL_TRIANGLES, 0, _maskVertexCount[eye]);
+		if (measure) {
+			glEndQuery(GL_SAMPLES_PASSED);
+			_maskQueryPending[eye] = true;
+		}
+
+		glBindVertexArray(0);
+		glDepthFunc(GL_LESS);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
+
+	// Non-blocking readback of the mask occlusion queries
+	void collectHiddenAreaCoverage() {
+		ovr::for_each_eye([&](ovrEyeType eye) {
+			if (!_maskQueryPending[eye]) {
+				return;
+			}
+			GLuint available = 0;
+			glGetQueryObjectuiv(_maskQuery[eye], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return;
 			}
+			GLuint samples = 0;
+			glGetQueryObjectuiv(_maskQuery[eye], GL_QUERY_RESULT, &samples);
+			const auto& vp = _sceneLayer.Viewport[eye];
+			_maskCoverage[eye] = (float)samples / (float)(vp.Size.w * vp.Size.h);
+			_maskQueryPending[eye] = false;
+		});
 
-			///////////////////////////////
-			// Logic to cycle between four head tracking modes with the 'B' button
-			else if ((inputState.Buttons & ovrButton_B) && !isPressed) {
+		if (_frameState.hiddenAreaMask && !_maskReported && !_maskQueryPending[0] && !_maskQueryPending[1] && _maskCoverage[0] > 0.0f) {
+			_maskReported = true;
+			LOG_INFO("hidden area mask skips %.1f%% of the left eye and %.1f%% of the right eye pixels",
+				_maskCoverage[ovrEye_Left] * 100.0f, _maskCoverage[ovrEye_Right] * 100.0f);
+		}
+	}
 
-				isPressed = true;
+	void update() final override
+	{
+		PROFILE_ZONE("RiftApp::update");
+
+		// Events come from the input thread in the order they were sampled, on the clock
+		// the ticks run on, and each tick sees the buttons and sticks as they were sampled
+		// by its end, so every press is applied exactly once whatever the frame rate
+		double now = ovr_GetTimeInSeconds();
+		if (_simTime == 0.0 || now - _simTime > SIM_MAX_CATCH_UP) {
+			_simTime = now - SIM_STEP;
+		}
+		{
+			PROFILE_ZONE("simulate");
+			while (_simTime + SIM_STEP <= now) {
+				applyInputUntil(_simTime + SIM_STEP);
+				simulate(SIM_STEP);
+				_simTime += SIM_STEP;
+			}
+		}
+		// what came after the last tick still counts for this frame's state
+		applyInputUntil(now);
 
-				if (b1) {
-					b1 = false;
-					b2 = true;
-					cout << "orientation only (position frozen to what it just was before the mode was selected)" << endl;
-				}
-				else if (b2) {
-					b2 = false;
-					b3 = true;
-					cout << "position only (orientation frozen to what it just was)" << endl;
-				}
-				else if (b3) {
-					b3 = false;
-					b4 = true;
-					cout << "no tracking (position and orientation frozen to what they just were when the user pressed the button)" << endl;
-				}
-				else if (b4) {
-					b4 = false;
-					b1 = true;
-					cout << "regular tracking (both position and orientation)" << endl;
+		publishFrameState(_frameState);
+	}
+
+	// Applies the queued events sampled at or before time; a later one waits in _nextInput
+	void applyInputUntil(double time) {
+		while (_haveNextInput || (_haveNextInput = _inputSampler.poll(_nextInput))) {
+			if (_nextInput.time > time) {
+				return;
+			}
+			applyInput(_nextInput);
+			_haveNextInput = false;
+		}
+	}
+
+	void applyInput(const InputEvent & e) {
+		switch (e.type) {
+		case InputEvent::Thumbstick:
+			_thumbstick[e.hand] = vec2(e.x, e.y);
+			break;
+		case InputEvent::ButtonUp:
+			_buttons &= ~e.button;
+			break;
+		case InputEvent::ButtonDown:
+			_buttons |= e.button;
+			onButtonPressed(e.button, e.time);
+			break;
+		case InputEvent::Resync: {
+			// events were dropped: take the whole state, pressing what went down meanwhile
+			unsigned int pressed = e.button & ~_buttons;
+			_buttons = e.button;
+			for (unsigned int bit = 1; pressed; bit <<= 1) {
+				if (pressed & bit) {
+					pressed &= ~bit;
+					onButtonPressed(bit, e.time);
 				}
+			}
+			_thumbstick[ovrHand_Left] = vec2(e.sticks[ovrHand_Left].x, e.sticks[ovrHand_Left].y);
+			_thumbstick[ovrHand_Right] = vec2(e.sticks[ovrHand_Right].x, e.sticks[ovrHand_Right].y);
+			break;
+		}
+		}
+	}
+
+	// Cycles the A/X/B/Y modes; time is when the controller sample saw the press
+	void onButtonPressed(unsigned int button, double time) {
+		///////////////////////////////
+		// Logic to cycle between five modes with the 'A' button
+		if (button == ovrButton_A) {
+			if (a1) {
+				a1 = false;
+				a2 = true;
+				LOG_DEBUG("monoscopic mode (left eye image rendered on both eyes)");
+			}
+			else if (a2) {
+				a2 = false;
+				a3 = true;
+				LOG_DEBUG("only rendering to left eye");
+			}
+			else if (a3) {
+				a3 = false;
+				a4 = true;
+				LOG_DEBUG("only rendering to right eye");
+			}
+			else if (a4) {
+				a4 = false;
+				a5 = true;
+				LOG_DEBUG("inverted stereo mode");
+			}
+			else if (a5) {
+				a1 = true;
+				a5 = false;
+				LOG_DEBUG("back to default mode");
+			}
+		}
 
+		///////////////////////////////
+		// Logic to cycle between five modes with the 'X' button
+		else if (button == ovrButton_X) {
+			if (x1) {
+				x1 = false;
+				x2 = true;
+				LOG_INFO("showing just the sky box in stereo");
+			}
+			else if (x2) {
+				x2 = false;
+				x3 = true;
+				LOG_INFO("showing just the sky box in mono");
 			}
-			else if ((inputState.Buttons & ovrButton_Y) && !isPressed) {
-				isPressed = true;
-				if (superRotation) superRotation = false;
-				else superRotation = true;
+			else if (x3) {
+				x3 = false;
+				x4 = true;
+				LOG_INFO("showing my room");
 			}
+			else if (x4) {
+				x4 = false;
+				x1 = true;
+				LOG_INFO("showing the entire scene");
+			}
+		}
 
-			/////////////
-			// change iod
-			if (iod_up && iod < 0.3) {
-				iod += 0.01;
+		///////////////////////////////
+		// Logic to cycle between four head tracking modes with the 'B' button
+		else if (button == ovrButton_B) {
+			if (b1) {
+				b1 = false;
+				b2 = true;
+				LOG_INFO("orientation only (position frozen to what it just was before the mode was selected)");
+			}
+			else if (b2) {
+				b2 = false;
+				b3 = true;
+				LOG_INFO("position only (orientation frozen to what it just was)");
 			}
-			else if (iod_down && iod > -0.1) {
-				iod -= 0.01;
+			else if (b3) {
+				b3 = false;
+				b4 = true;
+				LOG_INFO("no tracking (position and orientation frozen to what they just were when the user pressed the button)");
 			}
-			else if (iod_reset) {
-				iod = original_iod;
+			else if (b4) {
+				b4 = false;
+				b1 = true;
+				LOG_INFO("regular tracking (both position and orientation)");
 			}
-			_viewScaleDesc.HmdToEyePose[0].Position.x = (float)(-iod / 2);
-			_viewScaleDesc.HmdToEyePose[1].Position.x = (float)(iod / 2);
+		}
+		else if (button == ovrButton_Y) {
+			superRotation = !superRotation;
+		}
+		else {
+			return;
 		}
 
-		// reset booleans
-		iod_up = false;
-		iod_down = false;
-		iod_reset = false;
+		// how long the press waited between being sampled and being applied
+		_inputLatencySeconds += ovr_GetTimeInSeconds() - time;
+		++_inputLatencyCount;
 	}
 
 	void onKey(int key, int scancode, int action, int mods) override {
@@ -768,16 +1399,176 @@ protected:
 		case GLFW_KEY_R:
 			ovr_RecenterTrackingOrigin(_session);
 			return;
+		case GLFW_KEY_H:
+			_hiddenAreaMask = !_hiddenAreaMask;
+			LOG_INFO(_hiddenAreaMask ? "hidden area mask on" : "hidden area mask off");
+			return;
+		case GLFW_KEY_G:
+			_dumpGpuTimings = true; // the timer belongs to whichever thread renders
+			return;
+		case GLFW_KEY_S:
+			_smoothPose = !_smoothPose;
+			LOG_INFO(_smoothPose ? "head pose smoothing on" : "head pose smoothing off");
+			return;
+		case GLFW_KEY_O:
+			_occlusion = !_occlusion;
+			LOG_INFO(_occlusion ? "occlusion culling on" : "occlusion culling off");
+			return;
+		case GLFW_KEY_LEFT_BRACKET:
+		case GLFW_KEY_RIGHT_BRACKET:
+			_pixelDensity = glm::clamp(_pixelDensity + (key == GLFW_KEY_RIGHT_BRACKET ? 0.1f : -0.1f), MIN_PIXEL_DENSITY, MAX_PIXEL_DENSITY);
+			return;
+		case GLFW_KEY_L:
+			_lateLatch = !_lateLatch;
+			LOG_INFO(_lateLatch ? "late latching on" : "late latching off");
+			return;
 		}
 
 		GlfwApp::onKey(key, scancode, action, mods);
 	}
 
+	void runLoop() override {
+		if (!_pipelined) {
+			LOG_INFO("serial frame loop");
+			GlfwApp::runLoop();
+			return;
+		}
+
+		LOG_INFO("pipelined frame loop");
+
+		// GL moves to the render thread, the window and input stay here
+		glfwMakeContextCurrent(nullptr);
+		_stopRendering = false;
+		_renderThreadRunning = true;
+		std::thread renderThread([&] { renderThreadMain(); });
+
+		unsigned int updated = 0;
+		while (!glfwWindowShouldClose(window)) {
+			PROFILE_ZONE("frame");
+			{
+				PROFILE_ZONE("glfwPollEvents");
+				glfwPollEvents();
+			}
+			update();
+
+			std::unique_lock<std::mutex> lock(_frameMutex);
+			_updatedFrame = ++updated;
+			_frameCondition.notify_all();
+			// don't touch the state or the scene again until the renderer has issued its draws
+			_frameCondition.wait(lock, [&] { return _consumedFrame >= updated || !_renderThreadRunning; });
+			if (!_renderThreadRunning) {
+				break;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_frameMutex);
+			_stopRendering = true;
+			_frameCondition.notify_all();
+		}
+		renderThread.join();
+		glfwMakeContextCurrent(window);
+		if (_jobs) _jobs->bindGlThread();
+	}
+
+	void renderThreadMain() {
+		PROFILE_THREAD("render");
+		glfwMakeContextCurrent(window);
+		if (_jobs) _jobs->bindGlThread();
+		try {
+			while (true) {
+				PROFILE_ZONE("render frame");
+				++frame;
+				// blocks on compositor pacing while the main thread is updating this frame
+				beginFrame();
+				{
+					std::unique_lock<std::mutex> lock(_frameMutex);
+					_frameCondition.wait(lock, [&] { return _updatedFrame >= frame || _stopRendering; });
+					if (_stopRendering) {
+						break;
+					}
+				}
+				renderFrame();
+				{
+					std::lock_guard<std::mutex> lock(_frameMutex);
+					_consumedFrame = frame;
+					_frameCondition.notify_all();
+				}
+				endFrame();
+				{
+					PROFILE_ZONE("finishFrame");
+					finishFrame();
+				}
+			}
+		}
+		catch (std::exception & error) {
+			LOG_ERROR("%s", error.what());
+		}
+		glfwMakeContextCurrent(nullptr);
+
+		std::lock_guard<std::mutex> lock(_frameMutex);
+		_renderThreadRunning = false;
+		_frameCondition.notify_all();
+	}
+
 	void draw() final override {
+		PROFILE_ZONE("RiftApp::draw");
+		beginFrame();
+		renderFrame();
+		endFrame();
+	}
+
+	// Waits until the compositor wants frame `frame`, then starts it
+	void beginFrame() {
+		{
+			PROFILE_ZONE("ovr_WaitToBeginFrame");
+			ovr_WaitToBeginFrame(_session, frame);
+		}
+		PROFILE_ZONE("ovr_BeginFrame");
+		ovr_BeginFrame(_session, frame);
+	}
+
+	// Reads the tracking and app state and issues every eye's draws
+	void renderFrame() {
+		PROFILE_ZONE("renderFrame");
+		const FrameState & state = _frameState;
 
-		// Query Touch controllers. Query their parameters:
-		double displayMidpointSeconds = ovr_GetPredictedDisplayTime(_session, 0);
-		ovrTrackingState trackState = ovr_GetTrackingState(_session, displayMidpointSeconds, ovrTrue);
+		countHeapAllocations();
+		if (_jobs) {
+			PROFILE_ZONE("GL jobs");
+			_jobs->runGlJobs();
+		}
+		_frameArena.beginFrame();
+		_gpuTimer.beginFrame();
+		if (_dumpGpuTimings) {
+			_dumpGpuTimings = false;
+			logGpuTimings();
+			logTelemetry(false);
+			reportFrameMemory();
+			logSceneStats();
+		}
+		if (state.lateLatch != _renderedLateLatch) {
+			_renderedLateLatch = state.lateLatch;
+			reportLateLatch();
+			_latchGainSeconds = 0.0;
+			_latchCount = 0;
+			_latchMissed = 0;
+		}
+		if (state.hiddenAreaMask != _renderedHiddenAreaMask) {
+			_renderedHiddenAreaMask = state.hiddenAreaMask;
+			_maskReported = false;
+		}
+		collectHiddenAreaCoverage();
+
+		// One tracking sample per frame, predicted for this frame's display time.
+		// Head, eye and controller poses below all come from it.
+		double displayMidpointSeconds = ovr_GetPredictedDisplayTime(_session, frame);
+		double sensorSampleTime = ovr_GetTimeInSeconds();
+		ovrTrackingState trackState;
+		{
+			PROFILE_ZONE("ovr_GetTrackingState");
+			trackState = ovr_GetTrackingState(_session, displayMidpointSeconds, ovrTrue);
+		}
 
 		// Process controller status. Useful to know if controller is being used at all, and if the cameras can see it. 
 		// Bits reported:
@@ -803,125 +1594,459 @@ protected:
 		//cerr << "left hand position  = " << handPosition[ovrHand_Left].x << ", " << handPosition[ovrHand_Left].y << ", " << handPosition[ovrHand_Left].z << endl;
 		//cerr << "right hand position = " << handPosition[ovrHand_Right].x << ", " << handPosition[ovrHand_Right].y << ", " << handPosition[ovrHand_Right].z << endl;
 		/////////////////////////////////////////
+		{
+			PROFILE_ZONE("handPoses");
+			handPosesUpdated(handPoses, handStatus);
+		}
 
+		_viewScaleDesc.HmdToEyePose[0].Position.x = (float)(-state.iod / 2);
+		_viewScaleDesc.HmdToEyePose[1].Position.x = (float)(state.iod / 2);
+
+		// The compositor gets the tracked eye poses, so timewarp only corrects for motion
+		// since the sample and a frozen or super-rotated view stays that way
+		ovrPosef trackedEyePoses[2];
+		ovr_CalcEyePoses(trackState.HeadPose.ThePose, _viewScaleDesc.HmdToEyePose, trackedEyePoses);
+		_sceneLayer.SensorSampleTime = sensorSampleTime;
+
+		// The scene is drawn from the processed head pose: one pass through the
+		// pipeline for the head, then the usual eye offsets
+		_freezePosition.enabled = state.b2 || state.b4;
+		_freezeOrientation.enabled = state.b3 || state.b4;
+		_superRotation.enabled = state.superRotation;
+		_smoothing.enabled = state.smoothing;
+		RigidPose headPose = _posePipeline.process(ovr::toRigid(trackState.HeadPose.ThePose), sensorSampleTime);
 		ovrPosef eyePoses[2];
-		ovr_GetEyePoses(_session, frame, true, _viewScaleDesc.HmdToEyePose, eyePoses, &_sceneLayer.SensorSampleTime);
+		ovr_CalcEyePoses(ovr::fromRigid(headPose), _viewScaleDesc.HmdToEyePose, eyePoses);
+		const mat4 eyeTransforms[2] = { ovr::toGlm(eyePoses[ovrEye_Left]), ovr::toGlm(eyePoses[ovrEye_Right]) };
+		const mat4 eyeViewProjections[2] = {
+			_eyeProjections[ovrEye_Left] * rigid::inverse(eyeTransforms[ovrEye_Left]),
+			_eyeProjections[ovrEye_Right] * rigid::inverse(eyeTransforms[ovrEye_Right])
+		};
+
+		// the region was last read three frames ago, long done in practice
+		_frameRing.beginFrame();
+		_latchRange = _frameRing.allocate(2 * sizeof(mat4), _uniformAlignment);
+		// empty when the ring gave up waiting on this frame's region
+		_latchThisFrame = state.lateLatch && _frameRing.persistent() && _latchRange;
+		if (_latchRange) {
+			writeLatchedViews(eyePoses);
+			glBindBufferRange(GL_UNIFORM_BUFFER, LATE_LATCH_BINDING, _frameRing.buffer(), _latchRange.offset, _latchRange.size);
+		}
 
-		///////////////////////////////
-		///// head positions this frame
-		headPos_left_curr = ovr::toGlm(eyePoses[ovrEye_Left]);
-		headPos_right_curr = ovr::toGlm(eyePoses[ovrEye_Right]);
-		
-		/////////
-		// do nothing on regular tracking mode (b1)
-
-		if (b2) {
-			// orientation only
-			// position frozen to last frame
-			headPos_left_curr[3] = headPos_left_prev[3];
-			headPos_right_curr[3] = headPos_right_prev[3];
-		}
-		else if (b3) {
-			// position only
-			// orientation frozen to last frame
-			headPos_left_curr[0] = headPos_left_prev[0];
-			headPos_left_curr[1] = headPos_left_prev[1];
-			headPos_left_curr[2] = headPos_left_prev[2];
-
-			headPos_right_curr[0] = headPos_right_prev[0];
-			headPos_right_curr[1] = headPos_right_prev[1];
-			headPos_right_curr[2] = headPos_right_prev[2];
-		}
-		else if (b4) {
-			// no tracking
-			// position and orientation frozen to last frame
-			headPos_left_curr = headPos_left_prev;
-			headPos_right_curr = headPos_right_prev;
-		}
-
-		int curIndex;
-		ovr_GetTextureSwapChainCurrentIndex(_session, _eyeTexture, &curIndex);
-		GLuint curTexId;
-		ovr_GetTextureSwapChainBufferGL(_session, _eyeTexture, curIndex, &curTexId);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curTexId, 0);
-		
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		{
+			PROFILE_ZONE("occlusion pyramids");
+			buildOcclusionPyramids(eyeViewProjections);
+		}
+		{
+			PROFILE_ZONE("cullScene");
+			cullScene(_eyeProjections, eyeTransforms);
+		}
+
+		applyPixelDensity(state.pixelDensity);
+		_eyeTargets.bind();
+
+		_underlay = underlayLayer();
+		unsigned int clearPass = _gpuTimer.begin("clear");
+		if (_underlay) {
+			// let the compositor layer underneath show through wherever nothing is drawn
+			GLfloat clearColor[4];
+			glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+		}
+		else {
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+		_gpuTimer.end(clearPass);
+
+		// Signals once the GPU gets to the eye draws, the first commands to read the latched views
+		GLsync drawsStarted = _latchThisFrame ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : nullptr;
 
 		/////// LOOK OVER HERE
 		ovr::for_each_eye([&](ovrEyeType eye) {
 			const auto& vp = _sceneLayer.Viewport[eye];
 			glViewport(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
-			_sceneLayer.RenderPose[eye] = eyePoses[eye];
+			_sceneLayer.RenderPose[eye] = trackedEyePoses[eye];
+			drawHiddenAreaMask(eye);
 			
-			if (a1) {
+			if (state.a1) {
 				//renderScene(_eyeProjections[eye], ovr::toGlm(eyePoses[eye]));  // cse190: this is for normal stereo rendering
 
 				// call renderScene() twice one time for each eye
 				if (eye == ovrEye_Left) {
 					//renderScene(_eyeProjections[ovrEye_Left], ovr::toGlm(eyePoses[ovrEye_Left]), true);
-					renderScene(_eyeProjections[ovrEye_Left], headPos_left_curr, true);
+					renderScene(_eyeProjections[ovrEye_Left], eyeTransforms[ovrEye_Left], true, eye, ovrEye_Left);
 
 				}
 				else {
 					//renderScene(_eyeProjections[ovrEye_Right], ovr::toGlm(eyePoses[ovrEye_Right]), false);
-					renderScene(_eyeProjections[ovrEye_Right], headPos_right_curr, false);
+					renderScene(_eyeProjections[ovrEye_Right], eyeTransforms[ovrEye_Right], false, eye, ovrEye_Right);
 
 				}			
 			}
 
-			else if (a2) {
+			else if (state.a2) {
 				// render one eye's view to both eyes = monoscopic view
 				/*renderScene(_eyeProjections[eye], ovr::toGlm(eyePoses[ovrEye_Left]), true);*/
-				renderScene(_eyeProjections[eye], headPos_left_curr, true);
+				// only the left viewport draws the left eye's culled view
+				renderScene(_eyeProjections[eye], eyeTransforms[ovrEye_Left], true, eye, eye == ovrEye_Left ? ovrEye_Left : -1);
 			}
-			else if (a3) {
+			else if (state.a3) {
 				// render to only left eye
 				if (eye == ovrEye_Left) {
 					//renderScene(_eyeProjections[ovrEye_Left], ovr::toGlm(eyePoses[ovrEye_Left]), true);
-					renderScene(_eyeProjections[ovrEye_Left], headPos_left_curr, true);
+					renderScene(_eyeProjections[ovrEye_Left], eyeTransforms[ovrEye_Left], true, eye, ovrEye_Left);
 				}
 				
 			}
-			else if (a4) {
+			else if (state.a4) {
 				// render to only right eye
 				if (eye == ovrEye_Right) {
 					//renderScene(_eyeProjections[ovrEye_Right], ovr::toGlm(eyePoses[ovrEye_Right]), false);
 
-					renderScene(_eyeProjections[ovrEye_Right], headPos_right_curr, false);
+					renderScene(_eyeProjections[ovrEye_Right], eyeTransforms[ovrEye_Right], false, eye, ovrEye_Right);
 				}
 			}
-			else if (a5) {
+			else if (state.a5) {
 				// render left eye to right eye and vice versa - inverted stereo
 				/*if (eye == ovrEye_Left) renderScene(_eyeProjections[ovrEye_Right], ovr::toGlm(eyePoses[ovrEye_Right]), false);
 				if (eye == ovrEye_Right) renderScene(_eyeProjections[ovrEye_Left], ovr::toGlm(eyePoses[ovrEye_Left]), true);*/
 
-				if (eye == ovrEye_Left) renderScene(_eyeProjections[ovrEye_Right], headPos_right_curr, false);
-				if (eye == ovrEye_Right) renderScene(_eyeProjections[ovrEye_Left], headPos_left_curr, true);
+				if (eye == ovrEye_Left) renderScene(_eyeProjections[ovrEye_Right], eyeTransforms[ovrEye_Right], false, eye, ovrEye_Right);
+				if (eye == ovrEye_Right) renderScene(_eyeProjections[ovrEye_Left], eyeTransforms[ovrEye_Left], true, eye, ovrEye_Left);
 			}
 
 		});
-		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+
+		// the views the depth buffer is actually drawn with, for the occlusion readback
+		mat4 drawnViewProjections[2] = { eyeViewProjections[0], eyeViewProjections[1] };
+		// The draws are queued, and the coherent mapping means the GPU reads whatever is in
+		// the buffer when it runs them. The driver may have flushed them already, so this is
+		// best effort: if the GPU has reached them the frame keeps its first sample, which
+		// the depth readback and the compositor's render poses then match. The poll doesn't
+		// flush; the GPU starting in the moment between it and the write is not covered.
+		bool latchInTime = false;
+		if (drawsStarted) {
+			GLenum reached = glClientWaitSync(drawsStarted, 0, 0);
+			glDeleteSync(drawsStarted);
+			latchInTime = reached == GL_TIMEOUT_EXPIRED;
+			if (!latchInTime) {
+				++_latchMissed;
+			}
+		}
+		if (latchInTime) {
+			PROFILE_ZONE("late latch");
+			double lateSampleTime = ovr_GetTimeInSeconds();
+			ovrTrackingState lateState = ovr_GetTrackingState(_session, displayMidpointSeconds, ovrFalse);
+			// same pipeline state as this frame's first sample, nothing is committed twice
+			RigidPose lateHead = _posePipeline.preview(ovr::toRigid(lateState.HeadPose.ThePose), lateSampleTime);
+			ovr_CalcEyePoses(ovr::fromRigid(lateHead), _viewScaleDesc.HmdToEyePose, eyePoses);
+			writeLatchedViews(eyePoses);
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				drawnViewProjections[eye] = _eyeProjections[eye] * ovr::toView(eyePoses[eye]);
+			});
+			ovr_CalcEyePoses(lateState.HeadPose.ThePose, _viewScaleDesc.HmdToEyePose, trackedEyePoses);
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				_sceneLayer.RenderPose[eye] = trackedEyePoses[eye];
+			});
+			_sceneLayer.SensorSampleTime = lateSampleTime;
+			_latchGainSeconds += lateSampleTime - sensorSampleTime;
+			++_latchCount;
+		}
+
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-		ovr_CommitTextureSwapChain(_session, _eyeTexture);
-		ovrLayerHeader* headerList = &_sceneLayer.Header;
-		ovr_SubmitFrame(_session, frame, &_viewScaleDesc, &headerList, 1);
 
-		GLuint mirrorTextureId;
-		ovr_GetMirrorTextureBufferGL(_session, _mirrorTexture, &mirrorTextureId);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, _mirrorFbo);
-		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureId, 0);
-		glBlitFramebuffer(0, 0, _mirrorSize.x, _mirrorSize.y, 0, _mirrorSize.y, _mirrorSize.x, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		// Only plain stereo leaves each eye's own view in its viewport
+		if (state.occlusion && state.a1) {
+			GpuTimer::Scope scope(&_gpuTimer, "depth readback");
+			glm::ivec4 viewports[2];
+			ovr::for_each_eye([&](ovrEyeType eye) {
+				const auto& vp = _sceneLayer.Viewport[eye];
+				viewports[eye] = glm::ivec4(vp.Pos.x, vp.Pos.y, vp.Size.w, vp.Size.h);
+			});
+			_depthReadback.capture(_eyeTargets.depthTexture(), viewports, drawnViewProjections, frame);
+		}
+		{
+			GpuTimer::Scope scope(&_gpuTimer, "commit");
+			_eyeTargets.commit();
+		}
+		_frameRing.endFrame();
+		_submittedViewScaleDesc = _viewScaleDesc;
+		_submittedMode = modeName(state);
+	}
 
+	// Hands the layers to the compositor and mirrors the result to the window.
+	// Only touches state renderFrame() set aside for it.
+	void endFrame() {
+		ovrLayerHeader* headerList[2];
+		unsigned int layerCount = 0;
+		if (_underlay) {
+			headerList[layerCount++] = _underlay;
+		}
+		headerList[layerCount++] = &_sceneLayer.Header;
+		{
+			PROFILE_ZONE("ovr_EndFrame");
+			ovr_EndFrame(_session, frame, &_submittedViewScaleDesc, headerList, layerCount);
+		}
+		if (!_firstFrameSubmitted) {
+			_firstFrameSubmitted = true;
+			firstFrameSubmitted();
+		}
+		{
+			PROFILE_ZONE("ovr_GetPerfStats");
+			_telemetry.poll(_session, _submittedMode);
+		}
 
-		/////////// store head positions from the previous frame
-		headPos_left_prev = headPos_left_curr;
-		headPos_right_prev = headPos_right_curr;
+		{
+			GpuTimer::Scope scope(&_gpuTimer, "mirror blit");
+			GLuint mirrorTextureId;
+			ovr_GetMirrorTextureBufferGL(_session, _mirrorTexture, &mirrorTextureId);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, _mirrorFbo);
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureId, 0);
+			glBlitFramebuffer(0, 0, _mirrorSize.x, _mirrorSize.y, 0, _mirrorSize.y, _mirrorSize.x, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		}
 	}
 
 	/*virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) = 0;*/
-	virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, bool isLeft) = 0;
+	// viewport is the eye buffer half being drawn, which the view need not belong to.
+	// stereoEye is the eye whose projection and pose (as given to cullScene()) these are,
+	// or -1 for a view no eye has, such as the right projection on the left pose.
+	virtual void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, bool isLeft, ovrEyeType viewport, int stereoEye) = 0;
+
+	// Called once per frame before any renderScene(), with both eyes' projections and
+	// processed poses, so the scene can cull for both eyes in one pass
+	virtual void cullScene(const glm::mat4 projections[2], const glm::mat4 eyePoses[2]) {}
+
+	// Called once per frame with this frame's controller poses, in the same tracking space
+	// the scene is drawn in, and their ovrStatus_ flags
+	virtual void handPosesUpdated(const ovrPosef handPoses[2], const unsigned int handStatus[2]) {}
+
+	// Per-frame scene counters, logged alongside the GPU timings (G key)
+	virtual void logSceneStats() {}
+
+	// Called once, right after the first ovr_EndFrame, on the thread that submits frames
+	virtual void firstFrameSubmitted() {}
+
+	// Optional layer the compositor draws beneath the eye layer (e.g. a skybox at infinity).
+	// While one is returned the eye buffer is cleared to transparent so it shows through.
+	virtual ovrLayerHeader * underlayLayer() { return nullptr; }
+};
+
+// Opens the compiled scene, compiling it from the text form first if there is no binary
+// yet or the text has been edited since
+static void openScene(scene::SceneFile & file, const char * path, const char * sourcePath) {
+	if (scene::sourceNewer(sourcePath, path)) {
+		LOG_INFO("%s is newer than %s, recompiling it", sourcePath, path);
+		scene::compile(sourcePath, path);
+	}
+	if (!file.open(path)) {
+		LOG_INFO("%s not found, compiling it from %s", path, sourcePath);
+		scene::compile(sourcePath, path);
+		if (!file.open(path)) {
+			FAIL("Unable to open the compiled scene");
+		}
+	}
+}
+
+// A skybox face as the compositor wants it. Its cube is left-handed (+X face on the
+// left when looking down -Z), which mirrors our GL cube map: every face is flipped
+// horizontally here, and SkyboxLayer swaps the X faces.
+static std::shared_ptr<const DecodedImage> mirroredFace(const DecodedImage & face) {
+	std::shared_ptr<DecodedImage> mirrored = std::make_shared<DecodedImage>();
+	mirrored->width = face.width;
+	mirrored->height = face.height;
+	mirrored->channels = face.channels;
+	const size_t pixel = (size_t)face.channels, row = (size_t)face.width * pixel;
+	mirrored->pixels = std::unique_ptr<unsigned char, void (*)(void *)>((unsigned char *)malloc(row * face.height), free);
+	if (!mirrored->pixels) {
+		return nullptr;
+	}
+	for (int y = 0; y < face.height; ++y) {
+		const unsigned char * source = face.pixels.get() + y * row;
+		unsigned char * line = mirrored->pixels.get() + y * row;
+		for (int x = 0; x < face.width; ++x) {
+			memcpy(line + x * pixel, source + (face.width - 1 - x) * pixel, pixel);
+		}
+	}
+	return mirrored;
+}
+
+// The CPU half of startup, queued on the first lines of main(): the scene file is
+// opened (compiled first if need be), every cube map face it names decoded, the
+// skybox faces mirrored for the compositor layers and every shader source read,
+// while the runtime, window and context come up. The GL half stays in initGl() and
+// ColorCubeScene and waits only on the tasks whose results it uploads.
+//
+// Serial (--serial-startup, no job system), nothing runs ahead: each task runs where
+// its result is first wanted, and startup happens in the order it always did.
+class StartupAssets {
+public:
+	StartupTasks tasks;
+	PrefetchedImages images;
+
+	explicit StartupAssets(JobSystem * jobs) : tasks(jobs), images(tasks) {}
+
+	~StartupAssets() {
+		tasks.stop(); // running tasks write into the members below
+	}
+
+	// Queues everything and returns; the paths must outlive the tasks
+	void start(const char * scenePath, const char * sceneSourcePath, const std::vector<const char *> & shaderPaths) {
+		sceneTask = tasks.add(std::string("open ") + scenePath, [this, scenePath, sceneSourcePath] {
+			openScene(sceneFile, scenePath, sceneSourcePath);
+			for (uint32_t i = 0; i < sceneFile.meshCount(); ++i) {
+				const scene::Mesh & mesh = sceneFile.mesh(i);
+				bool layer = mesh.kind == scene::MESH_SKYBOX_LEFT || mesh.kind == scene::MESH_SKYBOX_ROOM;
+				for (const string & face : sceneFile.faces(mesh.texture)) {
+					StartupTasks::Task decoded = images.prefetch(face);
+					if (layer) {
+						prefetchLayerFace(face, decoded);
+					}
+				}
+			}
+		});
+		for (const char * path : shaderPaths) {
+			tasks.add(std::string("read ") + path, [path] { PrefetchShaderSource(path); });
+		}
+	}
+
+	// The open scene file, once it is
+	scene::SceneFile & scene() {
+		tasks.wait(sceneTask);
+		return sceneFile;
+	}
+
+	// A skybox face mirrored for a compositor cube layer, null if it wasn't prefetched
+	std::shared_ptr<const DecodedImage> layerFace(const std::string & path) {
+		StartupTasks::Task task;
+		{
+			std::lock_guard<std::mutex> lock(layerMutex);
+			auto found = layerFaces.find(path);
+			if (found == layerFaces.end()) {
+				return nullptr;
+			}
+			task = found->second.task;
+		}
+		tasks.wait(task);
+		std::lock_guard<std::mutex> lock(layerMutex);
+		return layerFaces[path].image;
+	}
+
+	// The tasks mirroring the skybox faces, once the scene has been opened
+	std::vector<StartupTasks::Task> layerFaceTasks() {
+		tasks.wait(sceneTask);
+		std::vector<StartupTasks::Task> mirrors;
+		std::lock_guard<std::mutex> lock(layerMutex);
+		for (const auto & face : layerFaces) {
+			mirrors.push_back(face.second.task);
+		}
+		return mirrors;
+	}
+
+	// Once everything is uploaded: drops the pixels and closes the scene file
+	void release() {
+		images.clear();
+		std::lock_guard<std::mutex> lock(layerMutex);
+		for (auto & face : layerFaces) {
+			face.second.image.reset();
+		}
+		sceneFile.close();
+	}
+
+private:
+	struct LayerFace {
+		StartupTasks::Task task{ 0 };
+		std::shared_ptr<const DecodedImage> image;
+	};
+
+	scene::SceneFile sceneFile;
+	StartupTasks::Task sceneTask{ 0 };
+	std::mutex layerMutex;
+	std::map<std::string, LayerFace> layerFaces;
+
+	void prefetchLayerFace(const std::string & path, StartupTasks::Task decoded) {
+		std::lock_guard<std::mutex> lock(layerMutex);
+		if (layerFaces.count(path)) {
+			return;
+		}
+		LayerFace & face = layerFaces[path];
+		face.task = tasks.add("mirror " + path, [this, path, &face] {
+			std::shared_ptr<const DecodedImage> image = images.get(path);
+			std::shared_ptr<const DecodedImage> mirrored = image ? mirroredFace(*image) : nullptr;
+			std::lock_guard<std::mutex> lock(layerMutex);
+			face.image = mirrored;
+		}, { decoded });
+	}
+};
+
+// A skybox uploaded once into a static cube map swap chain and handed to the
+// compositor as an ovrLayerCube, so it costs the application no GPU time.
+class SkyboxLayer {
+	ovrSession _session;
+	ovrTextureSwapChain _cubeTexture{ nullptr };
+
+public:
+	ovrLayerCube layer;
+
+	// startup, if given, has the faces decoded and mirrored already (or on their way)
+	SkyboxLayer(ovrSession session, const vector<string> & faces, StartupAssets * startup = nullptr) : _session(session) {
+		memset(&layer, 0, sizeof(ovrLayerCube));
+		layer.Header.Type = ovrLayerType_Cube;
+		layer.Header.Flags = 0; // ovrLayerFlag_TextureOriginAtBottomLeft isn't supported for cube layers
+		layer.Orientation = ovr::fromGlm(quat(1.0f, 0.0f, 0.0f, 0.0f));
+
+		GLuint texId = 0;
+		for (unsigned int i = 0; i < faces.size(); i++) {
+			std::shared_ptr<const DecodedImage> face = startup ? startup->layerFace(faces[i]) : nullptr;
+			if (!face) {
+				std::shared_ptr<const DecodedImage> decoded = decodeImage(faces[i], PrefetchedImages::CHANNELS);
+				face = decoded ? mirroredFace(*decoded) : nullptr;
+			}
+			if (!face) {
+				LOG_ERROR("Cubemap layer failed to load at path: %s", faces[i].c_str());
+				continue;
+			}
+			const int width = face->width, height = face->height;
+
+			if (!_cubeTexture) {
+				ovrTextureSwapChainDesc desc = {};
+				desc.Type = ovrTexture_Cube;
+				desc.ArraySize = 6;
+				desc.Width = width;
+				desc.Height = height;
+				desc.MipLevels = 1;
+				desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+				desc.SampleCount = 1;
+				desc.StaticImage = ovrTrue;
+				if (!OVR_SUCCESS(ovr_CreateTextureSwapChainGL(_session, &desc, &_cubeTexture))) {
+					FAIL("Failed to create cube map layer texture");
+				}
+				ovr_GetTextureSwapChainBufferGL(_session, _cubeTexture, 0, &texId);
+				glBindTexture(GL_TEXTURE_CUBE_MAP, texId);
+			}
+
+			// the face is mirrored already (see mirroredFace), the X faces swap here
+			unsigned int target = (i < 2) ? (i ^ 1) : i;
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + target, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, face->pixels.get());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		}
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		if (!_cubeTexture) {
+			FAIL("No faces could be loaded for cube map layer");
+		}
+		ovr_CommitTextureSwapChain(_session, _cubeTexture);
+		layer.CubeMapTexture = _cubeTexture;
+	}
+
+	~SkyboxLayer() {
+		if (_cubeTexture) {
+			ovr_DestroyTextureSwapChain(_session, _cubeTexture);
+		}
+	}
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -935,151 +2060,365 @@ protected:
 struct ColorCubeScene {
 
 public:
-	Cube * cube_1;
-	Cube * skybox_left;
-	Cube * skybox_right;
-	Cube * skybox_room;
-
 	GLuint cube_shader;
-
-	vector<string> cube_faces = {
-		"cube_pattern.ppm",
-		"cube_pattern.ppm",
-		"cube_pattern.ppm",
-		"cube_pattern.ppm",
-		"cube_pattern.ppm",
-		"cube_pattern.ppm"
+	GLint cubeLatchedView{ -1 }; // picks the eye cube_shader takes from the LateLatch block
+
+	GpuTimer * gpuTimer{ nullptr }; // optional, times the skybox and cube passes
+	FrameRingBuffer * frameRing{ nullptr }; // optional, carries the instance transforms
+	JobSystem * jobs{ nullptr }; // optional, spreads the transform and culling systems
+	FrameArena * frameArena{ nullptr }; // where render() keeps its draw lists
+
+	// face images of the skyboxes, for the compositor cube map layers
+	vector<string> skybox_faces_left;
+	vector<string> skybox_faces_room;
+
+	static constexpr const char * CUBE_VERT_PATH = "shader_cube.vert";
+	static constexpr const char * CUBE_FRAG_PATH = "shader_cube.frag";
+	static constexpr const char * CUBE_INDIRECT_VERT_PATH = "shader_cube_indirect.vert";
+	static constexpr const char * CULL_COMP_PATH = "shader_cull.comp";
+	static constexpr const char * SCENE_PATH = "scene.bin";
+	static constexpr const char * SCENE_SOURCE_PATH = "scene.txt";
+
+	// simulation state, only changed by simulate()
+	float cubeScale = 0.3f;
+	// what the left stick scales the cubes by a second, 1% a 90 Hz tick either way
+	static constexpr float GROW_PER_SECOND = 2.449f;
+	static constexpr float SHRINK_PER_SECOND = 0.405f;
+
+	// Placement of everything drawn. updateTransforms() brings it in line with the
+	// simulation once per frame; render() only reads the world matrices.
+	SceneGraph graph;
+	struct ResizableNode {
+		SceneGraph::Node node;
+		scene::Node placement;
 	};
+	vector<ResizableNode> resizableNodes; // scaled about their pivots by cubeScale
+	float placedScale = -1.0f; // cubeScale the resizable nodes were last set up for
+
+	// What is drawn: one entity per object, its mesh an index into meshTable
+	vector<Cube *> meshTable;
+	EntityStore entities;
+
+	// Both eyes are culled once per frame by cullStereo(). render() draws from that result
+	// when told its view is one of the two, and culls on its own for any other (mono).
+	bool stereoCulled{ false };
+	std::vector<uint8_t> stereoVisible; // bit 0 left eye, bit 1 right eye
+	culling::StereoStats cullStats;     // from the last cullStereo()
+
+	// A late-latched view turns a little after culling; its frustum is widened by this
+	const float LATCH_CULL_MARGIN = 0.05f;
+
+	// Spatial index over the entities' bounds for single-view culls and ray casts.
+	// Built once when the scene loads and refit whenever entities move.
+	Bvh bvh;
+
+	// Every cube instance's box for controller picking, rebuilt whenever entities move.
+	// The budget holds at 100k cubes (see --bench); past it the sweep stops early.
+	RayPicker cubePicker;
+	static constexpr double PICK_BUDGET_US = 250.0;
+	static constexpr float PICK_DISTANCE = 100.0f;
+
+	// On 4.3 contexts the cubes are culled by a compute shader and drawn with one indirect
+	// multi-draw per eye; the skyboxes, mono views and 4.1 contexts stay on the CPU path.
+	GpuCuller gpuCuller;
+	bool gpuCulling{ true };           // the I key toggles it where it's supported, via FrameState
+	bool gpuCulledFrame{ false };      // this frame's cubes were culled on the GPU
+	bool gpuInstancesDirty{ false };   // entities moved since the instances were uploaded
+	GLint indirectLatchedView{ -1 };   // the indirect program's latchedView uniform
+
+	// startup, if given, has the scene file and its images on the way
+	ColorCubeScene(StartupAssets * startup = nullptr) {
+		loadScene(startup);
 
-	vector<string> skybox_faces_room = {
-		// 2 are flipped horizontally
-		// 3 are flipped vertically
-		"skybox_room/px_2.ppm",
-		"skybox_room/nx_2.ppm",
-		"skybox_room/py_3.ppm",
-		"skybox_room/ny_3.ppm",
-		"skybox_room/nz_2.ppm",
-		"skybox_room/pz_2.ppm",
-	};
-
-	vector<string> skybox_faces_left = {
-		"skybox_leftEye/nx.ppm",
-		"skybox_leftEye/px.ppm",
-		"skybox_leftEye/py_2.ppm", // rotated 
-		"skybox_leftEye/ny_2.ppm", // rotated
-		"skybox_leftEye/nz.ppm",
-		"skybox_leftEye/pz.ppm",
-	};
+		cube_shader = LoadShaders(CUBE_VERT_PATH, CUBE_FRAG_PATH);
+		cubeLatchedView = bindLateLatch(cube_shader);
+		initGpuCulling();
+	}
 
-	vector<string> skybox_faces_right = {
-		"skybox_rightEye/nx.ppm",
-		"skybox_rightEye/px.ppm",
-		"skybox_rightEye/py_2.ppm", // rotated 
-		"skybox_rightEye/ny_2.ppm", // rotated
-		"skybox_rightEye/nz.ppm",
-		"skybox_rightEye/pz.ppm",
-	};
+	// Binds the program's LateLatch block and returns its latchedView uniform, which
+	// picks the eye to take from the block
+	static GLint bindLateLatch(GLuint program) {
+		GLuint latchBlock = glGetUniformBlockIndex(program, "LateLatch");
+		if (latchBlock != GL_INVALID_INDEX) {
+			glUniformBlockBinding(program, latchBlock, LATE_LATCH_BINDING);
+		}
+		return glGetUniformLocation(program, "latchedView");
+	}
 
-	const char * CUBE_VERT_PATH = "shader_cube.vert";
-	const char * CUBE_FRAG_PATH = "shader_cube.frag";
+	void initGpuCulling() {
+		if (!GpuCuller::supported()) {
+			LOG_INFO("GPU culling needs OpenGL 4.3, culling on the CPU");
+			return;
+		}
+		const Cube * cube = nullptr;
+		for (EntityStore::Entity entity = 0; entity < entities.size() && !cube; ++entity) {
+			if (entities.layers[entity] & LAYER_CUBES) cube = meshTable[entities.meshes[entity]];
+		}
+		// every cube mesh is the same unit cube, so one VAO over the first serves them all
+		if (!cube || !gpuCuller.init(CULL_COMP_PATH, CUBE_INDIRECT_VERT_PATH, CUBE_FRAG_PATH, cube->VBO, cube->EBO, 36)) {
+			LOG_WARN("GPU culling unavailable, culling on the CPU");
+			return;
+		}
+		indirectLatchedView = bindLateLatch(gpuCuller.program());
+		gpuCuller.setInstances(entities, LAYER_CUBES);
+		LOG_INFO("GPU culling %u cubes in %u draw commands per eye", (unsigned int)gpuCuller.instanceCount(), (unsigned int)gpuCuller.meshes().size());
+	}
 
-	glm::mat4 cubeScaleMat = glm::scale(glm::mat4(1.0f), glm::vec3(0.3f, 0.3f, 0.3f)); // only mat used to scale cube
+	bool gpuCullingActive(const FrameState & state) const {
+		return state.gpuCulling && gpuCuller.ready();
+	}
 
-	ColorCubeScene() {
-		skybox_left = new Cube(1, skybox_faces_left, true, true, false);
+	~ColorCubeScene(){
+		for (Cube * mesh : meshTable) {
+			delete mesh;
+		}
+		glDeleteProgram(cube_shader);
+	}
 
-		skybox_right = new Cube(1, skybox_faces_right, true, false, false);
+	// Builds the graph, meshes and entities from the compiled scene, the one startup
+	// opened if there is one
+	void loadScene(StartupAssets * startup) {
+		auto start = std::chrono::steady_clock::now();
+		scene::SceneFile ownFile;
+		if (!startup) {
+			openScene(ownFile, SCENE_PATH, SCENE_SOURCE_PATH);
+		}
+		scene::SceneFile & file = startup ? startup->scene() : ownFile;
+		PrefetchedImages * images = startup ? &startup->images : nullptr;
+		std::chrono::duration<double, std::milli> openTime = std::chrono::steady_clock::now() - start;
+
+		vector<SceneGraph::Node> nodes(file.nodeCount());
+		for (uint32_t i = 0; i < file.nodeCount(); ++i) {
+			const scene::Node & node = file.node(i);
+			SceneGraph::Node parent = node.parent < 0 ? SceneGraph::None : nodes[node.parent];
+			nodes[i] = graph.create(parent, scene::nodeLocal(node));
+			if (node.flags & scene::NODE_RESIZABLE) {
+				resizableNodes.push_back({ nodes[i], node });
+			}
+		}
+		updateTransforms();
+
+		for (uint32_t i = 0; i < file.meshCount(); ++i) {
+			const scene::Mesh & mesh = file.mesh(i);
+			vector<string> faces = file.faces(mesh.texture);
+			switch (mesh.kind) {
+			case scene::MESH_SKYBOX_LEFT:
+				skybox_faces_left = faces;
+				meshTable.push_back(new Cube(1, faces, true, true, false, images));
+				break;
+			case scene::MESH_SKYBOX_RIGHT:
+				meshTable.push_back(new Cube(1, faces, true, false, false, images));
+				break;
+			case scene::MESH_SKYBOX_ROOM:
+				skybox_faces_room = faces;
+				meshTable.push_back(new Cube(1, faces, true, false, true, images));
+				break;
+			default:
+				meshTable.push_back(new Cube(1, faces, false, false, false, images));
+				break;
+			}
+		}
 
-		skybox_room = new Cube(1, skybox_faces_room, true, false, true);
+		// every mesh is the -1..1 cube, so its box is the same whatever the file's radius
+		entities.reserve(file.objectCount());
+		for (uint32_t i = 0; i < file.objectCount(); ++i) {
+			const scene::Object & object = file.object(i);
+			entities.create(nodes[object.node], (uint16_t)object.mesh, (uint16_t)object.material, object.radius, object.layers, glm::vec3(1.0f));
+		}
+		entities.updateTransforms(graph);
+		bvh.build(entities.spheres());
+		rebuildPicker();
+		LOG_INFO("Scene: %u nodes, %u objects, %s %s in %.3f ms", file.nodeCount(), file.objectCount(), SCENE_PATH,
+			startup ? "waited for" : "opened", openTime.count());
+	}
 
-		cube_1 = new Cube(1, cube_faces, false, false, false); // first cube of size 1
+	// One simulation step of dt seconds: stickX > 0 grows the cubes, < 0 shrinks them
+	void simulate(float stickX, bool reset, double dt) {
+		if (stickX > 0) {
+			if (cubeScale < 0.5f) cubeScale *= powf(GROW_PER_SECOND, (float)dt);
+		}
+		else if (stickX < 0) {
+			if (cubeScale > 0.01f) cubeScale *= powf(SHRINK_PER_SECOND, (float)dt);
+		}
+		else if (reset) {
+			cubeScale = 0.3f;
+		}
+	}
 
-		cube_shader = LoadShaders(CUBE_VERT_PATH, CUBE_FRAG_PATH);
+	// Each resizable node is scaled about its own pivot
+	void updateTransforms() {
+		if (cubeScale != placedScale) {
+			placedScale = cubeScale;
+			for (const ResizableNode & resizable : resizableNodes) {
+				graph.setLocal(resizable.node, scene::nodeLocal(resizable.placement, cubeScale));
+			}
+		}
+		graph.update();
+		if (entities.updateTransforms(graph, jobs)) {
+			bvh.refit(entities.spheres());
+			rebuildPicker();
+			gpuInstancesDirty = true; // uploaded by the render thread, which owns the context
+		}
 	}
 
-	~ColorCubeScene(){
-		delete(skybox_left);
-		delete(skybox_right);
-		delete(cube_1);
-		glDeleteProgram(cube_shader);
-		// delete char * ?
+	void rebuildPicker() {
+		cubePicker.clear();
+		cubePicker.reserve(entities.size());
+		for (EntityStore::Entity entity = 0; entity < entities.size(); ++entity) {
+			if (entities.layers[entity] & LAYER_CUBES) {
+				cubePicker.addCube(entity, entities.worlds[entity]);
+			}
+		}
+		cubePicker.finish();
 	}
 
-	void resetCubes() {
-		cubeScaleMat = glm::scale(glm::mat4(1.0f), glm::vec3(0.3f, 0.3f, 0.3f));
-	} 
+	// Closest cube entity along each ray (one per controller), in at most PICK_BUDGET_US
+	RayPicker::Stats pickCubes(const RayPicker::Ray * rays, int rayCount, RayPicker::Hit * hits) const {
+		return cubePicker.pick(rays, rayCount, hits, PICK_DISTANCE, PICK_BUDGET_US);
+	}
 
-	void scaleCubes(float val) {
-		cubeScaleMat = cubeScaleMat * glm::scale(glm::mat4(1.0f), glm::vec3(val));
+	// Culls every layer for both eyes, against a frustum enclosing both and then each eye.
+	// With depth pyramids (one per eye) the cubes left are tested for occlusion too.
+	void cullStereo(const FrameState & state, const mat4 projections[2], const mat4 views[2], bool latched, const HiZBuffer * occlusion = nullptr) {
+		mat4 cullViewProjection[2];
+		glm::vec4 eyePlanes[2][6], combined[6];
+		for (int eye = 0; eye < 2; ++eye) {
+			mat4 projection = latched ? culling::widenedProjection(projections[eye], LATCH_CULL_MARGIN) : projections[eye];
+			cullViewProjection[eye] = projection * views[eye];
+			frustumPlanes(cullViewProjection[eye], eyePlanes[eye]);
+		}
+		culling::combinedFrustumPlanes(cullViewProjection, combined);
+
+		gpuCulledFrame = gpuCullingActive(state);
+		uint32_t cpuLayers = ~0u;
+		if (gpuCulledFrame) {
+			GpuTimer::Scope scope(gpuTimer, "gpu cull");
+			if (gpuInstancesDirty) {
+				gpuCuller.updateInstances(entities);
+				gpuInstancesDirty = false;
+			}
+			gpuCuller.setOcclusion(occlusion);
+			gpuCuller.cull(eyePlanes);
+			cpuLayers = ~(uint32_t)LAYER_CUBES;
+		}
+		cullStats = entities.cullStereo(combined, eyePlanes[0], eyePlanes[1], cpuLayers, stereoVisible, jobs);
+		if (occlusion) {
+			// the skyboxes enclose everything, only cubes can be hidden
+			PROFILE_ZONE("occlusionCull");
+			entities.occlusionCull(occlusion, LAYER_CUBES & cpuLayers, stereoVisible, cullStats, jobs);
+		}
+		stereoCulled = true;
 	}
 
-	void render(const mat4 & projection, const mat4 & modelview, bool isLeftEye) {
+	// The cubes the compute shader found visible to one eye: one indirect multi-draw per
+	// run of commands drawing the same mesh, each with that mesh's state and texture
+	void drawCubesIndirect(int eye, const mat4 & projection, const mat4 & modelview, int latchedView) const {
+		GLuint program = gpuCuller.program();
+		glUseProgram(program);
+		glUniform1i(indirectLatchedView, latchedView);
+		const std::vector<uint16_t> & meshes = gpuCuller.meshes();
+		for (size_t first = 0; first < meshes.size();) {
+			size_t last = first + 1;
+			while (last < meshes.size() && meshes[last] == meshes[first]) ++last;
+			meshTable[meshes[first]]->bindState(program, projection, modelview);
+			gpuCuller.draw(eye, first, last - first);
+			first = last;
+		}
+		glUseProgram(cube_shader);
+	}
 
-		// change cubeScaleMat according to booleans
-		if (cube_size_up) {
-			if (cubeScaleMat[0][0] < 0.5f && cubeScaleMat[1][1] < 0.5f && cubeScaleMat[2][2] < 0.5f) {
-				scaleCubes(1.01f);
-			}
+	// Draws the visible entities on the given layers, grouped by mesh. eye >= 0 takes
+	// visibility from that eye's stereo cull, otherwise planes are tested here.
+	// The model matrices are written to the frame ring and every run of packets with
+	// one mesh is a single instanced draw; without room in the ring each is drawn alone.
+	void drawLayers(uint32_t layerMask, int eye, const glm::vec4 planes[6], const mat4 & projection, const mat4 & modelview) const {
+		// reserved up front: every regrowth would leave its old block in the arena
+		FrameVector<DrawPacket> packets(*frameArena);
+		if (eye >= 0) {
+			packets.reserve(entities.size());
+			entities.buildDrawPackets(stereoVisible, packets, (uint8_t)(1 << eye), layerMask);
+		}
+		else {
+			FrameVector<uint32_t> found(*frameArena);
+			found.reserve(entities.size());
+			bvh.queryFrustum(entities.spheres(), planes, layerMask, found);
+			packets.reserve(found.size());
+			entities.buildDrawPackets(found, packets);
+		}
+		const size_t count = packets.size();
+		FrameRingBuffer::Range models;
+		if (frameRing && count) {
+			models = frameRing->allocate(count * sizeof(mat4), sizeof(mat4));
 		}
-		if (cube_size_down) {
-			if (cubeScaleMat[0][0] > 0.01f && cubeScaleMat[1][1] > 0.01f && cubeScaleMat[2][2] > 0.01f) {
-				scaleCubes(0.99f);
+		if (!models) {
+			for (const DrawPacket & packet : packets) {
+				Cube::setModel(entities.worlds[packet.entity]);
+				meshTable[entities.meshes[packet.entity]]->draw(cube_shader, projection, modelview);
 			}
+			return;
 		}
 
-		if (cube_size_reset) {
-			resetCubes();
+		// unmapped, the matrices are gathered here and copied in
+		mat4 * written = models.data ? (mat4 *)models.data : (mat4 *)frameArena->allocate(count * sizeof(mat4), alignof(mat4));
+		for (size_t i = 0; i < count; ++i) {
+			written[i] = entities.worlds[packets[i].entity];
+		}
+		if (!models.data) frameRing->write(models, written, models.size);
+		for (size_t first = 0; first < count;) {
+			const uint16_t mesh = entities.meshes[packets[first].entity];
+			size_t last = first + 1;
+			while (last < count && entities.meshes[packets[last].entity] == mesh) ++last;
+			meshTable[mesh]->drawInstanced(cube_shader, projection, modelview,
+				frameRing->buffer(), models.offset + first * sizeof(mat4), (GLsizei)(last - first));
+			first = last;
 		}
+	}
 
+	// isLeftEye picks the skybox the view sees, viewport (0 left, 1 right) the eye buffer
+	// half it is drawn into, which names the GPU timings. stereoEye is the eye whose
+	// cullStereo() view this is, or -1 to cull it here.
+	// drawSkybox is false while the compositor draws the skybox as a cube layer.
+	// latchedView >= 0 makes the shader take that eye's late-latched view instead of modelview.
+	void render(const FrameState & state, const mat4 & projection, const mat4 & modelview, bool isLeftEye, int viewport,
+		int stereoEye = -1, bool drawSkybox = true, int latchedView = -1) const {
 		glUseProgram(cube_shader);
-		GLuint uProjection = glGetUniformLocation(cube_shader, "model");
-
-		// render skybox
-		glm::mat4 scaleMat = glm::scale(glm::mat4(1.0f), glm::vec3(100.0f, 100.0f, 100.0f));
-		glUniformMatrix4fv(uProjection, 1, GL_FALSE, &scaleMat[0][0]);
-
-		// render in different modes 
-		if (x1 || x2) {
-			// render different texture images for left and right eye to create stereo effect
-			if (isLeftEye) {
-				//cout << "isLeftEye" << endl;
-				skybox_left->draw(cube_shader, projection, modelview);
+		glUniform1i(cubeLatchedView, latchedView);
+
+		// render in different modes: x1 skybox and cubes, x2 just the skybox, both in stereo;
+		// x3 the left skybox in mono, x4 the room
+		uint32_t skyboxLayer = 0;
+		if (drawSkybox) {
+			if (state.x1 || state.x2) {
+				skyboxLayer = isLeftEye ? LAYER_SKYBOX_LEFT : LAYER_SKYBOX_RIGHT;
 			}
-			else {
-				//cout << "isRightEye" << endl;
-				skybox_right->draw(cube_shader, projection, modelview);
+			else if (state.x3) {
+				skyboxLayer = LAYER_SKYBOX_LEFT;
 			}
-
-			if (x1) {
-				// render cubes
-				// specify positions
-				vec3 pos_1 = vec3(0.0f, 0.0f, -4.0f);
-				vec3 pos_2 = vec3(0.0f, 0.0f, -8.0f);
-
-				glm::mat4 posMat = glm::translate(glm::mat4(1.0f), pos_1);
-				glm::mat4 posMat_in = glm::translate(glm::mat4(1.0f), -pos_1);
-				glm::mat4 M = posMat * cubeScaleMat * posMat_in;
-
-				// draw closer cube
-				glUniformMatrix4fv(uProjection, 1, GL_FALSE, &M[0][0]);
-				cube_1->draw(cube_shader, projection, modelview);
-
-				posMat = glm::translate(glm::mat4(1.0f), pos_2);
-				posMat_in = glm::translate(glm::mat4(1.0f), -pos_2);
-				M = posMat * cubeScaleMat * posMat_in;
-
-				// draw further cube
-				glUniformMatrix4fv(uProjection, 1, GL_FALSE, &M[0][0]);
-				cube_1->draw(cube_shader, projection, modelview);
+			else if (state.x4) {
+				skyboxLayer = LAYER_SKYBOX_ROOM;
 			}
 		}
-		else if (x3) {
-			// render just skybox in mono
-			skybox_left->draw(cube_shader, projection, modelview);
+		const uint32_t cubeLayer = state.x1 ? LAYER_CUBES : 0;
+
+		const int eye = stereoCulled ? stereoEye : -1;
+		glm::vec4 planes[6];
+		if (eye < 0) {
+			mat4 cullProjection = latchedView >= 0 ? culling::widenedProjection(projection, LATCH_CULL_MARGIN) : projection;
+			frustumPlanes(cullProjection * modelview, planes);
+		}
+
+		if (skyboxLayer) {
+			GpuTimer::Scope scope(gpuTimer, viewport == 0 ? "skybox left" : "skybox right");
+			drawLayers(skyboxLayer, eye, planes, projection, modelview);
 		}
-		else if (x4) {
-			// render custom skybox
-			skybox_room->draw(cube_shader, projection, modelview);
+		if (cubeLayer) {
+			GpuTimer::Scope scope(gpuTimer, viewport == 0 ? "cubes left" : "cubes right");
+			if (eye >= 0 && gpuCulledFrame) {
+				drawCubesIndirect(eye, projection, modelview, latchedView);
+			}
+			else {
+				drawLayers(cubeLayer, eye, planes, projection, modelview);
+			}
 		}
 	}
 };
@@ -1089,133 +2428,221 @@ public:
 class ExampleApp : public RiftApp {
 	std::shared_ptr<ColorCubeScene> cubeScene;
 
+	// compositor-side skyboxes, toggled with the C key
+	std::unique_ptr<SkyboxLayer> skyboxLayer_left;
+	std::unique_ptr<SkyboxLayer> skyboxLayer_room;
+	bool compositorSkybox = false;
+	bool skyboxInCompositor = false; // true this frame if a cube layer replaces the rendered skybox
+	uint32_t pointedAt[2]{ RayPicker::NoHit, RayPicker::NoHit }; // object each controller points at
+	StartupAssets * startup; // what main() started loading, if anything
+
 public:
-	ExampleApp() { }
+	ExampleApp(StartupAssets * startup = nullptr) : startup(startup) {
+		if (startup) startup->tasks.mark("glfwInit, ovr_Create");
+	}
+
+	// Every shader initGl() compiles, for main() to read ahead
+	static std::vector<const char *> shaderPaths() {
+		return {
+			"shader_mask.vert", "shader_mask.frag", "shader_hiz.vert", "shader_hiz.frag",
+			ColorCubeScene::CUBE_VERT_PATH, ColorCubeScene::CUBE_FRAG_PATH,
+			ColorCubeScene::CUBE_INDIRECT_VERT_PATH, ColorCubeScene::CULL_COMP_PATH,
+		};
+	}
 
 
 protected:
 	void initGl() override {
+		if (startup) startup->tasks.mark("window, GLEW");
 		RiftApp::initGl();
+		if (startup) startup->tasks.mark("eye targets, mirror, GL resources");
 		glClearColor(0.2f, 0.3f, 0.8f, 1.0f); // change background color to light blue
 
 		glEnable(GL_DEPTH_TEST);
 		ovr_RecenterTrackingOrigin(_session);
-		cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene());
+		cubeScene = std::shared_ptr<ColorCubeScene>(new ColorCubeScene(startup));
+		cubeScene->gpuTimer = &_gpuTimer;
+		cubeScene->frameRing = &_frameRing;
+		cubeScene->jobs = _jobs;
+		cubeScene->frameArena = &_frameArena;
+		if (startup) startup->tasks.mark("scene");
+
+		if (!startup || !startup->tasks.isParallel()) {
+			createSkyboxLayers();
+			if (startup) {
+				startup->tasks.mark("skybox layers");
+				startup->release();
+			}
+			return;
+		}
+		// The layers stay off until the C key, so the first frame doesn't wait for them:
+		// they are made on the GL thread between frames once their faces are mirrored
+		startup->tasks.add("skybox layers", [this] {
+			try {
+				createSkyboxLayers();
+			}
+			catch (std::exception & error) {
+				LOG_ERROR("No compositor skybox: %s", error.what());
+			}
+			startup->release();
+		}, startup->layerFaceTasks(), JobSystem::GL_THREAD);
 	}
 
-	void shutdownGl() override {
-		cubeScene.reset();
+	void createSkyboxLayers() {
+		skyboxLayer_left = std::unique_ptr<SkyboxLayer>(new SkyboxLayer(_session, cubeScene->skybox_faces_left, startup));
+		skyboxLayer_room = std::unique_ptr<SkyboxLayer>(new SkyboxLayer(_session, cubeScene->skybox_faces_room, startup));
 	}
 
-	//void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) override {
-	//	//cubeScene->render(projection, glm::inverse(headPose));
-	//}
-
-	mat3 computeRotation(float theta_x, float theta_y, float theta_z) {
-		mat3 X, Y, Z = mat3(1.0f);
-
-		X[1][1] = cosf(theta_x);
-		X[2][1] = -sinf(theta_x);
-		X[1][2] = sinf(theta_x);
-		X[2][2] = cosf(theta_x);
-
-		Y[0][0] = cosf(theta_y);
-		Y[0][2] = -sinf(theta_y);
-		Y[2][0] = sinf(theta_y);
-		Y[2][2] = cosf(theta_y);
-
-		Z[0][0] = cosf(theta_z);
-		Z[0][1] = sinf(theta_z);
-		Z[1][0] = -sinf(theta_z);
-		Z[1][1] = cosf(theta_z);
-
-		mat3 R = Z * Y * X;
-		/*mat3 R = Z * X * Y;*/
-
-		/*mat3 R = Y * X * Z;*/
-		/*mat3 R = Y * Z * X;*/
-
-		/*mat3 R = X * Z * Y;*/
-		//mat3 R = X * Y * Z;
-
-		return R;
+	// Time to first frame: from the top of main() to the first frame the compositor has
+	void firstFrameSubmitted() override {
+		if (!startup) {
+			return;
+		}
+		startup->tasks.mark("first frame");
+		LOG_INFO("First frame submitted %.1f ms after launch (%s startup)", startup->tasks.elapsedMs(),
+			startup->tasks.isParallel() ? "parallel" : "serial");
+		std::ostringstream report;
+		startup->tasks.dump(report);
+		logging::lines(LOG_LEVEL_INFO, report.str());
 	}
 
-	// newly defined function
-	// To freeze head rotation and/or position, manipulate mat4 headPose (see notes)
-	void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, bool isLeft) {
-		headPos_curr = headPose;
+	void shutdownGl() override {
+		if (startup) startup->tasks.stop(); // the skybox layers may still be queued
+		skyboxLayer_left.reset();
+		skyboxLayer_room.reset();
+		cubeScene.reset();
+		RiftApp::shutdownGl();
+	}
 
-		if (!superRotation) {
-			cubeScene->render(projection, glm::inverse(headPose), isLeft);
-			if (!isPressed) {
-				cout << "old head pose" << endl;				
-				cout << "inverse(headPose)[0]: " << glm::inverse(headPose)[0].x << ", " << glm::inverse(headPose)[0].y << ", " << glm::inverse(headPose)[0].z << endl;
-				cout << "inverse(headPose)[1]: " << glm::inverse(headPose)[1].x << ", " << glm::inverse(headPose)[1].y << ", " << glm::inverse(headPose)[1].z << endl;
-				cout << "inverse(headPose)[2]: " << glm::inverse(headPose)[2].x << ", " << glm::inverse(headPose)[2].y << ", " << glm::inverse(headPose)[2].z << endl;
+	void onKey(int key, int scancode, int action, int mods) override {
+		if (GLFW_PRESS == action) switch (key) {
+		case GLFW_KEY_C:
+			compositorSkybox = !compositorSkybox;
+			LOG_INFO(compositorSkybox ? "compositor skybox on" : "compositor skybox off");
+			return;
+		case GLFW_KEY_I:
+			if (!cubeScene->gpuCuller.ready()) {
+				LOG_INFO("GPU culling is not available on this context");
+				return;
 			}
+			cubeScene->gpuCulling = !cubeScene->gpuCulling;
+			LOG_INFO(cubeScene->gpuCulling ? "GPU culling and indirect draws on" : "GPU culling and indirect draws off");
+			return;
 		}
-		else {
-			// Super-rotation
-
-			//// 1. compute euler angles from HMD's rotation matrix
-			mat3 R = mat3(headPos_curr[0], headPos_curr[1], headPos_curr[2]);
 
-			// euler angles for left eye
-			/*theta_x_curr = atan2f(R[1][2], R[2][2]);
-			theta_y_curr = atan2f(-R[0][2], sqrt(pow(R[1][2], 2) + pow(R[2][2], 2)));
-			theta_z_curr = atan2f(R[0][1], R[0][0]);*/
-			//////////////////////////////////////////
-
-			theta_y_curr = atan2f(R[1][1], R[2][1]);
-			theta_z_curr = atan2f(-R[0][1], sqrt(pow(R[1][1], 2) + pow(R[2][1], 2)));
-			theta_x_curr = atan2f(R[0][0], R[0][2]);
-
-			/*theta_y_curr = atan2f(R[1][0], R[2][0]);
-			theta_z_curr = atan2f(-R[0][0], sqrt(pow(R[1][0], 2) + pow(R[2][0], 2)));
-			theta_x_curr = atan2f(R[0][2], R[0][1]);*/
-
-			/*theta_y_curr = atan2f(R[1][2], R[2][2]);
-			theta_z_curr = atan2f(-R[0][2], sqrt(pow(R[1][2], 2) + pow(R[2][2], 2)));
-			theta_x_curr = atan2f(R[0][1], R[0][0]);*/
-
-
-			//cout << "theta_curr: " << theta_x_curr << ", " << theta_y_curr/* *2*/ << ", " << theta_z_curr << endl;
+		RiftApp::onKey(key, scancode, action, mods);
+	}
 
-			//// 2. get the delta value of euler angles between two frames
-			//// 3. double the delta values;
-			//float delta_x = (theta_x_curr - theta_x_prev)/* * 2*/;
-			//float delta_y = (theta_y_curr - theta_y_prev)/* * 2*/;
-			//float delta_z = (theta_z_curr - theta_z_prev)/* * 2*/;
+	void simulate(double dt) override {
+		RiftApp::simulate(dt);
+		cubeScene->simulate(thumbstick(ovrHand_Left).x, buttonDown(ovrButton_LThumb), dt);
+	}
 
-			//// 4. use the new delta values to compose a new rotation matrix
-			// call function plug in delta values
-			/*float x = theta_x_curr;
-			float y = theta_y_curr * 2.0;
-			float z = theta_z_curr;*/
+	// The scene graph is part of what renderFrame reads, so it is brought up to date here
+	void publishFrameState(FrameState & state) override {
+		RiftApp::publishFrameState(state);
+		state.compositorSkybox = compositorSkybox;
+		state.gpuCulling = cubeScene->gpuCulling;
+		cubeScene->updateTransforms();
+	}
 
-			//mat3 new_R = computeRotation(theta_x_curr, y, theta_z_curr);
+	// A cube layer holds a single cube map, so it can only stand in for the skybox when
+	// both eyes see the same one. The stereo bear pair and the one-eye modes stay rasterised.
+	// The compositor turns the layer with the tracked head, so the skybox is rasterised
+	// too whenever the pose pipeline turns the rendered head differently: frozen
+	// orientation (b3, b4), super-rotation and smoothing.
+	ovrLayerHeader * underlayLayer() override {
+		const FrameState & state = frameState();
+		skyboxInCompositor = false;
+		if (!state.compositorSkybox || state.a3 || state.a4) {
+			return nullptr;
+		}
+		if (state.b3 || state.b4 || state.superRotation || state.smoothing) {
+			return nullptr;
+		}
 
-			mat3 new_R = computeRotation(theta_z_curr, theta_x_curr * 2.0, theta_y_curr);
+		if (state.x4) {
+			if (!skyboxLayer_room) {
+				return nullptr; // not made yet
+			}
+			skyboxInCompositor = true;
+			return &skyboxLayer_room->layer.Header;
+		}
+		if (state.x3 || (state.a2 && (state.x1 || state.x2))) {
+			if (!skyboxLayer_left) {
+				return nullptr;
+			}
+			skyboxInCompositor = true;
+			return &skyboxLayer_left->layer.Header;
+		}
+		return nullptr;
+	}
 
-			//// 5. assign new rotation matrix back to transformation matrix
-			mat4 new_T = mat4(new_R);
-			new_T[3] = headPos_curr[3];
-			// do I need to put [0][3], [1][3], and [2][3] ?
+	//void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose) override {
+	//	//cubeScene->render(projection, glm::inverse(headPose));
+	//}
 
-			// 6. done
-			headPos_curr = new_T;
-			cubeScene->render(projection, glm::inverse(headPos_curr), isLeft);
+	void cullScene(const mat4 projections[2], const mat4 eyePoses[2]) override {
+		const mat4 views[2] = { rigid::inverse(eyePoses[ovrEye_Left]), rigid::inverse(eyePoses[ovrEye_Right]) };
+		cubeScene->cullStereo(frameState(), projections, views, latchedView(true) >= 0, occlusionBuffers());
+	}
 
-			if (isPressed) {
-				cout << "new head pose" << endl;
-				cout << "inverse(headPose)[0]: " << glm::inverse(headPose)[0].x << ", " << glm::inverse(headPose)[0].y << ", " << glm::inverse(headPose)[0].z << endl;
-				cout << "inverse(headPose)[1]: " << glm::inverse(headPose)[1].x << ", " << glm::inverse(headPose)[1].y << ", " << glm::inverse(headPose)[1].z << endl;
-				cout << "inverse(headPose)[2]: " << glm::inverse(headPose)[2].x << ", " << glm::inverse(headPose)[2].y << ", " << glm::inverse(headPose)[2].z << endl;
+	// Each tracked controller casts a ray along its pointing direction (-z) into the cubes;
+	// both rays go through the picker together
+	void handPosesUpdated(const ovrPosef handPoses[2], const unsigned int handStatus[2]) override {
+		const unsigned int tracked = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+		RayPicker::Ray rays[2];
+		int rayHand[2];
+		int rayCount = 0;
+		for (int hand = 0; hand < 2; ++hand) {
+			if ((handStatus[hand] & tracked) == tracked) {
+				rays[rayCount].origin = ovr::toGlm(handPoses[hand].Position);
+				rays[rayCount].direction = ovr::toGlm(handPoses[hand].Orientation) * vec3(0.0f, 0.0f, -1.0f);
+				rayHand[rayCount++] = hand;
 			}
 		}
+		RayPicker::Hit hits[2];
+		if (rayCount) {
+			RayPicker::Stats stats = cubeScene->pickCubes(rays, rayCount, hits);
+			if (!stats.complete) {
+				LOG_WARN("Picking ran out of budget after %u of %u cubes", (unsigned int)stats.boxesTested, (unsigned int)cubeScene->cubePicker.size());
+			}
+		}
+		uint32_t targets[2] = { RayPicker::NoHit, RayPicker::NoHit };
+		float distances[2] = { 0.0f, 0.0f };
+		for (int r = 0; r < rayCount; ++r) {
+			targets[rayHand[r]] = hits[r].id;
+			distances[rayHand[r]] = hits[r].distance;
+		}
+		for (int hand = 0; hand < 2; ++hand) {
+			if (targets[hand] != pointedAt[hand]) {
+				pointedAt[hand] = targets[hand];
+				if (targets[hand] != RayPicker::NoHit) {
+					LOG_INFO("%s hand points at object %u, %.2f m away", hand == ovrHand_Left ? "Left" : "Right", targets[hand], distances[hand]);
+				}
+			}
+		}
+	}
+
+	void logSceneStats() override {
+		const culling::StereoStats & stats = cubeScene->cullStats;
+		LOG_INFO("Culling: %u objects tested, %u outside both eyes, %u visible left, %u visible right",
+			stats.tested, stats.rejected, stats.visible[ovrEye_Left], stats.visible[ovrEye_Right]);
+		LOG_INFO("Culling: %u occluded left, %u occluded right", stats.occluded[ovrEye_Left], stats.occluded[ovrEye_Right]);
+		if (cubeScene->gpuCulledFrame) {
+			unsigned int occluded[2];
+			cubeScene->gpuCuller.occludedCounts(occluded);
+			LOG_INFO("Culling: %u cubes culled on the GPU, not counted above; %u occluded left, %u occluded right",
+				(unsigned int)cubeScene->gpuCuller.instanceCount(), occluded[ovrEye_Left], occluded[ovrEye_Right]);
+		}
+	}
 
-		headPos_prev = headPos_curr;
+	// headPose has already been through the pose pipeline (freezing, super-rotation)
+	void renderScene(const glm::mat4 & projection, const glm::mat4 & headPose, bool isLeft, ovrEyeType viewport, int stereoEye) {
+		PROFILE_ZONE(viewport == ovrEye_Left ? "renderScene left" : "renderScene right");
+		const FrameState & state = frameState();
+		const mat4 view = rigid::inverse(headPose); // eye poses are rigid, no general inverse needed
+		cubeScene->render(state, projection, view, isLeft, viewport, stereoEye, !skyboxInCompositor, latchedView(isLeft));
 	}
 };
  
@@ -1223,16 +2650,56 @@ protected:
 int main(int argc, char** argv)
 {
 	int result = -1;
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--bench") {
+			BenchmarkSettings settings = { ColorCubeScene::PICK_DISTANCE, ColorCubeScene::PICK_BUDGET_US, ColorCubeScene::SCENE_SOURCE_PATH };
+			return runBenchmarks(settings) ? 0 : 1;
+		}
+		// --compile-scene in.txt out.bin converts a text scene offline
+		if (std::string(argv[i]) == "--compile-scene" && i + 2 < argc) {
+			try {
+				scene::compile(argv[i + 1], argv[i + 2]);
+				cout << "Compiled " << argv[i + 1] << " to " << argv[i + 2] << endl;
+				return 0;
+			}
+			catch (std::exception & error) {
+				cerr << error.what() << endl;
+				return 1;
+			}
+		}
+	}
+	// --serial-startup loads everything on this thread, where it is first needed,
+	// to compare time to first frame against the default; the frame loop still uses
+	// the workers
+	bool serialStartup = false;
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--serial-startup") {
+			serialStartup = true;
+		}
+	}
+	JobSystem jobs; // first, so it outlives everything that queues on it
+	StartupAssets startup(serialStartup ? nullptr : &jobs);
+	startup.start(ColorCubeScene::SCENE_PATH, ColorCubeScene::SCENE_SOURCE_PATH, ExampleApp::shaderPaths());
 	try {
 		if (!OVR_SUCCESS(ovr_Initialize(nullptr))) {
 			FAIL("Failed to initialize the Oculus SDK");
 		}
-		result = ExampleApp().run();
+		startup.tasks.mark("ovr_Initialize");
+		ExampleApp app(&startup);
+		app.setJobSystem(&jobs);
+		// --pipelined overlaps the next frame's update with this frame's submission
+		for (int i = 1; i < argc; ++i) {
+			if (std::string(argv[i]) == "--pipelined") {
+				app.setPipelined(true);
+			}
+		}
+		result = app.run();
 	}
 	catch (std::exception & error) {
 		OutputDebugStringA(error.what());
-		std::cerr << error.what() << std::endl;
+		LOG_ERROR("%s", error.what());
 	}
 	ovr_Shutdown();
+	logging::shutdown(); // writes out everything still queued
 	return result;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <mutex>
 using namespace std;
 
 #define GLFW_INCLUDE_GLEXT
@@ -20,6 +22,43 @@ using namespace std;
 
 #include "shader.h"
 
+// Sources read ahead by PrefetchShaderSource, by path
+static std::map<std::string, std::string> PrefetchedSources;
+static std::mutex PrefetchedSourcesMutex;
+
+// The file as the shaders are compiled from it, each line after a newline
+static bool ReadShaderFile(const char * file_path, std::string & code) {
+	std::ifstream stream(file_path, std::ios::in);
+	if (!stream.is_open()) {
+		return false;
+	}
+	std::string Line = "";
+	while (getline(stream, Line))
+		code += "\n" + Line;
+	return true;
+}
+
+// A prefetched source if there is one, read from the file otherwise
+static bool ReadShaderSource(const char * file_path, std::string & code) {
+	{
+		std::lock_guard<std::mutex> lock(PrefetchedSourcesMutex);
+		auto found = PrefetchedSources.find(file_path);
+		if (found != PrefetchedSources.end()) {
+			code = found->second;
+			return true;
+		}
+	}
+	return ReadShaderFile(file_path, code);
+}
+
+void PrefetchShaderSource(const char * file_path) {
+	std::string code;
+	if (ReadShaderFile(file_path, code)) {
+		std::lock_guard<std::mutex> lock(PrefetchedSourcesMutex);
+		PrefetchedSources[file_path] = code;
+	}
+}
+
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path) {
 
 	// Create the shaders
@@ -28,14 +67,7 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 
 																  // Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
-	else {
+	if (!ReadShaderSource(vertex_file_path, VertexShaderCode)) {
 		printf("Impossible to open %s. Check to make sure the file exists and you passed in the right filepath!\n", vertex_file_path);
 		printf("The current working directory is:");
 		// Please for the love of whatever deity/ies you believe in never do something like the next line of code,
@@ -51,13 +83,7 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 
 	// Read the Fragment Shader code from the file
 	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open()) {
-		std::string Line = "";
-		while (getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+	ReadShaderSource(fragment_file_path, FragmentShaderCode);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
@@ -126,3 +152,60 @@ GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_pat
 
 	return ProgramID;
 }
+
+// Compute programs need GL 4.3 (or ARB_compute_shader); returns 0 if the shader is
+// missing or fails to compile or link
+GLuint LoadComputeShader(const char * compute_file_path) {
+	std::string ComputeShaderCode;
+	if (!ReadShaderSource(compute_file_path, ComputeShaderCode)) {
+		printf("Impossible to open %s\n", compute_file_path);
+		return 0;
+	}
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Compile Compute Shader
+	printf("Compiling shader : %s\n", compute_file_path);
+	GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
+	char const * ComputeSourcePointer = ComputeShaderCode.c_str();
+	glShaderSource(ComputeShaderID, 1, &ComputeSourcePointer, NULL);
+	glCompileShader(ComputeShaderID);
+
+	// Check Compute Shader
+	glGetShaderiv(ComputeShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(ComputeShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength > 0) {
+		std::vector<char> ComputeShaderErrorMessage(InfoLogLength + 1);
+		glGetShaderInfoLog(ComputeShaderID, InfoLogLength, NULL, &ComputeShaderErrorMessage[0]);
+		printf("%s\n", &ComputeShaderErrorMessage[0]);
+	}
+	if (Result != GL_TRUE) {
+		glDeleteShader(ComputeShaderID);
+		return 0;
+	}
+
+	// Link the program
+	printf("Linking program\n");
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, ComputeShaderID);
+	glLinkProgram(ProgramID);
+
+	// Check the program
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength > 0) {
+		std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+
+	glDetachShader(ProgramID, ComputeShaderID);
+	glDeleteShader(ComputeShaderID);
+
+	if (Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
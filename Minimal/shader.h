@@ -3,5 +3,10 @@
 #define SHADER_HPP
 
 GLuint LoadShaders(const char * vertex_file_path, const char * fragment_file_path);
+GLuint LoadComputeShader(const char * compute_file_path);
+
+// Reads a shader file ahead of time, from any thread; the Load functions then take the
+// source from memory. A file that can't be read is left to them to report.
+void PrefetchShaderSource(const char * file_path);
 
 #endif
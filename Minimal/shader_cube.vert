@@ -6,10 +6,18 @@ out vec3 TexCoords;
 uniform mat4 projection; //
 uniform mat4 view; // modelView
 
-uniform mat4 model; // used for scaling
+// per instance from the frame ring, or one constant value for a single draw
+layout (location = 2) in mat4 model;
+
+// per-eye views rewritten from a late head pose sample just before the GPU runs
+layout (std140) uniform LateLatch {
+    mat4 latchedViews[2];
+};
+uniform int latchedView; // index into latchedViews, or -1 to use view
 
 void main()
 {       
     TexCoords = aPos;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    mat4 eyeView = latchedView >= 0 ? latchedViews[latchedView] : view;
+    gl_Position = projection * eyeView * model * vec4(aPos, 1.0);
 }
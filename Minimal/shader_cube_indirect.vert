@@ -0,0 +1,26 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in uint instanceIndex; // from the culled list, one per instance
+
+out vec3 TexCoords;
+
+uniform mat4 projection; //
+uniform mat4 view; // modelView
+
+// every instance's model matrix, indexed by instanceIndex
+layout (std430, binding = 4) readonly buffer Models {
+    mat4 models[];
+};
+
+// per-eye views rewritten from a late head pose sample just before the GPU runs
+layout (std140) uniform LateLatch {
+    mat4 latchedViews[2];
+};
+uniform int latchedView; // index into latchedViews, or -1 to use view
+
+void main()
+{       
+    TexCoords = aPos;
+    mat4 eyeView = latchedView >= 0 ? latchedViews[latchedView] : view;
+    gl_Position = projection * eyeView * models[instanceIndex] * vec4(aPos, 1.0);
+}
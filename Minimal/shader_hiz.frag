@@ -0,0 +1,25 @@
+#version 330 core
+
+// Reduces one eye viewport of the depth buffer to a coarse grid: each cell keeps the
+// farthest depth under it, so anything behind a cell is hidden everywhere in it
+out float farthest;
+
+uniform sampler2D depthTex;
+uniform ivec4 sourceViewport; // the eye's x, y, width, height in depth texels
+uniform ivec2 gridOrigin;     // where this eye's grid starts in the target
+uniform ivec2 gridSize;
+
+void main()
+{
+    ivec2 cell = ivec2(gl_FragCoord.xy) - gridOrigin;
+    // cells share the texels on their borders where the viewport doesn't divide evenly
+    ivec2 begin = sourceViewport.xy + cell * sourceViewport.zw / gridSize;
+    ivec2 end = sourceViewport.xy + ((cell + 1) * sourceViewport.zw + gridSize - 1) / gridSize;
+    float depth = 0.0;
+    for (int y = begin.y; y < end.y; ++y) {
+        for (int x = begin.x; x < end.x; ++x) {
+            depth = max(depth, texelFetch(depthTex, ivec2(x, y), 0).r);
+        }
+    }
+    farthest = depth;
+}
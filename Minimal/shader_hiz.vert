@@ -0,0 +1,8 @@
+#version 330 core
+// a triangle covering the viewport, no vertex buffer needed
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);
+    gl_Position = vec4(corner, 0.0, 1.0);
+}
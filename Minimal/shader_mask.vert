@@ -0,0 +1,8 @@
+#version 330 core
+layout (location = 0) in vec2 aPos; // hidden area mesh in normalized device coordinates
+
+void main()
+{
+    // on the near plane, so everything drawn afterwards fails the depth test here
+    gl_Position = vec4(aPos, -1.0, 1.0);
+}